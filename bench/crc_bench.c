@@ -0,0 +1,109 @@
+/*  
+  File:         crc_bench.c
+  Written by:   Rod Boyce
+  e-mail:       rod@boyce.net.nz
+
+  This file is part of lpc935-prog
+  
+  lpc935-prog is free software; you can redistribute it and/or modify
+  it under the terms of the Lesser GNU General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  lpc935-prog is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser
+  GNU General Public License for more details.
+
+  You should have received a copy of the Lesser GNU General Public
+  License along with lpc935-prog; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+  USA
+*/
+/*
+  Micro benchmark of the host CRC engine.  Times the slice by 4 code in
+  crc.c against a plain bit at a time version of the same CRC over an
+  8 KB image.  test/crc_test.c checks the answers.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../crc.h"
+
+#define BENCH_LOOPS 2000
+
+static unsigned long bench_BitCrc( const unsigned char *pbData, unsigned int lLen );
+static long long bench_Usec( void );
+
+
+int main( int argc, char **argv )
+{
+    static unsigned char abRom[ CRC_FLASH_SIZE ];
+    volatile unsigned long lSink = 0;
+    long long llStart;
+    long long llTable;
+    long long llBit;
+    int i;
+
+    srand( 1 );
+    for( i = 0; i < sizeof( abRom ); i++ )
+    {
+        abRom[ i ] = rand() & 0xff;
+    }
+
+    llStart = bench_Usec();
+    for( i = 0; i < BENCH_LOOPS; i++ )
+    {
+        lSink ^= crc_Global( abRom );
+    }
+    llTable = bench_Usec() - llStart;
+
+    llStart = bench_Usec();
+    for( i = 0; i < BENCH_LOOPS / 10; i++ )
+    {
+        lSink ^= bench_BitCrc( abRom, CRC_FLASH_SIZE );
+    }
+    llBit = ( bench_Usec() - llStart ) * 10;
+
+    printf( "crc,slice4,%lld ns/image,%.1f MB/s\n",
+            llTable * 1000 / BENCH_LOOPS,
+            ( double )CRC_FLASH_SIZE * BENCH_LOOPS / ( llTable > 0 ? llTable : 1 ));
+    printf( "crc,bitwise,%lld ns/image,%.1f MB/s\n",
+            llBit * 1000 / BENCH_LOOPS,
+            ( double )CRC_FLASH_SIZE * BENCH_LOOPS / ( llBit > 0 ? llBit : 1 ));
+
+    return( 0 );
+}
+
+
+/*
+  Straight from the polynomial, one bit at a time
+ */
+static unsigned long bench_BitCrc( const unsigned char *pbData, unsigned int lLen )
+{
+    unsigned long lCrc = 0;
+    int zBit;
+
+    while( lLen-- > 0 )
+    {
+        lCrc ^= ( unsigned long )*pbData++ << 24;
+        for( zBit = 0; zBit < 8; zBit++ )
+        {
+            lCrc = ( 0 != ( lCrc & 0x80000000UL )) ? ( lCrc << 1 ) ^ 0x04c11db7UL : ( lCrc << 1 );
+        }
+        lCrc &= 0xffffffffUL;
+    }
+
+    return( lCrc );
+}
+
+
+static long long bench_Usec( void )
+{
+    struct timespec sTs;
+
+    clock_gettime( CLOCK_MONOTONIC, &sTs );
+
+    return(( long long )sTs.tv_sec * 1000000LL + sTs.tv_nsec / 1000 );
+}
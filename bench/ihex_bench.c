@@ -0,0 +1,401 @@
+/*
+  File:         ihex_bench.c
+  Written by:   Rod Boyce
+  e-mail:       rod@boyce.net.nz
+
+  This file is part of lpc935-prog
+
+  lpc935-prog is free software; you can redistribute it and/or modify
+  it under the terms of the Lesser GNU General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  lpc935-prog is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser
+  GNU General Public License for more details.
+
+  You should have received a copy of the Lesser GNU General Public
+  License along with lpc935-prog; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+  USA
+*/
+/*
+  Micro benchmark of the host side Intel hex code.  Times writing an 8 KB
+  image to a hex file, reading it back and encoding it as 64 byte ISP
+  records with snintel_hex, and checks the image survives the round trip.
+  A 64 KB file made of several images, each with its own end of file
+  record, is also read with read_intel_hex_map and with the fgets and
+  nibble() parser it replaced, which must give the same image and map.
+  The whole image is also encoded into one buffer with put_intel_hex and
+  with the snprintf encoder it replaced, which must give the same text.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../ihex.h"
+
+#define BENCH_IMAGE  8192
+#define BENCH_RECORD 64
+#define BENCH_LOOPS  200
+/* The multi image file, BENCH_PARTS images of BENCH_PART bytes */
+#define BENCH_BIG    65536
+#define BENCH_PARTS  8
+#define BENCH_PART   ( BENCH_BIG / BENCH_PARTS )
+#define BENCH_BIG_LOOPS 50
+/* The whole image as back to back BENCH_RECORD byte records */
+#define BENCH_TEXT   (( BENCH_IMAGE / BENCH_RECORD ) * INTEL_HEX_LEN( BENCH_RECORD ))
+
+static void bench_Report( const char *pacName, long long llTime, int zLoops );
+static void bench_ReportSize( const char *pacName, long long llTime, int zLoops, int zSize );
+static int bench_WriteMulti( char *pacFile, unsigned char *pabRom );
+static int bench_OldRead( char *pacFile, unsigned char *pabData, unsigned char *pabMap,
+                          unsigned int lLen );
+static int bench_OldNibble( char c );
+static unsigned int bench_OldEncode( char abString[], unsigned int lStrLen,
+                                     unsigned char bRecId, unsigned char *pbBuff,
+                                     unsigned char bBufLen, unsigned short wStartAddr );
+static long long bench_Usec( void );
+
+
+int main( int argc, char **argv )
+{
+    static unsigned char abRom[ BENCH_IMAGE ];
+    static unsigned char abBack[ BENCH_IMAGE ];
+    static unsigned char abBig[ BENCH_BIG ];
+    static unsigned char abNew[ BENCH_BIG ];
+    static unsigned char abNewMap[ BENCH_BIG ];
+    static unsigned char abOld[ BENCH_BIG ];
+    static unsigned char abOldMap[ BENCH_BIG ];
+    static char acNewText[ BENCH_TEXT ];
+    static char acOldText[ BENCH_TEXT + 1 ];
+    char acFile[] = "/tmp/ihex_benchXXXXXX";
+    char acRec[ INTEL_HEX_LEN( BENCH_RECORD ) + 1 ];
+    volatile unsigned int lSink = 0;
+    unsigned int lPos;
+    long long llStart;
+    int zErrors = 0;
+    int zFd;
+    int i;
+    int j;
+
+    srand( 1 );
+    for( i = 0; i < sizeof( abRom ); i++ )
+    {
+        abRom[ i ] = rand() & 0xff;
+    }
+
+    zFd = mkstemp( acFile );
+    if( 0 > zFd )
+    {
+        perror( "ihex_bench: mkstemp" );
+        return( 1 );
+    }
+    close( zFd );
+
+    /* Check the image makes it through a file and back */
+    write_intel_hex( abRom, sizeof( abRom ), 16, acFile );
+    memset( abBack, 0xff, sizeof( abBack ));
+    read_intel_hex( acFile, abBack, sizeof( abBack ));
+    if( 0 != memcmp( abRom, abBack, sizeof( abRom )))
+    {
+        printf( "Image read back from %s does not match\n", acFile );
+        zErrors++;
+    }
+
+    llStart = bench_Usec();
+    for( i = 0; i < BENCH_LOOPS; i++ )
+    {
+        write_intel_hex( abRom, sizeof( abRom ), 16, acFile );
+    }
+    bench_Report( "write_intel_hex", bench_Usec() - llStart, BENCH_LOOPS );
+
+    llStart = bench_Usec();
+    for( i = 0; i < BENCH_LOOPS; i++ )
+    {
+        lSink += read_intel_hex( acFile, abBack, sizeof( abBack ));
+    }
+    bench_Report( "read_intel_hex", bench_Usec() - llStart, BENCH_LOOPS );
+
+    llStart = bench_Usec();
+    for( i = 0; i < BENCH_LOOPS * 10; i++ )
+    {
+        for( j = 0; j < sizeof( abRom ); j += BENCH_RECORD )
+        {
+            lSink += snintel_hex( acRec, sizeof( acRec ), 0, &abRom[ j ], BENCH_RECORD, j );
+        }
+    }
+    bench_Report( "snintel_hex", bench_Usec() - llStart, BENCH_LOOPS * 10 );
+
+    /* Both encoders must give the same text for the whole image */
+    lPos = 0;
+    for( j = 0; j < sizeof( abRom ); j += BENCH_RECORD )
+    {
+        lPos += put_intel_hex( &acNewText[ lPos ], 0, &abRom[ j ], BENCH_RECORD, j );
+    }
+    lSink += lPos;
+    for( lPos = 0, j = 0; j < sizeof( abRom ); j += BENCH_RECORD )
+    {
+        lPos += bench_OldEncode( &acOldText[ lPos ], sizeof( acOldText ) - lPos, 0,
+                                 &abRom[ j ], BENCH_RECORD, j );
+    }
+    if(( BENCH_TEXT != lPos ) || ( 0 != memcmp( acNewText, acOldText, BENCH_TEXT )))
+    {
+        printf( "put_intel_hex and the old encoder differ on the image\n" );
+        zErrors++;
+    }
+
+    llStart = bench_Usec();
+    for( i = 0; i < BENCH_LOOPS * 10; i++ )
+    {
+        for( lPos = 0, j = 0; j < sizeof( abRom ); j += BENCH_RECORD )
+        {
+            lPos += put_intel_hex( &acNewText[ lPos ], 0, &abRom[ j ], BENCH_RECORD, j );
+        }
+        lSink += lPos;
+    }
+    bench_Report( "put_intel_hex image", bench_Usec() - llStart, BENCH_LOOPS * 10 );
+
+    llStart = bench_Usec();
+    for( i = 0; i < BENCH_LOOPS * 10; i++ )
+    {
+        for( lPos = 0, j = 0; j < sizeof( abRom ); j += BENCH_RECORD )
+        {
+            lPos += bench_OldEncode( &acOldText[ lPos ], sizeof( acOldText ) - lPos, 0,
+                                     &abRom[ j ], BENCH_RECORD, j );
+        }
+        lSink += lPos;
+    }
+    bench_Report( "snprintf_strlen image", bench_Usec() - llStart, BENCH_LOOPS * 10 );
+
+    /* Both parsers must agree on the multi image file */
+    for( i = 0; i < sizeof( abBig ); i++ )
+    {
+        abBig[ i ] = rand() & 0xff;
+    }
+    bench_WriteMulti( acFile, abBig );
+    memset( abNew, 0xff, sizeof( abNew ));
+    memset( abNewMap, 0, sizeof( abNewMap ));
+    memset( abOld, 0xff, sizeof( abOld ));
+    memset( abOldMap, 0, sizeof( abOldMap ));
+    if(( read_intel_hex_map( acFile, abNew, abNewMap, sizeof( abNew )) !=
+         bench_OldRead( acFile, abOld, abOldMap, sizeof( abOld ))) ||
+       ( 0 != memcmp( abNew, abOld, sizeof( abNew ))) ||
+       ( 0 != memcmp( abNewMap, abOldMap, sizeof( abNewMap ))))
+    {
+        printf( "read_intel_hex_map and the old parser differ on the multi image file\n" );
+        zErrors++;
+    }
+
+    llStart = bench_Usec();
+    for( i = 0; i < BENCH_BIG_LOOPS; i++ )
+    {
+        lSink += read_intel_hex_map( acFile, abNew, abNewMap, sizeof( abNew ));
+    }
+    bench_ReportSize( "read_intel_hex_map 64K", bench_Usec() - llStart, BENCH_BIG_LOOPS,
+                      BENCH_BIG );
+
+    llStart = bench_Usec();
+    for( i = 0; i < BENCH_BIG_LOOPS; i++ )
+    {
+        lSink += bench_OldRead( acFile, abOld, abOldMap, sizeof( abOld ));
+    }
+    bench_ReportSize( "fgets_nibble 64K", bench_Usec() - llStart, BENCH_BIG_LOOPS, BENCH_BIG );
+
+    unlink( acFile );
+
+    return(( 0 == zErrors ) ? 0 : 1 );
+}
+
+
+/*
+  One CSV line per function, time for a whole image and the data rate
+ */
+static void bench_Report( const char *pacName, long long llTime, int zLoops )
+{
+    bench_ReportSize( pacName, llTime, zLoops, BENCH_IMAGE );
+}
+
+
+static void bench_ReportSize( const char *pacName, long long llTime, int zLoops, int zSize )
+{
+    printf( "ihex,%s,%lld ns/image,%.1f MB/s\n", pacName, llTime * 1000 / zLoops,
+            ( double )zSize * zLoops / ( llTime > 0 ? llTime : 1 ));
+}
+
+
+/*
+  Write pabRom as BENCH_PARTS images one after the other, each of 32 byte
+  records with its own end of file record and a line of text between
+  them, the way several tools' output gets concatenated.
+ */
+static int bench_WriteMulti( char *pacFile, unsigned char *pabRom )
+{
+    char acRec[ 11 + 2 * 32 + 1 ];
+    FILE *psOut;
+    int zPart;
+    int zAddr;
+
+    if( NULL == ( psOut = fopen( pacFile, "wt" )))
+    {
+        return( -1 );
+    }
+
+    for( zPart = 0; zPart < BENCH_PARTS; zPart++ )
+    {
+        fprintf( psOut, "image %d\n", zPart );
+        for( zAddr = zPart * BENCH_PART; zAddr < ( zPart + 1 ) * BENCH_PART; zAddr += 32 )
+        {
+            snintel_hex( acRec, sizeof( acRec ), 0, &pabRom[ zAddr ], 32, zAddr );
+            fprintf( psOut, "%s\r\n", acRec );
+        }
+        fprintf( psOut, ":00000001FF\r\n" );
+    }
+    fclose( psOut );
+
+    return( 0 );
+}
+
+
+/*
+  The encoder snintel_hex used before it was table driven, kept as the
+  reference.  snprintf two digits then strlen to find the end, per byte.
+ */
+static unsigned int bench_OldEncode( char abString[], unsigned int lStrLen,
+                                     unsigned char bRecId, unsigned char *pbBuff,
+                                     unsigned char bBufLen, unsigned short wStartAddr )
+{
+    unsigned int lCurStrPos;
+    unsigned char bSum;
+    int i;
+
+    memset( abString, 0, lStrLen );
+    abString[ 0 ] = ':';
+    lCurStrPos = strlen( abString );
+    snprintf( &abString[ lCurStrPos ], lStrLen - lCurStrPos, "%02x", bBufLen );
+    lCurStrPos = strlen( abString );
+    bSum = bBufLen;
+
+    snprintf( &abString[ lCurStrPos ], lStrLen - lCurStrPos, "%04x", wStartAddr );
+    lCurStrPos = strlen( abString );
+    bSum += ( wStartAddr >> 8 );
+    bSum += ( wStartAddr & 0xff );
+
+    snprintf( &abString[ lCurStrPos ], lStrLen - lCurStrPos, "%02x", bRecId );
+    lCurStrPos = strlen( abString );
+    bSum += bRecId;
+
+    for( i = 0; i < bBufLen; i++ )
+    {
+        snprintf( &abString[ lCurStrPos ], lStrLen - lCurStrPos, "%02x", *( pbBuff + i ));
+        lCurStrPos = strlen( abString );
+        bSum += *( pbBuff + i );
+    }
+
+    bSum = ( 0x100 - bSum ) & 0xff;
+    snprintf( &abString[ lCurStrPos ], lStrLen - lCurStrPos, "%02x", bSum );
+    lCurStrPos = strlen( abString );
+
+    return( lCurStrPos );
+}
+
+
+/*
+  The parser read_intel_hex_map used before it was table driven, kept as
+  the reference.  fgets a line, checksum it, then decode it again.
+ */
+static int bench_OldRead( char *pacFile, unsigned char *pabData, unsigned char *pabMap,
+                          unsigned int lLen )
+{
+    FILE *in;
+    char buff[ 524 ];
+    unsigned int max_addr = 0;
+    unsigned int rec_len;
+    unsigned int taddr;
+    unsigned int i;
+    int csum;
+    int len;
+
+    if( NULL == ( in = fopen( pacFile, "rt" )))
+    {
+        return( -1 );
+    }
+
+    while( NULL != fgets( buff, sizeof( buff ) - 2, in ))
+    {
+        if( ':' != buff[ 0 ])
+        {
+            continue;
+        }
+
+        len = strlen( buff ) - 2;
+        for( csum = 0, i = 1; i < len; i += 2 )
+        {
+            csum += ( bench_OldNibble( buff[ i ]) << 4 ) + bench_OldNibble( buff[ i + 1 ]);
+        }
+        if( 0 != ( csum & 0xff ))
+        {
+            fclose( in );
+            return( -2 );
+        }
+
+        if( 0 != (( bench_OldNibble( buff[ 7 ]) << 4 ) + bench_OldNibble( buff[ 8 ])))
+        {
+            continue;
+        }
+        rec_len = ( bench_OldNibble( buff[ 1 ]) << 4 ) + bench_OldNibble( buff[ 2 ]);
+        taddr = ( bench_OldNibble( buff[ 3 ]) << 12 ) + ( bench_OldNibble( buff[ 4 ]) << 8 ) +
+            ( bench_OldNibble( buff[ 5 ]) << 4 ) + bench_OldNibble( buff[ 6 ]);
+        for( i = 0; i < rec_len; i++ )
+        {
+            if( taddr + i >= lLen )
+            {
+                fclose( in );
+                return( -3 );
+            }
+            if( taddr + i > max_addr )
+            {
+                max_addr = taddr + i;
+            }
+            pabData[ taddr + i ] = ( bench_OldNibble( buff[ 9 + i * 2 ]) << 4 ) +
+                bench_OldNibble( buff[ 10 + i * 2 ]);
+            pabMap[ taddr + i ] = 1;
+        }
+    }
+    fclose( in );
+
+    return( max_addr );
+}
+
+
+static int bench_OldNibble( char c )
+{
+    if( isascii( c ) && isxdigit( c ))
+    {
+        if( isdigit( c ))
+        {
+            return( c - '0' );
+        }
+        if( isupper( c ))
+        {
+            return( c - 'A' + 10 );
+        }
+        return( c - 'a' + 10 );
+    }
+
+    return( -1 );
+}
+
+
+static long long bench_Usec( void )
+{
+    struct timespec sTs;
+
+    clock_gettime( CLOCK_MONOTONIC, &sTs );
+
+    return(( long long )sTs.tv_sec * 1000000LL + sTs.tv_nsec / 1000 );
+}
@@ -0,0 +1,339 @@
+/*
+  File:         isp_bench.c
+  Written by:   Rod Boyce
+  e-mail:       rod@boyce.net.nz
+
+  This file is part of lpc935-prog
+
+  lpc935-prog is free software; you can redistribute it and/or modify
+  it under the terms of the Lesser GNU General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  lpc935-prog is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser
+  GNU General Public License for more details.
+
+  You should have received a copy of the Lesser GNU General Public
+  License along with lpc935-prog; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+  USA
+*/
+/*
+  End to end benchmark of a programming session.  Starts lpc935-emu and
+  drives it through liblpc935 over a matrix of image sizes, sparse and
+  dense images, line rates and record sizes.  Each run times boot loader
+  entry, autobaud, erase, programming and a CRC verify and is printed as
+  one CSV line.
+
+      isp_bench [-q] [-j FILE] [-e EMULATOR]
+
+  -q runs a single case, -j also writes the results to FILE as JSON and
+  -e gives the emulator to run, ./lpc935-emu by default.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../crc.h"
+#include "../lpc935.h"
+
+/* Result of one run of the matrix */
+typedef struct
+{
+    int zSize; /**< Bytes of flash the image spans */
+    int zSparse; /**< Set if only every other page is used */
+    int zBaud; /**< Line rate */
+    int zRecSize; /**< Data bytes per program record */
+    int zBytes; /**< Data bytes programmed */
+    long long llEntry; /**< Boot loader entry in microseconds */
+    long long llSync; /**< Autobaud */
+    long long llErase; /**< Sector erases */
+    long long llProgram; /**< Program records */
+    long long llVerify; /**< Sector CRC reads and compares */
+    int zOk; /**< Set if every phase worked and the CRCs matched */
+} tsBenchRun;
+
+static const int azSizes[] = { 1024, 8192 };
+static const int azBauds[] = { 19200, 115200 };
+static const int azRecSizes[] = { 16, 64 };
+#define N_SIZES     ( sizeof( azSizes ) / sizeof( azSizes[ 0 ]))
+#define N_BAUDS     ( sizeof( azBauds ) / sizeof( azBauds[ 0 ]))
+#define N_REC_SIZES ( sizeof( azRecSizes ) / sizeof( azRecSizes[ 0 ]))
+
+static pid_t bench_StartEmu( char *pacEmu, char *pacPort, int zSize, FILE **ppsEmu );
+static void bench_MakeImage( unsigned char *pabRom, unsigned char *pabUsed, int zSize,
+                             int zSparse );
+static void bench_Run( char *pacPort, tsBenchRun *psRun );
+static void bench_Quiet( void *pvUser, teLOG_LEVEL eLevel, const char *pacMsg );
+static void bench_Csv( tsBenchRun *psRun );
+static void bench_Json( FILE *psOut, tsBenchRun *psRun, int zFirst );
+
+
+int main( int argc, char **argv )
+{
+    tsBenchRun sRun;
+    char acPort[ 256 ];
+    char *pacEmu = "./lpc935-emu";
+    char *pacJson = NULL;
+    FILE *psJson = NULL;
+    FILE *psEmu;
+    char acLine[ 256 ];
+    int zQuick = 0;
+    int zFailed = 0;
+    int zRuns = 0;
+    int zSize;
+    int zSparse;
+    int zBaud;
+    int zRec;
+    pid_t tEmu;
+    int i;
+
+    for( i = 1; i < argc; i++ )
+    {
+        if( 0 == strcmp( "-q", argv[ i ]))
+        {
+            zQuick = 1;
+        }
+        else if(( 0 == strcmp( "-j", argv[ i ])) && ( i + 1 < argc ))
+        {
+            pacJson = argv[ ++i ];
+        }
+        else if(( 0 == strcmp( "-e", argv[ i ])) && ( i + 1 < argc ))
+        {
+            pacEmu = argv[ ++i ];
+        }
+        else
+        {
+            fprintf( stderr, "usage: %s [-q] [-j FILE] [-e EMULATOR]\n", argv[ 0 ]);
+            return( 1 );
+        }
+    }
+
+    tEmu = bench_StartEmu( pacEmu, acPort, sizeof( acPort ), &psEmu );
+    if( 0 > tEmu )
+    {
+        return( 1 );
+    }
+
+    if(( NULL != pacJson ) && ( NULL == ( psJson = fopen( pacJson, "wt" ))))
+    {
+        perror( pacJson );
+    }
+    if( NULL != psJson )
+    {
+        fprintf( psJson, "[\n" );
+    }
+
+    printf( "size,sparse,baud,record,bytes,entry_ms,sync_ms,erase_ms,program_ms,"
+            "program_Bps,verify_ms,result\n" );
+    /* The quick run is only the last case, the biggest image at the
+       fastest rate */
+    for( zSize = zQuick ? N_SIZES - 1 : 0; zSize < N_SIZES; zSize++ )
+    {
+        for( zSparse = 0; zSparse < ( zQuick ? 1 : 2 ); zSparse++ )
+        {
+            for( zBaud = zQuick ? N_BAUDS - 1 : 0; zBaud < N_BAUDS; zBaud++ )
+            {
+                for( zRec = zQuick ? N_REC_SIZES - 1 : 0; zRec < N_REC_SIZES; zRec++ )
+                {
+                    memset( &sRun, 0, sizeof( sRun ));
+                    sRun.zSize = azSizes[ zSize ];
+                    sRun.zSparse = zSparse;
+                    sRun.zBaud = azBauds[ zBaud ];
+                    sRun.zRecSize = azRecSizes[ zRec ];
+
+                    bench_Run( acPort, &sRun );
+                    bench_Csv( &sRun );
+                    if( NULL != psJson )
+                    {
+                        bench_Json( psJson, &sRun, 0 == zRuns );
+                    }
+                    zFailed |= !sRun.zOk;
+                    zRuns++;
+                }
+            }
+        }
+    }
+
+    if( NULL != psJson )
+    {
+        fprintf( psJson, "\n]\n" );
+        fclose( psJson );
+    }
+
+    /* Pass on the emulator's totals */
+    kill( tEmu, SIGTERM );
+    waitpid( tEmu, NULL, 0 );
+    while( NULL != fgets( acLine, sizeof( acLine ), psEmu ))
+    {
+        fprintf( stderr, "%s", acLine );
+    }
+    fclose( psEmu );
+
+    return(( 0 == zFailed ) ? 0 : 1 );
+}
+
+
+/*
+  Run the emulator with its output on a pipe and read back the name of
+  the terminal it opened.  The rest of its output is left in *ppsEmu.
+  Returns the pid of the emulator or -1.
+ */
+static pid_t bench_StartEmu( char *pacEmu, char *pacPort, int zSize, FILE **ppsEmu )
+{
+    int azPipe[ 2 ];
+    pid_t tPid;
+
+    if( 0 != pipe( azPipe ))
+    {
+        perror( "isp_bench: pipe" );
+        return( -1 );
+    }
+
+    tPid = fork();
+    if( 0 == tPid )
+    {
+        dup2( azPipe[ 1 ], STDOUT_FILENO );
+        close( azPipe[ 0 ]);
+        close( azPipe[ 1 ]);
+        execl( pacEmu, pacEmu, ( char * )NULL );
+        perror( pacEmu );
+        _exit( 127 );
+    }
+    close( azPipe[ 1 ]);
+
+    *ppsEmu = fdopen( azPipe[ 0 ], "rt" );
+    if(( 0 > tPid ) || ( NULL == *ppsEmu ) || ( NULL == fgets( pacPort, zSize, *ppsEmu )))
+    {
+        fprintf( stderr, "isp_bench: could not start %s\n", pacEmu );
+        return( -1 );
+    }
+    pacPort[ strcspn( pacPort, "\r\n" )] = '\0';
+
+    return( tPid );
+}
+
+
+/*
+  Random image data covering the first zSize bytes, or every other page of
+  them for a sparse image.  Bytes the image does not use are left blank.
+ */
+static void bench_MakeImage( unsigned char *pabRom, unsigned char *pabUsed, int zSize,
+                             int zSparse )
+{
+    int i;
+
+    srand( zSize + zSparse );
+    memset( pabRom, 0xff, CRC_FLASH_SIZE );
+    memset( pabUsed, 0, CRC_FLASH_SIZE );
+    for( i = 0; i < zSize; i++ )
+    {
+        if(( 0 == zSparse ) || ( 0 == (( i / FLASH_PAGE_SIZE ) & 1 )))
+        {
+            pabRom[ i ] = rand() & 0xff;
+            pabUsed[ i ] = 1;
+        }
+    }
+}
+
+
+/*
+  One complete session against the emulator, filling in the times.
+ */
+static void bench_Run( char *pacPort, tsBenchRun *psRun )
+{
+    static unsigned char abRom[ CRC_FLASH_SIZE ];
+    static unsigned char abUsed[ CRC_FLASH_SIZE ];
+    unsigned long lCrc;
+    long long llStart;
+    tsLpcCtx sCtx;
+    int zOk = 1;
+    int zSector;
+
+    bench_MakeImage( abRom, abUsed, psRun->zSize, psRun->zSparse );
+
+    lpc_Init( &sCtx );
+    sCtx.zBaud = psRun->zBaud;
+    sCtx.zRecSize = psRun->zRecSize;
+    sCtx.fLog = bench_Quiet;
+    if( 0 != lpc_Open( &sCtx, pacPort ))
+    {
+        fprintf( stderr, "isp_bench: could not open %s\n", pacPort );
+        return;
+    }
+
+    llStart = lpc_Usec();
+    lpc_EnterBootLoader( &sCtx );
+    psRun->llEntry = lpc_Usec() - llStart;
+
+    llStart = lpc_Usec();
+    zOk = ( 0 == lpc_SyncBaud( &sCtx ));
+    psRun->llSync = lpc_Usec() - llStart;
+
+    llStart = lpc_Usec();
+    for( zSector = 0; zOk && ( zSector < psRun->zSize ); zSector += CRC_SECTOR_SIZE )
+    {
+        zOk = ( 0 == lpc_Erase( &sCtx, DO_SECTOR, zSector ));
+    }
+    psRun->llErase = lpc_Usec() - llStart;
+
+    if( zOk )
+    {
+        llStart = lpc_Usec();
+        psRun->zBytes = lpc_ProgramBuffer( &sCtx, abRom, abUsed, 0, psRun->zSize - 1 );
+        psRun->llProgram = lpc_Usec() - llStart;
+        zOk = ( 0 < psRun->zBytes );
+    }
+
+    llStart = lpc_Usec();
+    for( zSector = 0; zOk && ( zSector < psRun->zSize ); zSector += CRC_SECTOR_SIZE )
+    {
+        zOk = (( 0 == lpc_GetSectorCrc( &sCtx, zSector, &lCrc )) &&
+               ( lCrc == crc_Sector( abRom, zSector )));
+    }
+    psRun->llVerify = lpc_Usec() - llStart;
+
+    lpc_Close( &sCtx );
+    psRun->zOk = zOk;
+}
+
+
+/*
+  Only errors are worth seeing while benchmarking
+ */
+static void bench_Quiet( void *pvUser, teLOG_LEVEL eLevel, const char *pacMsg )
+{
+    if( eLOG_ERROR == eLevel )
+    {
+        fprintf( stderr, "%s", pacMsg );
+    }
+}
+
+
+static void bench_Csv( tsBenchRun *psRun )
+{
+    printf( "%d,%s,%d,%d,%d,%.1f,%.1f,%.1f,%.1f,%lld,%.1f,%s\n",
+            psRun->zSize, psRun->zSparse ? "sparse" : "dense", psRun->zBaud,
+            psRun->zRecSize, psRun->zBytes, psRun->llEntry / 1000.0, psRun->llSync / 1000.0,
+            psRun->llErase / 1000.0, psRun->llProgram / 1000.0,
+            ( psRun->llProgram > 0 ) ? ( psRun->zBytes * 1000000LL ) / psRun->llProgram : 0,
+            psRun->llVerify / 1000.0, psRun->zOk ? "pass" : "fail" );
+    fflush( stdout );
+}
+
+
+static void bench_Json( FILE *psOut, tsBenchRun *psRun, int zFirst )
+{
+    fprintf( psOut, "%s  { \"size\": %d, \"sparse\": %s, \"baud\": %d, \"record\": %d, "
+             "\"bytes\": %d, \"entry_us\": %lld, \"sync_us\": %lld, \"erase_us\": %lld, "
+             "\"program_us\": %lld, \"verify_us\": %lld, \"pass\": %s }",
+             zFirst ? "" : ",\n", psRun->zSize, psRun->zSparse ? "true" : "false",
+             psRun->zBaud, psRun->zRecSize, psRun->zBytes, psRun->llEntry, psRun->llSync,
+             psRun->llErase, psRun->llProgram, psRun->llVerify,
+             psRun->zOk ? "true" : "false" );
+}
@@ -0,0 +1,301 @@
+/*  
+  File:         crc.c
+  Written by:   Rod Boyce
+  e-mail:       rod@boyce.net.nz
+
+  This file is part of lpc935-prog
+  
+  lpc935-prog is free software; you can redistribute it and/or modify
+  it under the terms of the Lesser GNU General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  lpc935-prog is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser
+  GNU General Public License for more details.
+
+  You should have received a copy of the Lesser GNU General Public
+  License along with lpc935-prog; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+  USA
+*/
+#include "crc.h"
+
+/* The boot loader CRC is the 32 bit polynomial
+   x32+x26+x23+x22+x16+x12+x11+x10+x8+x7+x5+x4+x2+x+1
+   fed most significant bit first starting from 0 */
+#define CRC_POLY   0x04c11db7U
+
+/* Slice by 4 lookup tables, entry [ k ][ n ] is the CRC of byte n followed
+   by k zero bytes.  Made from CRC_POLY ahead of time so they are never
+   written and any number of threads may share them, test/crc_test.c
+   checks them against the polynomial */
+static const unsigned int aalCrcTable[ 4 ][ 256 ] =
+{
+    {
+        0x00000000U, 0x04c11db7U, 0x09823b6eU, 0x0d4326d9U, 0x130476dcU, 0x17c56b6bU,
+        0x1a864db2U, 0x1e475005U, 0x2608edb8U, 0x22c9f00fU, 0x2f8ad6d6U, 0x2b4bcb61U,
+        0x350c9b64U, 0x31cd86d3U, 0x3c8ea00aU, 0x384fbdbdU, 0x4c11db70U, 0x48d0c6c7U,
+        0x4593e01eU, 0x4152fda9U, 0x5f15adacU, 0x5bd4b01bU, 0x569796c2U, 0x52568b75U,
+        0x6a1936c8U, 0x6ed82b7fU, 0x639b0da6U, 0x675a1011U, 0x791d4014U, 0x7ddc5da3U,
+        0x709f7b7aU, 0x745e66cdU, 0x9823b6e0U, 0x9ce2ab57U, 0x91a18d8eU, 0x95609039U,
+        0x8b27c03cU, 0x8fe6dd8bU, 0x82a5fb52U, 0x8664e6e5U, 0xbe2b5b58U, 0xbaea46efU,
+        0xb7a96036U, 0xb3687d81U, 0xad2f2d84U, 0xa9ee3033U, 0xa4ad16eaU, 0xa06c0b5dU,
+        0xd4326d90U, 0xd0f37027U, 0xddb056feU, 0xd9714b49U, 0xc7361b4cU, 0xc3f706fbU,
+        0xceb42022U, 0xca753d95U, 0xf23a8028U, 0xf6fb9d9fU, 0xfbb8bb46U, 0xff79a6f1U,
+        0xe13ef6f4U, 0xe5ffeb43U, 0xe8bccd9aU, 0xec7dd02dU, 0x34867077U, 0x30476dc0U,
+        0x3d044b19U, 0x39c556aeU, 0x278206abU, 0x23431b1cU, 0x2e003dc5U, 0x2ac12072U,
+        0x128e9dcfU, 0x164f8078U, 0x1b0ca6a1U, 0x1fcdbb16U, 0x018aeb13U, 0x054bf6a4U,
+        0x0808d07dU, 0x0cc9cdcaU, 0x7897ab07U, 0x7c56b6b0U, 0x71159069U, 0x75d48ddeU,
+        0x6b93dddbU, 0x6f52c06cU, 0x6211e6b5U, 0x66d0fb02U, 0x5e9f46bfU, 0x5a5e5b08U,
+        0x571d7dd1U, 0x53dc6066U, 0x4d9b3063U, 0x495a2dd4U, 0x44190b0dU, 0x40d816baU,
+        0xaca5c697U, 0xa864db20U, 0xa527fdf9U, 0xa1e6e04eU, 0xbfa1b04bU, 0xbb60adfcU,
+        0xb6238b25U, 0xb2e29692U, 0x8aad2b2fU, 0x8e6c3698U, 0x832f1041U, 0x87ee0df6U,
+        0x99a95df3U, 0x9d684044U, 0x902b669dU, 0x94ea7b2aU, 0xe0b41de7U, 0xe4750050U,
+        0xe9362689U, 0xedf73b3eU, 0xf3b06b3bU, 0xf771768cU, 0xfa325055U, 0xfef34de2U,
+        0xc6bcf05fU, 0xc27dede8U, 0xcf3ecb31U, 0xcbffd686U, 0xd5b88683U, 0xd1799b34U,
+        0xdc3abdedU, 0xd8fba05aU, 0x690ce0eeU, 0x6dcdfd59U, 0x608edb80U, 0x644fc637U,
+        0x7a089632U, 0x7ec98b85U, 0x738aad5cU, 0x774bb0ebU, 0x4f040d56U, 0x4bc510e1U,
+        0x46863638U, 0x42472b8fU, 0x5c007b8aU, 0x58c1663dU, 0x558240e4U, 0x51435d53U,
+        0x251d3b9eU, 0x21dc2629U, 0x2c9f00f0U, 0x285e1d47U, 0x36194d42U, 0x32d850f5U,
+        0x3f9b762cU, 0x3b5a6b9bU, 0x0315d626U, 0x07d4cb91U, 0x0a97ed48U, 0x0e56f0ffU,
+        0x1011a0faU, 0x14d0bd4dU, 0x19939b94U, 0x1d528623U, 0xf12f560eU, 0xf5ee4bb9U,
+        0xf8ad6d60U, 0xfc6c70d7U, 0xe22b20d2U, 0xe6ea3d65U, 0xeba91bbcU, 0xef68060bU,
+        0xd727bbb6U, 0xd3e6a601U, 0xdea580d8U, 0xda649d6fU, 0xc423cd6aU, 0xc0e2d0ddU,
+        0xcda1f604U, 0xc960ebb3U, 0xbd3e8d7eU, 0xb9ff90c9U, 0xb4bcb610U, 0xb07daba7U,
+        0xae3afba2U, 0xaafbe615U, 0xa7b8c0ccU, 0xa379dd7bU, 0x9b3660c6U, 0x9ff77d71U,
+        0x92b45ba8U, 0x9675461fU, 0x8832161aU, 0x8cf30badU, 0x81b02d74U, 0x857130c3U,
+        0x5d8a9099U, 0x594b8d2eU, 0x5408abf7U, 0x50c9b640U, 0x4e8ee645U, 0x4a4ffbf2U,
+        0x470cdd2bU, 0x43cdc09cU, 0x7b827d21U, 0x7f436096U, 0x7200464fU, 0x76c15bf8U,
+        0x68860bfdU, 0x6c47164aU, 0x61043093U, 0x65c52d24U, 0x119b4be9U, 0x155a565eU,
+        0x18197087U, 0x1cd86d30U, 0x029f3d35U, 0x065e2082U, 0x0b1d065bU, 0x0fdc1becU,
+        0x3793a651U, 0x3352bbe6U, 0x3e119d3fU, 0x3ad08088U, 0x2497d08dU, 0x2056cd3aU,
+        0x2d15ebe3U, 0x29d4f654U, 0xc5a92679U, 0xc1683bceU, 0xcc2b1d17U, 0xc8ea00a0U,
+        0xd6ad50a5U, 0xd26c4d12U, 0xdf2f6bcbU, 0xdbee767cU, 0xe3a1cbc1U, 0xe760d676U,
+        0xea23f0afU, 0xeee2ed18U, 0xf0a5bd1dU, 0xf464a0aaU, 0xf9278673U, 0xfde69bc4U,
+        0x89b8fd09U, 0x8d79e0beU, 0x803ac667U, 0x84fbdbd0U, 0x9abc8bd5U, 0x9e7d9662U,
+        0x933eb0bbU, 0x97ffad0cU, 0xafb010b1U, 0xab710d06U, 0xa6322bdfU, 0xa2f33668U,
+        0xbcb4666dU, 0xb8757bdaU, 0xb5365d03U, 0xb1f740b4U
+    },
+    {
+        0x00000000U, 0xd219c1dcU, 0xa0f29e0fU, 0x72eb5fd3U, 0x452421a9U, 0x973de075U,
+        0xe5d6bfa6U, 0x37cf7e7aU, 0x8a484352U, 0x5851828eU, 0x2abadd5dU, 0xf8a31c81U,
+        0xcf6c62fbU, 0x1d75a327U, 0x6f9efcf4U, 0xbd873d28U, 0x10519b13U, 0xc2485acfU,
+        0xb0a3051cU, 0x62bac4c0U, 0x5575babaU, 0x876c7b66U, 0xf58724b5U, 0x279ee569U,
+        0x9a19d841U, 0x4800199dU, 0x3aeb464eU, 0xe8f28792U, 0xdf3df9e8U, 0x0d243834U,
+        0x7fcf67e7U, 0xadd6a63bU, 0x20a33626U, 0xf2baf7faU, 0x8051a829U, 0x524869f5U,
+        0x6587178fU, 0xb79ed653U, 0xc5758980U, 0x176c485cU, 0xaaeb7574U, 0x78f2b4a8U,
+        0x0a19eb7bU, 0xd8002aa7U, 0xefcf54ddU, 0x3dd69501U, 0x4f3dcad2U, 0x9d240b0eU,
+        0x30f2ad35U, 0xe2eb6ce9U, 0x9000333aU, 0x4219f2e6U, 0x75d68c9cU, 0xa7cf4d40U,
+        0xd5241293U, 0x073dd34fU, 0xbabaee67U, 0x68a32fbbU, 0x1a487068U, 0xc851b1b4U,
+        0xff9ecfceU, 0x2d870e12U, 0x5f6c51c1U, 0x8d75901dU, 0x41466c4cU, 0x935fad90U,
+        0xe1b4f243U, 0x33ad339fU, 0x04624de5U, 0xd67b8c39U, 0xa490d3eaU, 0x76891236U,
+        0xcb0e2f1eU, 0x1917eec2U, 0x6bfcb111U, 0xb9e570cdU, 0x8e2a0eb7U, 0x5c33cf6bU,
+        0x2ed890b8U, 0xfcc15164U, 0x5117f75fU, 0x830e3683U, 0xf1e56950U, 0x23fca88cU,
+        0x1433d6f6U, 0xc62a172aU, 0xb4c148f9U, 0x66d88925U, 0xdb5fb40dU, 0x094675d1U,
+        0x7bad2a02U, 0xa9b4ebdeU, 0x9e7b95a4U, 0x4c625478U, 0x3e890babU, 0xec90ca77U,
+        0x61e55a6aU, 0xb3fc9bb6U, 0xc117c465U, 0x130e05b9U, 0x24c17bc3U, 0xf6d8ba1fU,
+        0x8433e5ccU, 0x562a2410U, 0xebad1938U, 0x39b4d8e4U, 0x4b5f8737U, 0x994646ebU,
+        0xae893891U, 0x7c90f94dU, 0x0e7ba69eU, 0xdc626742U, 0x71b4c179U, 0xa3ad00a5U,
+        0xd1465f76U, 0x035f9eaaU, 0x3490e0d0U, 0xe689210cU, 0x94627edfU, 0x467bbf03U,
+        0xfbfc822bU, 0x29e543f7U, 0x5b0e1c24U, 0x8917ddf8U, 0xbed8a382U, 0x6cc1625eU,
+        0x1e2a3d8dU, 0xcc33fc51U, 0x828cd898U, 0x50951944U, 0x227e4697U, 0xf067874bU,
+        0xc7a8f931U, 0x15b138edU, 0x675a673eU, 0xb543a6e2U, 0x08c49bcaU, 0xdadd5a16U,
+        0xa83605c5U, 0x7a2fc419U, 0x4de0ba63U, 0x9ff97bbfU, 0xed12246cU, 0x3f0be5b0U,
+        0x92dd438bU, 0x40c48257U, 0x322fdd84U, 0xe0361c58U, 0xd7f96222U, 0x05e0a3feU,
+        0x770bfc2dU, 0xa5123df1U, 0x189500d9U, 0xca8cc105U, 0xb8679ed6U, 0x6a7e5f0aU,
+        0x5db12170U, 0x8fa8e0acU, 0xfd43bf7fU, 0x2f5a7ea3U, 0xa22feebeU, 0x70362f62U,
+        0x02dd70b1U, 0xd0c4b16dU, 0xe70bcf17U, 0x35120ecbU, 0x47f95118U, 0x95e090c4U,
+        0x2867adecU, 0xfa7e6c30U, 0x889533e3U, 0x5a8cf23fU, 0x6d438c45U, 0xbf5a4d99U,
+        0xcdb1124aU, 0x1fa8d396U, 0xb27e75adU, 0x6067b471U, 0x128ceba2U, 0xc0952a7eU,
+        0xf75a5404U, 0x254395d8U, 0x57a8ca0bU, 0x85b10bd7U, 0x383636ffU, 0xea2ff723U,
+        0x98c4a8f0U, 0x4add692cU, 0x7d121756U, 0xaf0bd68aU, 0xdde08959U, 0x0ff94885U,
+        0xc3cab4d4U, 0x11d37508U, 0x63382adbU, 0xb121eb07U, 0x86ee957dU, 0x54f754a1U,
+        0x261c0b72U, 0xf405caaeU, 0x4982f786U, 0x9b9b365aU, 0xe9706989U, 0x3b69a855U,
+        0x0ca6d62fU, 0xdebf17f3U, 0xac544820U, 0x7e4d89fcU, 0xd39b2fc7U, 0x0182ee1bU,
+        0x7369b1c8U, 0xa1707014U, 0x96bf0e6eU, 0x44a6cfb2U, 0x364d9061U, 0xe45451bdU,
+        0x59d36c95U, 0x8bcaad49U, 0xf921f29aU, 0x2b383346U, 0x1cf74d3cU, 0xceee8ce0U,
+        0xbc05d333U, 0x6e1c12efU, 0xe36982f2U, 0x3170432eU, 0x439b1cfdU, 0x9182dd21U,
+        0xa64da35bU, 0x74546287U, 0x06bf3d54U, 0xd4a6fc88U, 0x6921c1a0U, 0xbb38007cU,
+        0xc9d35fafU, 0x1bca9e73U, 0x2c05e009U, 0xfe1c21d5U, 0x8cf77e06U, 0x5eeebfdaU,
+        0xf33819e1U, 0x2121d83dU, 0x53ca87eeU, 0x81d34632U, 0xb61c3848U, 0x6405f994U,
+        0x16eea647U, 0xc4f7679bU, 0x79705ab3U, 0xab699b6fU, 0xd982c4bcU, 0x0b9b0560U,
+        0x3c547b1aU, 0xee4dbac6U, 0x9ca6e515U, 0x4ebf24c9U
+    },
+    {
+        0x00000000U, 0x01d8ac87U, 0x03b1590eU, 0x0269f589U, 0x0762b21cU, 0x06ba1e9bU,
+        0x04d3eb12U, 0x050b4795U, 0x0ec56438U, 0x0f1dc8bfU, 0x0d743d36U, 0x0cac91b1U,
+        0x09a7d624U, 0x087f7aa3U, 0x0a168f2aU, 0x0bce23adU, 0x1d8ac870U, 0x1c5264f7U,
+        0x1e3b917eU, 0x1fe33df9U, 0x1ae87a6cU, 0x1b30d6ebU, 0x19592362U, 0x18818fe5U,
+        0x134fac48U, 0x129700cfU, 0x10fef546U, 0x112659c1U, 0x142d1e54U, 0x15f5b2d3U,
+        0x179c475aU, 0x1644ebddU, 0x3b1590e0U, 0x3acd3c67U, 0x38a4c9eeU, 0x397c6569U,
+        0x3c7722fcU, 0x3daf8e7bU, 0x3fc67bf2U, 0x3e1ed775U, 0x35d0f4d8U, 0x3408585fU,
+        0x3661add6U, 0x37b90151U, 0x32b246c4U, 0x336aea43U, 0x31031fcaU, 0x30dbb34dU,
+        0x269f5890U, 0x2747f417U, 0x252e019eU, 0x24f6ad19U, 0x21fdea8cU, 0x2025460bU,
+        0x224cb382U, 0x23941f05U, 0x285a3ca8U, 0x2982902fU, 0x2beb65a6U, 0x2a33c921U,
+        0x2f388eb4U, 0x2ee02233U, 0x2c89d7baU, 0x2d517b3dU, 0x762b21c0U, 0x77f38d47U,
+        0x759a78ceU, 0x7442d449U, 0x714993dcU, 0x70913f5bU, 0x72f8cad2U, 0x73206655U,
+        0x78ee45f8U, 0x7936e97fU, 0x7b5f1cf6U, 0x7a87b071U, 0x7f8cf7e4U, 0x7e545b63U,
+        0x7c3daeeaU, 0x7de5026dU, 0x6ba1e9b0U, 0x6a794537U, 0x6810b0beU, 0x69c81c39U,
+        0x6cc35bacU, 0x6d1bf72bU, 0x6f7202a2U, 0x6eaaae25U, 0x65648d88U, 0x64bc210fU,
+        0x66d5d486U, 0x670d7801U, 0x62063f94U, 0x63de9313U, 0x61b7669aU, 0x606fca1dU,
+        0x4d3eb120U, 0x4ce61da7U, 0x4e8fe82eU, 0x4f5744a9U, 0x4a5c033cU, 0x4b84afbbU,
+        0x49ed5a32U, 0x4835f6b5U, 0x43fbd518U, 0x4223799fU, 0x404a8c16U, 0x41922091U,
+        0x44996704U, 0x4541cb83U, 0x47283e0aU, 0x46f0928dU, 0x50b47950U, 0x516cd5d7U,
+        0x5305205eU, 0x52dd8cd9U, 0x57d6cb4cU, 0x560e67cbU, 0x54679242U, 0x55bf3ec5U,
+        0x5e711d68U, 0x5fa9b1efU, 0x5dc04466U, 0x5c18e8e1U, 0x5913af74U, 0x58cb03f3U,
+        0x5aa2f67aU, 0x5b7a5afdU, 0xec564380U, 0xed8eef07U, 0xefe71a8eU, 0xee3fb609U,
+        0xeb34f19cU, 0xeaec5d1bU, 0xe885a892U, 0xe95d0415U, 0xe29327b8U, 0xe34b8b3fU,
+        0xe1227eb6U, 0xe0fad231U, 0xe5f195a4U, 0xe4293923U, 0xe640ccaaU, 0xe798602dU,
+        0xf1dc8bf0U, 0xf0042777U, 0xf26dd2feU, 0xf3b57e79U, 0xf6be39ecU, 0xf766956bU,
+        0xf50f60e2U, 0xf4d7cc65U, 0xff19efc8U, 0xfec1434fU, 0xfca8b6c6U, 0xfd701a41U,
+        0xf87b5dd4U, 0xf9a3f153U, 0xfbca04daU, 0xfa12a85dU, 0xd743d360U, 0xd69b7fe7U,
+        0xd4f28a6eU, 0xd52a26e9U, 0xd021617cU, 0xd1f9cdfbU, 0xd3903872U, 0xd24894f5U,
+        0xd986b758U, 0xd85e1bdfU, 0xda37ee56U, 0xdbef42d1U, 0xdee40544U, 0xdf3ca9c3U,
+        0xdd555c4aU, 0xdc8df0cdU, 0xcac91b10U, 0xcb11b797U, 0xc978421eU, 0xc8a0ee99U,
+        0xcdaba90cU, 0xcc73058bU, 0xce1af002U, 0xcfc25c85U, 0xc40c7f28U, 0xc5d4d3afU,
+        0xc7bd2626U, 0xc6658aa1U, 0xc36ecd34U, 0xc2b661b3U, 0xc0df943aU, 0xc10738bdU,
+        0x9a7d6240U, 0x9ba5cec7U, 0x99cc3b4eU, 0x981497c9U, 0x9d1fd05cU, 0x9cc77cdbU,
+        0x9eae8952U, 0x9f7625d5U, 0x94b80678U, 0x9560aaffU, 0x97095f76U, 0x96d1f3f1U,
+        0x93dab464U, 0x920218e3U, 0x906bed6aU, 0x91b341edU, 0x87f7aa30U, 0x862f06b7U,
+        0x8446f33eU, 0x859e5fb9U, 0x8095182cU, 0x814db4abU, 0x83244122U, 0x82fceda5U,
+        0x8932ce08U, 0x88ea628fU, 0x8a839706U, 0x8b5b3b81U, 0x8e507c14U, 0x8f88d093U,
+        0x8de1251aU, 0x8c39899dU, 0xa168f2a0U, 0xa0b05e27U, 0xa2d9abaeU, 0xa3010729U,
+        0xa60a40bcU, 0xa7d2ec3bU, 0xa5bb19b2U, 0xa463b535U, 0xafad9698U, 0xae753a1fU,
+        0xac1ccf96U, 0xadc46311U, 0xa8cf2484U, 0xa9178803U, 0xab7e7d8aU, 0xaaa6d10dU,
+        0xbce23ad0U, 0xbd3a9657U, 0xbf5363deU, 0xbe8bcf59U, 0xbb8088ccU, 0xba58244bU,
+        0xb831d1c2U, 0xb9e97d45U, 0xb2275ee8U, 0xb3fff26fU, 0xb19607e6U, 0xb04eab61U,
+        0xb545ecf4U, 0xb49d4073U, 0xb6f4b5faU, 0xb72c197dU
+    },
+    {
+        0x00000000U, 0xdc6d9ab7U, 0xbc1a28d9U, 0x6077b26eU, 0x7cf54c05U, 0xa098d6b2U,
+        0xc0ef64dcU, 0x1c82fe6bU, 0xf9ea980aU, 0x258702bdU, 0x45f0b0d3U, 0x999d2a64U,
+        0x851fd40fU, 0x59724eb8U, 0x3905fcd6U, 0xe5686661U, 0xf7142da3U, 0x2b79b714U,
+        0x4b0e057aU, 0x97639fcdU, 0x8be161a6U, 0x578cfb11U, 0x37fb497fU, 0xeb96d3c8U,
+        0x0efeb5a9U, 0xd2932f1eU, 0xb2e49d70U, 0x6e8907c7U, 0x720bf9acU, 0xae66631bU,
+        0xce11d175U, 0x127c4bc2U, 0xeae946f1U, 0x3684dc46U, 0x56f36e28U, 0x8a9ef49fU,
+        0x961c0af4U, 0x4a719043U, 0x2a06222dU, 0xf66bb89aU, 0x1303defbU, 0xcf6e444cU,
+        0xaf19f622U, 0x73746c95U, 0x6ff692feU, 0xb39b0849U, 0xd3ecba27U, 0x0f812090U,
+        0x1dfd6b52U, 0xc190f1e5U, 0xa1e7438bU, 0x7d8ad93cU, 0x61082757U, 0xbd65bde0U,
+        0xdd120f8eU, 0x017f9539U, 0xe417f358U, 0x387a69efU, 0x580ddb81U, 0x84604136U,
+        0x98e2bf5dU, 0x448f25eaU, 0x24f89784U, 0xf8950d33U, 0xd1139055U, 0x0d7e0ae2U,
+        0x6d09b88cU, 0xb164223bU, 0xade6dc50U, 0x718b46e7U, 0x11fcf489U, 0xcd916e3eU,
+        0x28f9085fU, 0xf49492e8U, 0x94e32086U, 0x488eba31U, 0x540c445aU, 0x8861deedU,
+        0xe8166c83U, 0x347bf634U, 0x2607bdf6U, 0xfa6a2741U, 0x9a1d952fU, 0x46700f98U,
+        0x5af2f1f3U, 0x869f6b44U, 0xe6e8d92aU, 0x3a85439dU, 0xdfed25fcU, 0x0380bf4bU,
+        0x63f70d25U, 0xbf9a9792U, 0xa31869f9U, 0x7f75f34eU, 0x1f024120U, 0xc36fdb97U,
+        0x3bfad6a4U, 0xe7974c13U, 0x87e0fe7dU, 0x5b8d64caU, 0x470f9aa1U, 0x9b620016U,
+        0xfb15b278U, 0x277828cfU, 0xc2104eaeU, 0x1e7dd419U, 0x7e0a6677U, 0xa267fcc0U,
+        0xbee502abU, 0x6288981cU, 0x02ff2a72U, 0xde92b0c5U, 0xcceefb07U, 0x108361b0U,
+        0x70f4d3deU, 0xac994969U, 0xb01bb702U, 0x6c762db5U, 0x0c019fdbU, 0xd06c056cU,
+        0x3504630dU, 0xe969f9baU, 0x891e4bd4U, 0x5573d163U, 0x49f12f08U, 0x959cb5bfU,
+        0xf5eb07d1U, 0x29869d66U, 0xa6e63d1dU, 0x7a8ba7aaU, 0x1afc15c4U, 0xc6918f73U,
+        0xda137118U, 0x067eebafU, 0x660959c1U, 0xba64c376U, 0x5f0ca517U, 0x83613fa0U,
+        0xe3168dceU, 0x3f7b1779U, 0x23f9e912U, 0xff9473a5U, 0x9fe3c1cbU, 0x438e5b7cU,
+        0x51f210beU, 0x8d9f8a09U, 0xede83867U, 0x3185a2d0U, 0x2d075cbbU, 0xf16ac60cU,
+        0x911d7462U, 0x4d70eed5U, 0xa81888b4U, 0x74751203U, 0x1402a06dU, 0xc86f3adaU,
+        0xd4edc4b1U, 0x08805e06U, 0x68f7ec68U, 0xb49a76dfU, 0x4c0f7becU, 0x9062e15bU,
+        0xf0155335U, 0x2c78c982U, 0x30fa37e9U, 0xec97ad5eU, 0x8ce01f30U, 0x508d8587U,
+        0xb5e5e3e6U, 0x69887951U, 0x09ffcb3fU, 0xd5925188U, 0xc910afe3U, 0x157d3554U,
+        0x750a873aU, 0xa9671d8dU, 0xbb1b564fU, 0x6776ccf8U, 0x07017e96U, 0xdb6ce421U,
+        0xc7ee1a4aU, 0x1b8380fdU, 0x7bf43293U, 0xa799a824U, 0x42f1ce45U, 0x9e9c54f2U,
+        0xfeebe69cU, 0x22867c2bU, 0x3e048240U, 0xe26918f7U, 0x821eaa99U, 0x5e73302eU,
+        0x77f5ad48U, 0xab9837ffU, 0xcbef8591U, 0x17821f26U, 0x0b00e14dU, 0xd76d7bfaU,
+        0xb71ac994U, 0x6b775323U, 0x8e1f3542U, 0x5272aff5U, 0x32051d9bU, 0xee68872cU,
+        0xf2ea7947U, 0x2e87e3f0U, 0x4ef0519eU, 0x929dcb29U, 0x80e180ebU, 0x5c8c1a5cU,
+        0x3cfba832U, 0xe0963285U, 0xfc14cceeU, 0x20795659U, 0x400ee437U, 0x9c637e80U,
+        0x790b18e1U, 0xa5668256U, 0xc5113038U, 0x197caa8fU, 0x05fe54e4U, 0xd993ce53U,
+        0xb9e47c3dU, 0x6589e68aU, 0x9d1cebb9U, 0x4171710eU, 0x2106c360U, 0xfd6b59d7U,
+        0xe1e9a7bcU, 0x3d843d0bU, 0x5df38f65U, 0x819e15d2U, 0x64f673b3U, 0xb89be904U,
+        0xd8ec5b6aU, 0x0481c1ddU, 0x18033fb6U, 0xc46ea501U, 0xa419176fU, 0x78748dd8U,
+        0x6a08c61aU, 0xb6655cadU, 0xd612eec3U, 0x0a7f7474U, 0x16fd8a1fU, 0xca9010a8U,
+        0xaae7a2c6U, 0x768a3871U, 0x93e25e10U, 0x4f8fc4a7U, 0x2ff876c9U, 0xf395ec7eU,
+        0xef171215U, 0x337a88a2U, 0x530d3accU, 0x8f60a07bU
+    }
+};
+
+
+/**
+ * Add a block of bytes to a running CRC
+ *
+ * Four bytes are folded in per step using one lookup in each of the four
+ * tables, any odd bytes at the end go through the single byte table.
+ *
+ * @param lCrc - The CRC so far, CRC_INIT for the first block
+ * @param pbData - The bytes to add
+ * @param lLen - Number of bytes in pbData
+ * @return The updated CRC
+ */
+unsigned long crc_Update( unsigned long lCrc, const unsigned char *pbData, unsigned int lLen )
+{
+    unsigned int lCur = ( unsigned int )lCrc;
+
+    while( lLen >= 4 )
+    {
+        lCur ^= (( unsigned int )pbData[ 0 ] << 24 ) | (( unsigned int )pbData[ 1 ] << 16 ) |
+            (( unsigned int )pbData[ 2 ] << 8 ) | pbData[ 3 ];
+        lCur = aalCrcTable[ 3 ][ lCur >> 24 ] ^ aalCrcTable[ 2 ][ ( lCur >> 16 ) & 0xff ] ^
+            aalCrcTable[ 1 ][ ( lCur >> 8 ) & 0xff ] ^ aalCrcTable[ 0 ][ lCur & 0xff ];
+        pbData += 4;
+        lLen -= 4;
+    }
+
+    while( lLen-- > 0 )
+    {
+        lCur = ( lCur << 8 ) ^ aalCrcTable[ 0 ][ ( lCur >> 24 ) ^ *pbData++ ];
+    }
+
+    return( lCur );
+}
+
+
+/**
+ * CRC of one flash sector as returned by READ_SECTOR_CRC
+ *
+ * @param pabRom - Image of the whole flash, unused bytes as 0xff
+ * @param lSectorAddr - Start address of the sector
+ * @return The sector CRC
+ */
+unsigned long crc_Sector( const unsigned char *pabRom, unsigned int lSectorAddr )
+{
+    lSectorAddr &= ~( CRC_SECTOR_SIZE - 1 );
+
+    return( crc_Update( CRC_INIT, &pabRom[ lSectorAddr ], CRC_SECTOR_SIZE ) ^ CRC_XOROUT );
+}
+
+
+/**
+ * CRC of the whole user flash as returned by READ_GLOBAL_CRC
+ *
+ * @param pabRom - Image of the whole flash, unused bytes as 0xff
+ * @return The global CRC
+ */
+unsigned long crc_Global( const unsigned char *pabRom )
+{
+    return( crc_Update( CRC_INIT, pabRom, CRC_FLASH_SIZE ) ^ CRC_XOROUT );
+}
+
+
+/**
+ * Work out every sector CRC and the global CRC of an image in one sweep
+ *
+ * @param pabRom - Image of the whole flash, unused bytes as 0xff
+ * @param alSector - Filled with CRC_FLASH_SIZE / CRC_SECTOR_SIZE sector CRCs
+ * @param plGlobal - Filled with the global CRC
+ */
+void crc_Image( const unsigned char *pabRom, unsigned long alSector[], unsigned long *plGlobal )
+{
+    unsigned long lGlobal = CRC_INIT;
+    unsigned int lAddr;
+
+    for( lAddr = 0; lAddr < CRC_FLASH_SIZE; lAddr += CRC_SECTOR_SIZE )
+    {
+        alSector[ lAddr / CRC_SECTOR_SIZE ] =
+            crc_Update( CRC_INIT, &pabRom[ lAddr ], CRC_SECTOR_SIZE ) ^ CRC_XOROUT;
+        lGlobal = crc_Update( lGlobal, &pabRom[ lAddr ], CRC_SECTOR_SIZE );
+    }
+
+    *plGlobal = lGlobal ^ CRC_XOROUT;
+}
+
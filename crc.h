@@ -0,0 +1,39 @@
+/*  
+  File:         crc.h
+  Written by:   Rod Boyce
+  e-mail:       rod@boyce.net.nz
+
+  This file is part of lpc935-prog
+  
+  lpc935-prog is free software; you can redistribute it and/or modify
+  it under the terms of the Lesser GNU General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  lpc935-prog is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser
+  GNU General Public License for more details.
+
+  You should have received a copy of the Lesser GNU General Public
+  License along with lpc935-prog; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+  USA
+*/
+#ifndef CRC_H
+#define CRC_H
+
+/* Flash layout the boot loader CRC commands work over */
+#define CRC_FLASH_SIZE  8192
+#define CRC_SECTOR_SIZE 1024
+
+/* Start value for crc_Update and the value a finished CRC is xored with */
+#define CRC_INIT   0x00000000UL
+#define CRC_XOROUT 0x00000000UL
+
+unsigned long crc_Update( unsigned long lCrc, const unsigned char *pbData, unsigned int lLen );
+unsigned long crc_Sector( const unsigned char *pabRom, unsigned int lSectorAddr );
+unsigned long crc_Global( const unsigned char *pabRom );
+void crc_Image( const unsigned char *pabRom, unsigned long alSector[], unsigned long *plGlobal );
+
+#endif
@@ -21,7 +21,7 @@
   USA
 */
 #include <stdio.h>
-#include <ctype.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "ihex.h"
@@ -41,13 +41,41 @@
 #define TEXT_BUFFER 524
 #define START_INTEL_DATA_SECTION 9
 
-static int do_chechsum( const char *record);
+/* Bytes in a record, length, address, type, up to 255 data and checksum */
+#define MAX_RECORD_BYTES ( 4 + 255 + 1 )
+/* Set in the lookup table entry of every hex digit, the value is the low
+   nibble */
+#define HEX_DIGIT 0x10
+
+/* Where put_flat_data puts the records of read_intel_hex_err */
+typedef struct
+{
+    unsigned char *pabData;
+    unsigned char *pabMap;
+} tsFlatImage;
+
+static int parse_hex_image( const unsigned char *pbText, long lSize, tfIhexData fData,
+                            void *pvUser, unsigned int lLen, tsIhexError *psErr );
+static int put_flat_data( void *pvUser, unsigned int lAddr, const unsigned char *pbData,
+                          unsigned int lLen );
+static void set_hex_error( tsIhexError *psErr, unsigned int lLine, unsigned int lColumn,
+                           const char *pacMsg );
 static unsigned char get_checksum( unsigned char sum );
 
-static unsigned int strword( char *buff);
-static void nibble_to_char( char *ch, int num);
-static void byte_to_str( char ch[], int num);
-static void word_to_str( char pos[], unsigned int num );
+/* HEX_DIGIT and the value of every character that is a hex digit, 0 for
+   the rest.  Constant so the parser and the reply decoders can run on any
+   number of threads at once */
+static const unsigned char abHexValue[ 256 ] =
+{
+    [ '0' ] = HEX_DIGIT | 0x0, [ '1' ] = HEX_DIGIT | 0x1, [ '2' ] = HEX_DIGIT | 0x2,
+    [ '3' ] = HEX_DIGIT | 0x3, [ '4' ] = HEX_DIGIT | 0x4, [ '5' ] = HEX_DIGIT | 0x5,
+    [ '6' ] = HEX_DIGIT | 0x6, [ '7' ] = HEX_DIGIT | 0x7, [ '8' ] = HEX_DIGIT | 0x8,
+    [ '9' ] = HEX_DIGIT | 0x9,
+    [ 'a' ] = HEX_DIGIT | 0xa, [ 'b' ] = HEX_DIGIT | 0xb, [ 'c' ] = HEX_DIGIT | 0xc,
+    [ 'd' ] = HEX_DIGIT | 0xd, [ 'e' ] = HEX_DIGIT | 0xe, [ 'f' ] = HEX_DIGIT | 0xf,
+    [ 'A' ] = HEX_DIGIT | 0xa, [ 'B' ] = HEX_DIGIT | 0xb, [ 'C' ] = HEX_DIGIT | 0xc,
+    [ 'D' ] = HEX_DIGIT | 0xd, [ 'E' ] = HEX_DIGIT | 0xe, [ 'F' ] = HEX_DIGIT | 0xf
+};
 
 
 /**
@@ -65,83 +93,109 @@ static void word_to_str( char pos[], unsigned int num );
     indicates an error.
  */
 unsigned int read_intel_hex( char *pacFilename, unsigned char pabData[], unsigned int lLen)
+{
+    return( read_intel_hex_map( pacFilename, pabData, NULL, lLen ));
+}
+
+
+/**
+ Same as read_intel_hex but also records which bytes the file defined.
+ Parameters:
+    pacFilename - the Intel hex file to read.
+    pabData - memory that will hold the binary version of the file.
+    pabMap - if not NULL, set to 1 for every byte of pabData that a data
+             record wrote.  Bytes the file does not mention are left
+             untouched so the caller must clear it first.  Must be lLen
+             bytes long.
+    lLen - that length of the data block.
+ Returns
+    The highest address written or a negative number on error.
+ */
+unsigned int read_intel_hex_map( char *pacFilename, unsigned char pabData[],
+                                 unsigned char pabMap[], unsigned int lLen )
+{
+    return( read_intel_hex_err( pacFilename, pabData, pabMap, lLen, NULL ));
+}
+
+
+/**
+ Same as read_intel_hex_map but says where the file went wrong.
+ The whole file is taken in with one read and each record is decoded and
+ checksummed in a single pass through a hex digit lookup table.  A record
+ only reaches pabData once its checksum has been checked.
+ Parameters:
+    pacFilename - the Intel hex file to read.
+    pabData - memory that will hold the binary version of the file.
+    pabMap - as for read_intel_hex_map, may be NULL.
+    lLen - that length of the data block.
+    psErr - if not NULL, filled in with the line, column and reason of the
+            first error.  Line is 0 if the file could not be read.
+ Returns
+    The highest address written or a negative number on error:
+    -1 the file could not be read, -2 a record is malformed or fails its
+    checksum, -3 data lies past lLen, -4 unknown record type.
+ */
+unsigned int read_intel_hex_err( char *pacFilename, unsigned char pabData[],
+                                 unsigned char pabMap[], unsigned int lLen,
+                                 tsIhexError *psErr )
+{
+    tsFlatImage sFlat;
+
+    sFlat.pabData = pabData;
+    sFlat.pabMap = pabMap;
+
+    return( read_intel_hex_cb( pacFilename, put_flat_data, &sFlat, lLen, psErr ));
+}
+
+
+/**
+ Same as read_intel_hex_err but every data record is handed to fData
+ instead of being copied into a flat buffer, so the caller can keep the
+ image in whatever form suits it.  Records are passed in file order with
+ the part of them below lLen.
+ Parameters:
+    pacFilename - the Intel hex file to read.
+    fData - called with the address, bytes and length of each data record.
+            A non zero return stops the read.
+    pvUser - handed back to fData.
+    lLen - size of the address space, data at or past it is an error.
+    psErr - as for read_intel_hex_err, may be NULL.
+ Returns
+    As read_intel_hex_err, or -5 if fData failed.
+ */
+unsigned int read_intel_hex_cb( char *pacFilename, tfIhexData fData, void *pvUser,
+                                unsigned int lLen, tsIhexError *psErr )
 {
     FILE *in;
-    char buff[ TEXT_BUFFER ];
-    unsigned int rec_type;
-    unsigned int taddr;
-    unsigned int max_addr = 0;
-    unsigned int rec_len;
-    unsigned int i;
-    unsigned int dbyte;
+    unsigned char *pbFile;
+    long lSize;
+    int zRtnv;
 
-    if( NULL == ( in = fopen( pacFilename, "rt")))
+    if( NULL == ( in = fopen( pacFilename, "rb" )))
     {
+        set_hex_error( psErr, 0, 0, "can not open file" );
         return( -1 );
     }
 
-    while((fgets( buff, TEXT_BUFFER - 2, in)) != NULL)
+    pbFile = NULL;
+    if(( 0 == fseek( in, 0, SEEK_END )) && ( 0 <= ( lSize = ftell( in ))) &&
+       ( 0 == fseek( in, 0, SEEK_SET )))
     {
-        /* if not intel hex record continue */
-        if(buff[0] != ':')
-        {
-            continue;
-        }
-
-        if( do_chechsum( buff ))
-        {
-            fclose( in );
-            return( -2 );
-        }
-
-        rec_type = (nibble( buff[ REC_TYPE_OFFSET ]) << 4) +
-            nibble( buff[ REC_TYPE_OFFSET + 1]);
-        /* We don't need to re-checksum the line as it is already done when we
-           got the address boundaries */
-        switch( rec_type )
-        {
-          case DATA_RECORD:
-              rec_len = (nibble( buff[ REC_LEN_OFFSET ]) << 4) +
-                  nibble( buff[ REC_LEN_OFFSET + 1]);
-
-              taddr = strword( &buff[ ADDRESS_OFFSET ]);
+        pbFile = malloc( lSize + 1 );
+    }
+    if(( NULL == pbFile ) || ( lSize != fread( pbFile, 1, lSize, in )))
+    {
+        free( pbFile );
+        fclose( in );
+        set_hex_error( psErr, 0, 0, "can not read file" );
+        return( -1 );
+    }
+    fclose( in );
 
-              for( i = 0; i < rec_len; i++)
-              {
-                  if(( taddr + i ) >= lLen )
-                  {
-                      fclose( in );
-                      return( -3 );
-                  }
-
-                  dbyte = ( nibble( buff[ DATA_OFFSET + ( i * 2 )]) << 4) +
-                      nibble( buff[ DATA_OFFSET + ( i * 2 ) + 1 ]);
-
-                  if( taddr + i > max_addr)   /* Find the highest address */
-                  {
-                      max_addr = taddr + i;
-                  }
-
-                  pabData[ taddr + i ] = dbyte;
-              }/*for*/
-              break;
-              
-          case EXTENDED_LINER_ADDRESS:
-              break;
-              
-          case END_OF_FILE:
-              break;
-              
-          default :
-              printf("Unknown record type %02X\n", rec_type);
-              fclose( in );
-              return( -4 );
-        } /* switch */
-    } /* while */
+    zRtnv = parse_hex_image( pbFile, lSize, fData, pvUser, lLen, psErr );
+    free( pbFile );
 
-    fclose( in );
-    
-    return( max_addr );
+    return( zRtnv );
 }
 
 
@@ -165,51 +219,28 @@ unsigned int write_intel_hex( unsigned char pabData[], unsigned int lLen,
 {
    FILE *out;
    char buff[ TEXT_BUFFER ];
-   int sum;
-   int lpos;
-   int max_chars;
-   int num_chars;
-   int datapos = 0;
+   unsigned int lpos;
+   unsigned int num_chars;
+   unsigned int datapos = 0;
 
    if( NULL == ( out = fopen( pacFilename, "wt")))
    {
       return( -1 );
    }
 
-   /* Decide how many characters per line we want */
-   max_chars = lLineLen;
+   /* A record holds at most 255 data bytes */
+   if( lLineLen > 255 )
+   {
+      lLineLen = 255;
+   }
 
    while( lLen > datapos )
    {
-      memset( buff, 0, sizeof( buff ));
-
-      /* do header */
-      sum = 0;
-      buff[0] = ':';
-      byte_to_str( &buff[ REC_LEN_OFFSET ], 0);
-      sum += (datapos >> 8);
-      sum += ( datapos & 0xFF);
-      word_to_str( &buff[ ADDRESS_OFFSET ], datapos);
-      byte_to_str( &buff[ REC_TYPE_OFFSET ], DATA_RECORD);
-      sum += DATA_RECORD;
-
-      /* do data */
-      lpos = START_INTEL_DATA_SECTION;
-      num_chars = 0;
-      while(( lLen > datapos ) && ( num_chars < max_chars))
-      {
-         byte_to_str( &buff[ lpos ], pabData[ datapos ]);
-         sum += pabData[ datapos ];
-         lpos += 2;
-         num_chars++;
-         datapos++;
-      }
-      
-      byte_to_str( &buff[ REC_LEN_OFFSET ], num_chars);
-      sum += num_chars;
-      sum = get_checksum( sum );
-      byte_to_str( &buff[ lpos ], sum);
-      fprintf( out, "%s\n", buff );
+      num_chars = ( lLen - datapos < lLineLen ) ? lLen - datapos : lLineLen;
+      lpos = put_intel_hex( buff, DATA_RECORD, &pabData[ datapos ], num_chars, datapos );
+      buff[ lpos++ ] = '\n';
+      fwrite( buff, 1, lpos, out );
+      datapos += num_chars;
    }
    
    /* print out the end of file header */
@@ -231,78 +262,92 @@ unsigned int write_intel_hex( unsigned char pabData[], unsigned int lLen,
  *   bBufLen - the size of the buffer
  *   wStartAddr - The start address to put into the Intel hex record
  * Returns
- *    A positive value or 0 for all OK.  A negative value indicates an error.
+ *    The length of the string, cut short to fit lStrLen if need be.
  */
 unsigned int snintel_hex( char abString[], unsigned int lStrLen, unsigned char bRecId,
                           unsigned char *pbBuff, unsigned char bBufLen,
                           unsigned short wStartAddr )
 {
-    unsigned int lCurStrPos;
+    char acRec[ INTEL_HEX_LEN( 255 ) ];
+    unsigned int lLen;
+
+    if( 0 == lStrLen )
+    {
+        return( 0 );
+    }
+
+    if( lStrLen > INTEL_HEX_LEN( bBufLen ))
+    {
+        lLen = put_intel_hex( abString, bRecId, pbBuff, bBufLen, wStartAddr );
+    }
+    else
+    {
+        put_intel_hex( acRec, bRecId, pbBuff, bBufLen, wStartAddr );
+        lLen = lStrLen - 1;
+        memcpy( abString, acRec, lLen );
+    }
+    abString[ lLen ] = '\0';
+
+    return( lLen );
+}
+
+
+/**
+ * Encode one Intel hex record into pacOut with no terminating null, so
+ * records can be packed one after another in a single buffer.  The hex
+ * digits come from a table and the checksum is summed in the same loop.
+ * Parameters
+ *   pacOut - where the record goes, at least INTEL_HEX_LEN( bBufLen ) chars
+ *   bRecId - the record ID to assign to this buffer
+ *   pbBuff - the data bytes
+ *   bBufLen - the number of data bytes
+ *   wStartAddr - The start address to put into the Intel hex record
+ * Returns
+ *    The number of characters written, INTEL_HEX_LEN( bBufLen ).
+ */
+unsigned int put_intel_hex( char *pacOut, unsigned char bRecId, const unsigned char *pbBuff,
+                            unsigned char bBufLen, unsigned short wStartAddr )
+{
+    static const char acDigit[] = "0123456789abcdef";
     unsigned char bSum;
+    char *pc = pacOut;
     int i;
 
-    /* Set up start of record and length */
-    memset( abString, 0, lStrLen );
-    abString[ 0 ] = ':';
-    bSum = 0;
-    lCurStrPos = strlen( abString );
-    snprintf( &abString[ lCurStrPos ], lStrLen - lCurStrPos, "%02x", bBufLen );
-    lCurStrPos = strlen( abString );
-    bSum += bBufLen;
-
-    /* Do address */
-    snprintf( &abString[ lCurStrPos ], lStrLen - lCurStrPos, "%04x", wStartAddr );
-    lCurStrPos = strlen( abString );
-    bSum += ( wStartAddr >> 8 );
-    bSum += ( wStartAddr & 0xff );
-
-    /* Do record Id */
-    snprintf( &abString[ lCurStrPos ], lStrLen - lCurStrPos, "%02x", bRecId );
-    lCurStrPos = strlen( abString );
-    bSum += bRecId;
-
-    /* Do Data */
+    bSum = bBufLen + ( wStartAddr >> 8 ) + ( wStartAddr & 0xff ) + bRecId;
+
+    *pc++ = ':';
+    *pc++ = acDigit[ bBufLen >> 4 ];
+    *pc++ = acDigit[ bBufLen & 0x0f ];
+    *pc++ = acDigit[ ( wStartAddr >> 12 ) & 0x0f ];
+    *pc++ = acDigit[ ( wStartAddr >> 8 ) & 0x0f ];
+    *pc++ = acDigit[ ( wStartAddr >> 4 ) & 0x0f ];
+    *pc++ = acDigit[ wStartAddr & 0x0f ];
+    *pc++ = acDigit[ bRecId >> 4 ];
+    *pc++ = acDigit[ bRecId & 0x0f ];
+
     for( i = 0; i < bBufLen; i++ )
     {
-        snprintf( &abString[ lCurStrPos ], lStrLen - lCurStrPos, "%02x", *( pbBuff + i ));
-        lCurStrPos = strlen( abString );
-        bSum += *( pbBuff + i );
+        *pc++ = acDigit[ pbBuff[ i ] >> 4 ];
+        *pc++ = acDigit[ pbBuff[ i ] & 0x0f ];
+        bSum += pbBuff[ i ];
     }
 
-    /* Do checksum */
     bSum = get_checksum( bSum );
-    snprintf( &abString[ lCurStrPos ], lStrLen - lCurStrPos, "%02x", bSum );
-    lCurStrPos = strlen( abString );
+    *pc++ = acDigit[ bSum >> 4 ];
+    *pc++ = acDigit[ bSum & 0x0f ];
 
-    return( lCurStrPos );
+    return( pc - pacOut );
 }
 
 
 /*
-   Convert ASCII nibble to binary
+   Convert ASCII nibble to binary, -1 if c is not a hex digit
  */
 int nibble( char c )
 {
-   if( isascii( c ) && isxdigit( c ))
-   {
-       if( isdigit( c ))
-       {
-           return( c - '0' );
-       }
-       
-       if( isupper( c ))
-       {
-           return( c - 'A' + 10 );
-       }
-       
-       if( islower( c ))
-       {
-           return( c - 'a' + 10 );
-       }
-   }
-   
-   printf( "Illegal Hex data in record\n" );
-   return( -1 );
+   unsigned char bHex = abHexValue[ ( unsigned char )c ];
+
+   return(( 0 == ( bHex & HEX_DIGIT )) ? -1 : bHex & 0x0f );
 }
 
 
@@ -310,90 +355,176 @@ int nibble( char c )
    Private functions
  */
 /*
-  Converts num to a hex character and returns it in ch
+  return the checksum of the sum
  */
-static void nibble_to_char( char *ch, int num)
+static unsigned char get_checksum( unsigned char sum )
 {
-   num &= 0xF;
+   unsigned char rtnv;
 
-   if( num > 9 )
-   {
-       *ch = num + ('a' - 10);
-   }
-   else
-   {
-       *ch = num + '0';
-   }
+   rtnv = 0 - sum % 256;
+
+   return( rtnv );
 }
 
 
 /*
-   converts the byte in num to hex characters.  Assumes array ch is
-   at least 2 in size.
+  Decode and place every record of a hex file held in memory.  Each record
+  is turned into bytes and summed in one pass, and only handed to fData
+  once its checksum is known to be good.  Returns as read_intel_hex_cb.
  */
-static void byte_to_str( char ch[], int num)
+static int parse_hex_image( const unsigned char *pbText, long lSize, tfIhexData fData,
+                            void *pvUser, unsigned int lLen, tsIhexError *psErr )
 {
-   int tnum;
+    unsigned char abRec[ MAX_RECORD_BYTES ];
+    const unsigned char *pbEnd = pbText + lSize;
+    const unsigned char *pbLine;
+    const unsigned char *pbNext;
+    const unsigned char *pbEol;
+    const unsigned char *pb;
+    unsigned int lLine = 0;
+    unsigned int max_addr = 0;
+    unsigned int lBytes;
+    unsigned int lFits;
+    unsigned int taddr;
+    unsigned int rec_len;
+    unsigned int i;
+    unsigned char hi;
+    unsigned char lo;
+    unsigned char sum;
 
-   tnum = num >> 4;
-   nibble_to_char( ch, tnum );
-   tnum = num & 0xF;
-   nibble_to_char( &ch[ 1 ], tnum );
-}
+    for( pbLine = pbText; pbLine < pbEnd; pbLine = pbNext )
+    {
+        lLine++;
+        pbEol = memchr( pbLine, '\n', pbEnd - pbLine );
+        if( NULL == pbEol )
+        {
+            pbEol = pbEnd;
+        }
+        pbNext = pbEol + 1;
+
+        /* if not intel hex record continue */
+        if( ':' != pbLine[ 0 ])
+        {
+            continue;
+        }
 
+        /* The record length is only known once its first byte is in so
+           decode the header then the rest */
+        pb = pbLine + 1;
+        sum = 0;
+        lBytes = 5;
+        for( i = 0; i < lBytes; i++ )
+        {
+            if( pb + 1 >= pbEol )
+            {
+                set_hex_error( psErr, lLine, pb - pbLine + 1, "record is too short" );
+                return( -2 );
+            }
+            hi = abHexValue[ pb[ 0 ]];
+            lo = abHexValue[ pb[ 1 ]];
+            if( 0 == ( hi & lo & HEX_DIGIT ))
+            {
+                set_hex_error( psErr, lLine, pb - pbLine + (( 0 == ( hi & HEX_DIGIT )) ? 1 : 2 ),
+                               "not a hex digit" );
+                return( -2 );
+            }
+            abRec[ i ] = (( hi & 0x0f ) << 4 ) | ( lo & 0x0f );
+            sum += abRec[ i ];
+            if( 0 == i )
+            {
+                lBytes = abRec[ 0 ] + 5;
+            }
+            pb += 2;
+        }
 
-/*
-   converts the word passed to hex characters.  Assumes aray pos is
-   at least 4 in size.
- */
-static void word_to_str( char pos[], unsigned int num )
-{
-   unsigned int tnum;
+        /* Only line end white space may follow the checksum */
+        for( ; pb < pbEol; pb++ )
+        {
+            if(( '\r' != *pb ) && ( ' ' != *pb ) && ( '\t' != *pb ))
+            {
+                set_hex_error( psErr, lLine, pb - pbLine + 1, "extra characters after checksum" );
+                return( -2 );
+            }
+        }
 
-   tnum = num >> 8;
-   byte_to_str( pos, tnum );
-   tnum = num & 0xFF;
-   byte_to_str( &pos[ 2 ], tnum );
-}
+        if( 0 != sum )
+        {
+            set_hex_error( psErr, lLine, 2 * lBytes, "bad checksum" );
+            return( -2 );
+        }
 
+        rec_len = abRec[ 0 ];
+        switch( abRec[ 3 ])
+        {
+          case DATA_RECORD:
+              taddr = ( abRec[ 1 ] << 8 ) | abRec[ 2 ];
+              lFits = ( taddr >= lLen ) ? 0 : lLen - taddr;
+              if( lFits > rec_len )
+              {
+                  lFits = rec_len;
+              }
 
-/*
-  Convert a string of hex chars to a word
- */
-static unsigned int strword( char *buff)
-{
-   return((nibble( buff[ 0 ]) << 12) + (nibble( buff[ 1 ]) << 8) +
-          (nibble( buff[ 2 ]) << 4) + nibble( buff[ 3 ]));
+              if(( 0 < lFits ) && ( 0 != fData( pvUser, taddr, &abRec[ 4 ], lFits )))
+              {
+                  set_hex_error( psErr, lLine, DATA_OFFSET + 1, "no room for data" );
+                  return( -5 );
+              }
+              if(( 0 < lFits ) && ( taddr + lFits - 1 > max_addr ))
+              {
+                  max_addr = taddr + lFits - 1;
+              }
+
+              if( lFits < rec_len )
+              {
+                  set_hex_error( psErr, lLine, ADDRESS_OFFSET + 1, "data past end of memory" );
+                  return( -3 );
+              }
+              break;
+
+          case EXTENDED_LINER_ADDRESS:
+              break;
+
+          case END_OF_FILE:
+              break;
+
+          default :
+              set_hex_error( psErr, lLine, REC_TYPE_OFFSET + 1, "unknown record type" );
+              return( -4 );
+        }
+    }
+
+    return( max_addr );
 }
 
 
 /*
-  return the checksum of the sum
+  Copy a data record into the flat buffer of read_intel_hex_err
  */
-static unsigned char get_checksum( unsigned char sum )
+static int put_flat_data( void *pvUser, unsigned int lAddr, const unsigned char *pbData,
+                          unsigned int lLen )
 {
-   unsigned char rtnv;
+    tsFlatImage *psFlat = pvUser;
 
-   rtnv = 0 - sum % 256;
+    memcpy( &psFlat->pabData[ lAddr ], pbData, lLen );
+    if( NULL != psFlat->pabMap )
+    {
+        memset( &psFlat->pabMap[ lAddr ], 1, lLen );
+    }
 
-   return( rtnv );
+    return( 0 );
 }
 
 
 /*
-  check the checksum of the hex record
+  Fill in the error details if the caller asked for them
  */
-static int do_chechsum( const char *record )
+static void set_hex_error( tsIhexError *psErr, unsigned int lLine, unsigned int lColumn,
+                           const char *pacMsg )
 {
-   int i, rec_len, csum = 0;
-
-   rec_len = strlen( record ) - 2;
-   for( i = 1; i < rec_len; i = i + 2)
-   {
-       csum += (nibble( record[ i ]) << 4) + nibble( record[ i + 1]);
-   }
-   csum &= 0xFF;
-   
-   return( csum );
+    if( NULL != psErr )
+    {
+        psErr->lLine = lLine;
+        psErr->lColumn = lColumn;
+        psErr->pacMsg = pacMsg;
+    }
 }
-
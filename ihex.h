@@ -23,13 +23,37 @@
 #ifndef IHEX_H
 #define IHEX_H
 
+/* Characters in an encoded record with n data bytes, not counting a null */
+#define INTEL_HEX_LEN( n ) ( 11 + 2 * ( n ))
+
+/* Where read_intel_hex_err found the first problem in a file */
+typedef struct
+{
+    unsigned int lLine; /**< Line counting from 1, 0 if the file could not be read */
+    unsigned int lColumn; /**< Column counting from 1 */
+    const char *pacMsg; /**< What was wrong */
+} tsIhexError;
+
+/* Takes each data record from read_intel_hex_cb, returns 0 to carry on */
+typedef int (*tfIhexData)( void *pvUser, unsigned int lAddr, const unsigned char *pbData,
+                           unsigned int lLen );
+
 unsigned int read_intel_hex( char filename[], unsigned char data_ptr[], unsigned int length);
+unsigned int read_intel_hex_map( char filename[], unsigned char data_ptr[],
+                                 unsigned char map_ptr[], unsigned int length );
+unsigned int read_intel_hex_err( char filename[], unsigned char data_ptr[],
+                                 unsigned char map_ptr[], unsigned int length,
+                                 tsIhexError *psErr );
+unsigned int read_intel_hex_cb( char filename[], tfIhexData fData, void *pvUser,
+                                unsigned int length, tsIhexError *psErr );
 unsigned int write_intel_hex( unsigned char data_ptr[], unsigned int length,
                               unsigned int line_length, char filename[]);
 
 unsigned int snintel_hex( char abString[], unsigned int lStrLen, unsigned char bRecId,
                           unsigned char *pbBuff, unsigned char bBufLen,
                           unsigned short wStartAddr );
+unsigned int put_intel_hex( char *pacOut, unsigned char bRecId, const unsigned char *pbBuff,
+                            unsigned char bBufLen, unsigned short wStartAddr );
 int nibble( char c );
 
 #endif
@@ -0,0 +1,447 @@
+/*
+  File:         image.c
+  Written by:   Rod Boyce
+  e-mail:       rod@boyce.net.nz
+
+  This file is part of lpc935-prog
+
+  lpc935-prog is free software; you can redistribute it and/or modify
+  it under the terms of the Lesser GNU General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  lpc935-prog is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser
+  GNU General Public License for more details.
+
+  You should have received a copy of the Lesser GNU General Public
+  License along with lpc935-prog; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+  USA
+*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc.h"
+#include "image.h"
+
+/* Smallest buffer given to a run, records are usually 16 or 32 bytes */
+#define IMG_MIN_ALLOC 256
+
+static int img_Grow( tsImgSeg *psSeg, unsigned int lNeed );
+static int img_Insert( tsImg *psImg, int zAt, unsigned int lAddr, const unsigned char *pbData,
+                       unsigned int lLen );
+static void img_Merge( tsImg *psImg, int zFirst, int zLast, unsigned int lAddr,
+                       const unsigned char *pbData, unsigned int lLen );
+static void img_Mark( tsImg *psImg, unsigned int lAddr, unsigned int lLen );
+static int img_AddRecord( void *pvImg, unsigned int lAddr, const unsigned char *pbData,
+                          unsigned int lLen );
+
+
+/**
+ * Start an empty image
+ */
+void img_Init( tsImg *psImg )
+{
+    memset( psImg, 0, sizeof( *psImg ));
+}
+
+
+/**
+ * Release the runs of an image and leave it empty.  Only the bitmap
+ * bytes of the runs are cleared so this costs as much as the image holds.
+ */
+void img_Free( tsImg *psImg )
+{
+    unsigned int lFirst;
+    unsigned int lLast;
+    int i;
+
+    for( i = 0; i < psImg->zSegs; i++ )
+    {
+        lFirst = psImg->psSeg[ i ].lAddr >> 3;
+        lLast = ( psImg->psSeg[ i ].lAddr + psImg->psSeg[ i ].lLen - 1 ) >> 3;
+        memset( &psImg->abDefined[ lFirst ], 0, lLast - lFirst + 1 );
+        free( psImg->psSeg[ i ].pbData );
+    }
+    free( psImg->psSeg );
+    psImg->psSeg = NULL;
+    psImg->zSegs = 0;
+    psImg->zAlloc = 0;
+    psImg->lBytes = 0;
+}
+
+
+/**
+ * Define lLen bytes from lAddr.  Bytes already defined are overwritten,
+ * the way a later record in a hex file wins.  Records in address order
+ * extend the last run in place.
+ *
+ * @return 0, or -1 if the bytes lie past IMG_SPACE or there was no memory
+ */
+int img_Add( tsImg *psImg, unsigned int lAddr, const unsigned char *pbData, unsigned int lLen )
+{
+    tsImgSeg *psLast;
+    unsigned int lEnd = lAddr + lLen;
+    unsigned int lStart;
+    unsigned int lTop;
+    int zFirst;
+    int zLast;
+
+    if( 0 == lLen )
+    {
+        return( 0 );
+    }
+    if( lEnd > IMG_SPACE )
+    {
+        return( -1 );
+    }
+
+    psLast = ( 0 < psImg->zSegs ) ? &psImg->psSeg[ psImg->zSegs - 1 ] : NULL;
+    if(( NULL != psLast ) && ( lAddr == psLast->lAddr + psLast->lLen ))
+    {
+        /* The usual case, straight on from the record before */
+        if( 0 != img_Grow( psLast, psLast->lLen + lLen ))
+        {
+            return( -1 );
+        }
+        memcpy( psLast->pbData + psLast->lLen, pbData, lLen );
+        psLast->lLen += lLen;
+    }
+    else if(( NULL == psLast ) || ( lAddr > psLast->lAddr + psLast->lLen ))
+    {
+        if( 0 != img_Insert( psImg, psImg->zSegs, lAddr, pbData, lLen ))
+        {
+            return( -1 );
+        }
+    }
+    else
+    {
+        /* Out of order, find the runs it overlaps or touches */
+        zFirst = img_Find( psImg, lAddr );
+        if(( 0 < zFirst ) &&
+           ( psImg->psSeg[ zFirst - 1 ].lAddr + psImg->psSeg[ zFirst - 1 ].lLen == lAddr ))
+        {
+            zFirst--;
+        }
+        for( zLast = zFirst - 1;
+             ( zLast + 1 < psImg->zSegs ) && ( psImg->psSeg[ zLast + 1 ].lAddr <= lEnd );
+             zLast++ )
+        {
+        }
+
+        if( zLast < zFirst )
+        {
+            if( 0 != img_Insert( psImg, zFirst, lAddr, pbData, lLen ))
+            {
+                return( -1 );
+            }
+        }
+        else
+        {
+            /* Room for everything from the lowest to the highest byte */
+            lStart = psImg->psSeg[ zFirst ].lAddr;
+            lStart = ( lAddr < lStart ) ? lAddr : lStart;
+            lTop = psImg->psSeg[ zLast ].lAddr + psImg->psSeg[ zLast ].lLen;
+            lTop = ( lEnd > lTop ) ? lEnd : lTop;
+            if( 0 != img_Grow( &psImg->psSeg[ zFirst ], lTop - lStart ))
+            {
+                return( -1 );
+            }
+            img_Merge( psImg, zFirst, zLast, lAddr, pbData, lLen );
+        }
+    }
+
+    img_Mark( psImg, lAddr, lLen );
+
+    return( 0 );
+}
+
+
+/**
+ * Add the data records of an Intel hex file to the image
+ *
+ * @return The highest address the file defined or a negative number on
+ *         error, as read_intel_hex_cb
+ */
+int img_ReadHex( tsImg *psImg, char *pacFilename, tsIhexError *psErr )
+{
+    return( read_intel_hex_cb( pacFilename, img_AddRecord, psImg, IMG_SPACE, psErr ));
+}
+
+
+/**
+ * @return The highest defined address or -1 if the image is empty
+ */
+int img_Last( const tsImg *psImg )
+{
+    const tsImgSeg *psLast;
+
+    if( 0 == psImg->zSegs )
+    {
+        return( -1 );
+    }
+    psLast = &psImg->psSeg[ psImg->zSegs - 1 ];
+
+    return( psLast->lAddr + psLast->lLen - 1 );
+}
+
+
+/**
+ * @return The index of the first run holding lAddr or lying after it,
+ *         zSegs if there is none
+ */
+int img_Find( const tsImg *psImg, unsigned int lAddr )
+{
+    int zLo = 0;
+    int zHi = psImg->zSegs;
+    int zMid;
+
+    while( zLo < zHi )
+    {
+        zMid = ( zLo + zHi ) / 2;
+        if( psImg->psSeg[ zMid ].lAddr + psImg->psSeg[ zMid ].lLen <= lAddr )
+        {
+            zLo = zMid + 1;
+        }
+        else
+        {
+            zHi = zMid;
+        }
+    }
+
+    return( zLo );
+}
+
+
+/**
+ * Copy lLen bytes from lAddr into pbOut, 0xff where nothing is defined
+ */
+void img_Read( const tsImg *psImg, unsigned int lAddr, unsigned char *pbOut, unsigned int lLen )
+{
+    const tsImgSeg *psSeg;
+    unsigned int lEnd = lAddr + lLen;
+    unsigned int lFrom;
+    unsigned int lTo;
+    int i;
+
+    memset( pbOut, 0xff, lLen );
+    for( i = img_Find( psImg, lAddr ); ( i < psImg->zSegs ) && ( psImg->psSeg[ i ].lAddr < lEnd );
+         i++ )
+    {
+        psSeg = &psImg->psSeg[ i ];
+        lFrom = ( psSeg->lAddr > lAddr ) ? psSeg->lAddr : lAddr;
+        lTo = ( psSeg->lAddr + psSeg->lLen < lEnd ) ? psSeg->lAddr + psSeg->lLen : lEnd;
+        memcpy( pbOut + lFrom - lAddr, psSeg->pbData + lFrom - psSeg->lAddr, lTo - lFrom );
+    }
+}
+
+
+/**
+ * Step through the pages or sectors the image uses.  lBlock is a power of
+ * two and lAddr a multiple of it.
+ *
+ * @return The start of the first lBlock sized block at or after lAddr that
+ *         holds a defined byte, or -1 if there is none
+ */
+int img_NextBlock( const tsImg *psImg, unsigned int lAddr, unsigned int lBlock )
+{
+    int i = img_Find( psImg, lAddr );
+
+    if( i >= psImg->zSegs )
+    {
+        return( -1 );
+    }
+    if( psImg->psSeg[ i ].lAddr > lAddr )
+    {
+        lAddr = psImg->psSeg[ i ].lAddr;
+    }
+
+    return( lAddr & ~( lBlock - 1 ));
+}
+
+
+/**
+ * Work out every sector CRC and the global CRC of the image as the boot
+ * loader would for a flash holding it, see crc_Image.  Only the sectors
+ * the image uses are copied out.
+ *
+ * @param alSector - Filled with CRC_FLASH_SIZE / CRC_SECTOR_SIZE sector CRCs
+ * @param plGlobal - Filled with the global CRC
+ */
+void img_Crc( const tsImg *psImg, unsigned long alSector[], unsigned long *plGlobal )
+{
+    unsigned char abBlank[ CRC_SECTOR_SIZE ];
+    unsigned char abSector[ CRC_SECTOR_SIZE ];
+    const unsigned char *pbSector;
+    unsigned long lBlankCrc;
+    unsigned long lGlobal = CRC_INIT;
+    unsigned int lAddr;
+
+    memset( abBlank, 0xff, sizeof( abBlank ));
+    lBlankCrc = crc_Sector( abBlank, 0 );
+
+    for( lAddr = 0; lAddr < CRC_FLASH_SIZE; lAddr += CRC_SECTOR_SIZE )
+    {
+        if( lAddr == img_NextBlock( psImg, lAddr, CRC_SECTOR_SIZE ))
+        {
+            img_Read( psImg, lAddr, abSector, sizeof( abSector ));
+            pbSector = abSector;
+            alSector[ lAddr / CRC_SECTOR_SIZE ] = crc_Sector( abSector, 0 );
+        }
+        else
+        {
+            pbSector = abBlank;
+            alSector[ lAddr / CRC_SECTOR_SIZE ] = lBlankCrc;
+        }
+        lGlobal = crc_Update( lGlobal, pbSector, CRC_SECTOR_SIZE );
+    }
+
+    *plGlobal = lGlobal ^ CRC_XOROUT;
+}
+
+
+/*
+   Private functions
+ */
+/*
+  Make room in a run for lNeed bytes, at least doubling it so a run built
+  a record at a time is copied a few times only
+ */
+static int img_Grow( tsImgSeg *psSeg, unsigned int lNeed )
+{
+    unsigned char *pbNew;
+    unsigned int lAlloc;
+
+    if( lNeed <= psSeg->lAlloc )
+    {
+        return( 0 );
+    }
+
+    lAlloc = ( psSeg->lAlloc < IMG_MIN_ALLOC ) ? IMG_MIN_ALLOC : psSeg->lAlloc;
+    while( lAlloc < lNeed )
+    {
+        lAlloc *= 2;
+    }
+    if( NULL == ( pbNew = realloc( psSeg->pbData, lAlloc )))
+    {
+        return( -1 );
+    }
+    psSeg->pbData = pbNew;
+    psSeg->lAlloc = lAlloc;
+
+    return( 0 );
+}
+
+
+/*
+  Put a new run at index zAt, the caller has checked it touches no other
+ */
+static int img_Insert( tsImg *psImg, int zAt, unsigned int lAddr, const unsigned char *pbData,
+                       unsigned int lLen )
+{
+    tsImgSeg sSeg;
+    tsImgSeg *psNew;
+    int zAlloc;
+
+    memset( &sSeg, 0, sizeof( sSeg ));
+    if( 0 != img_Grow( &sSeg, lLen ))
+    {
+        return( -1 );
+    }
+
+    if( psImg->zSegs == psImg->zAlloc )
+    {
+        zAlloc = ( 0 == psImg->zAlloc ) ? 8 : psImg->zAlloc * 2;
+        if( NULL == ( psNew = realloc( psImg->psSeg, zAlloc * sizeof( tsImgSeg ))))
+        {
+            free( sSeg.pbData );
+            return( -1 );
+        }
+        psImg->psSeg = psNew;
+        psImg->zAlloc = zAlloc;
+    }
+
+    memcpy( sSeg.pbData, pbData, lLen );
+    sSeg.lAddr = lAddr;
+    sSeg.lLen = lLen;
+    memmove( &psImg->psSeg[ zAt + 1 ], &psImg->psSeg[ zAt ],
+             ( psImg->zSegs - zAt ) * sizeof( tsImgSeg ));
+    psImg->psSeg[ zAt ] = sSeg;
+    psImg->zSegs++;
+
+    return( 0 );
+}
+
+
+/*
+  Join runs zFirst to zLast and the new bytes into run zFirst.  The new
+  bytes cover every gap between the runs.  Run zFirst already has room.
+ */
+static void img_Merge( tsImg *psImg, int zFirst, int zLast, unsigned int lAddr,
+                       const unsigned char *pbData, unsigned int lLen )
+{
+    tsImgSeg *psSeg = &psImg->psSeg[ zFirst ];
+    unsigned int lStart = ( lAddr < psSeg->lAddr ) ? lAddr : psSeg->lAddr;
+    unsigned int lEnd;
+    int i;
+
+    if( lStart < psSeg->lAddr )
+    {
+        memmove( psSeg->pbData + psSeg->lAddr - lStart, psSeg->pbData, psSeg->lLen );
+        psSeg->lLen += psSeg->lAddr - lStart;
+        psSeg->lAddr = lStart;
+    }
+
+    for( i = zFirst + 1; i <= zLast; i++ )
+    {
+        memcpy( psSeg->pbData + psImg->psSeg[ i ].lAddr - lStart, psImg->psSeg[ i ].pbData,
+                psImg->psSeg[ i ].lLen );
+        free( psImg->psSeg[ i ].pbData );
+    }
+
+    lEnd = psImg->psSeg[ zLast ].lAddr + psImg->psSeg[ zLast ].lLen;
+    if( lEnd < lAddr + lLen )
+    {
+        lEnd = lAddr + lLen;
+    }
+    if( lEnd > lStart + psSeg->lLen )
+    {
+        psSeg->lLen = lEnd - lStart;
+    }
+    memcpy( psSeg->pbData + lAddr - lStart, pbData, lLen );
+
+    memmove( &psImg->psSeg[ zFirst + 1 ], &psImg->psSeg[ zLast + 1 ],
+             ( psImg->zSegs - zLast - 1 ) * sizeof( tsImgSeg ));
+    psImg->zSegs -= zLast - zFirst;
+}
+
+
+/*
+  Set the bitmap bits of lLen bytes from lAddr, counting the new ones
+ */
+static void img_Mark( tsImg *psImg, unsigned int lAddr, unsigned int lLen )
+{
+    unsigned char bBit;
+
+    for( ; lLen > 0; lAddr++, lLen-- )
+    {
+        bBit = 1 << ( lAddr & 7 );
+        if( 0 == ( psImg->abDefined[ lAddr >> 3 ] & bBit ))
+        {
+            psImg->abDefined[ lAddr >> 3 ] |= bBit;
+            psImg->lBytes++;
+        }
+    }
+}
+
+
+/*
+  read_intel_hex_cb sink for img_ReadHex
+ */
+static int img_AddRecord( void *pvImg, unsigned int lAddr, const unsigned char *pbData,
+                          unsigned int lLen )
+{
+    return( img_Add( pvImg, lAddr, pbData, lLen ));
+}
@@ -0,0 +1,66 @@
+/*
+  File:         image.h
+  Written by:   Rod Boyce
+  e-mail:       rod@boyce.net.nz
+
+  This file is part of lpc935-prog
+
+  lpc935-prog is free software; you can redistribute it and/or modify
+  it under the terms of the Lesser GNU General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  lpc935-prog is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser
+  GNU General Public License for more details.
+
+  You should have received a copy of the Lesser GNU General Public
+  License along with lpc935-prog; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+  USA
+*/
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "ihex.h"
+
+/* Address space of an image, the 16 bit ISP addresses */
+#define IMG_SPACE 65536
+
+/* A run of bytes the hex file defined */
+typedef struct
+{
+    unsigned int lAddr; /**< Address of the first byte */
+    unsigned int lLen; /**< Bytes in the run */
+    unsigned int lAlloc; /**< Bytes pbData has room for */
+    unsigned char *pbData; /**< The bytes */
+} tsImgSeg;
+
+/* A sparse image.  Only the bytes the hex file defined are held, as runs
+   in address order that never touch or overlap, with a bitmap to look up
+   a single address.  Everything else reads as erased flash, 0xff. */
+typedef struct
+{
+    tsImgSeg *psSeg; /**< The runs, NULL if there are none */
+    int zSegs; /**< Number of runs */
+    int zAlloc; /**< Runs psSeg has room for */
+    unsigned int lBytes; /**< Defined bytes over all the runs */
+    unsigned char abDefined[ IMG_SPACE / 8 ]; /**< One bit per address, set if defined */
+} tsImg;
+
+void img_Init( tsImg *psImg );
+void img_Free( tsImg *psImg );
+int img_Add( tsImg *psImg, unsigned int lAddr, const unsigned char *pbData, unsigned int lLen );
+int img_ReadHex( tsImg *psImg, char *pacFilename, tsIhexError *psErr );
+int img_Last( const tsImg *psImg );
+int img_Find( const tsImg *psImg, unsigned int lAddr );
+void img_Read( const tsImg *psImg, unsigned int lAddr, unsigned char *pbOut, unsigned int lLen );
+int img_NextBlock( const tsImg *psImg, unsigned int lAddr, unsigned int lBlock );
+void img_Crc( const tsImg *psImg, unsigned long alSector[], unsigned long *plGlobal );
+
+/* Non zero if the hex file defined the byte at lAddr */
+#define img_Defined( psImg, lAddr ) \
+    ((( psImg )->abDefined[ ( lAddr ) >> 3 ] >> (( lAddr ) & 7 )) & 1 )
+
+#endif
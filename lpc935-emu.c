@@ -0,0 +1,764 @@
+/*
+  File:         lpc935-emu.c
+  Written by:   Rod Boyce
+  e-mail:       rod@boyce.net.nz
+
+  This file is part of lpc935-prog
+
+  lpc935-prog is free software; you can redistribute it and/or modify
+  it under the terms of the Lesser GNU General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  lpc935-prog is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser
+  GNU General Public License for more details.
+
+  You should have received a copy of the Lesser GNU General Public
+  License along with lpc935-prog; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+  USA
+*/
+/*
+  LPC935 ISP emulator.  Opens a pseudo terminal and answers the boot loader
+  protocol on it from a simulated 8 KB flash and its configuration
+  registers, so lpc935-prog can be run and timed without a board:
+
+      lpc935-emu &
+      lpc935-prog -p /dev/pts/N -o serial -g image.hex
+
+  The name of the terminal to use is printed on the first line of stdout.
+  Every character is echoed as the real boot loader does and the echo and
+  replies are paced at the line rate the program set on the terminal.
+  Flash programming and erase take the times given on the command line.
+  While a record is being carried out the boot loader reads nothing, and
+  as on the part only --rxbuf of the characters that arrive in that time
+  are kept, the rest are lost.
+ */
+/* posix_openpt() and friends */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <popt.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+
+#include "ihex.h"
+#include "crc.h"
+#include "lpc935.h"
+
+/* Default flash timings in microseconds */
+#define EMU_PROG_US          2000 /* Programming each page a record touches */
+#define EMU_PAGE_ERASE_US    4000
+#define EMU_SECTOR_ERASE_US 40000
+
+/* Ids and version the emulated part reports */
+#define EMU_MANID   0x15
+#define EMU_DEVID   0xdd
+#define EMU_DERID   0x03
+#define EMU_VERSION 0x01
+
+/* Reset values of the configuration registers */
+#define EMU_UCFG1 0x63 /* Internal RC oscillator, reset pin and brownout enabled */
+#define EMU_BOOTV 0x1f
+#define EMU_STATB 0x01
+
+/* Character the boot loader measures the line rate from */
+#define EMU_AUTO_BAUD 'U'
+
+/* Status characters ending a reply */
+#define EMU_OK        '.'
+#define EMU_BAD_REC   'X' /* Checksum error or a record that makes no sense */
+#define EMU_PROTECTED 'R' /* Security bits stop the program or erase */
+
+/* Longest record, a full page of data as hex plus the header and checksum */
+#define EMU_LINE_SIZE ( 11 + 2 * 255 )
+
+/* Everything the emulated micro remembers */
+typedef struct
+{
+    unsigned char abFlash[ CRC_FLASH_SIZE ]; /**< Flash contents */
+    unsigned char bUcfg1; /**< User configuration register */
+    unsigned char bBootV; /**< Boot vector */
+    unsigned char bStatB; /**< Boot status byte */
+    unsigned char abSec[ CRC_FLASH_SIZE / CRC_SECTOR_SIZE ]; /**< Sector security bytes */
+    unsigned short wBrg; /**< Last value loaded by a direct baud rate load */
+    unsigned short wOffTime; /**< Bridge programmer power off time */
+    unsigned char bIcpState; /**< Bridge programmer ICP state */
+    int zRecords; /**< Records answered */
+    int zProgBytes; /**< Data bytes programmed */
+    int zPageErases; /**< Pages erased */
+    int zSectorErases; /**< Sectors erased */
+    int zBadRecords; /**< Records answered with an error status */
+    int zOverruns; /**< Characters lost while the boot loader was busy */
+} tsEmuTarget;
+
+int zProgUs = EMU_PROG_US; /**< Time to program one page */
+int zPageEraseUs = EMU_PAGE_ERASE_US; /**< Time to erase one page */
+int zSectorEraseUs = EMU_SECTOR_ERASE_US; /**< Time to erase one sector */
+int zBaud = 0; /**< Line rate to pace at, 0 follows the terminal, -1 does not pace */
+int zRxBuffer = LPC_RX_BUFFER; /**< Characters the UART holds while the boot loader is busy */
+int zShowDebug = 0; /**< If set print each record and its status */
+char *pacImage = NULL; /**< Hex file loaded into the flash at start up */
+char *pacLink = NULL; /**< Symbolic link made to the terminal name */
+
+static volatile sig_atomic_t zStop = 0;
+static long long llWireFree = 0; /**< When the last character sent has left the wire */
+
+struct poptOption optionsTable[] =
+{
+    { "prog-us", 0, POPT_ARG_INT, &zProgUs, 0,
+      "Time to program each page a record touches in microseconds", "USEC" },
+    { "page-us", 0, POPT_ARG_INT, &zPageEraseUs, 0,
+      "Time of a page erase in microseconds", "USEC" },
+    { "sector-us", 0, POPT_ARG_INT, &zSectorEraseUs, 0,
+      "Time of a sector erase in microseconds", "USEC" },
+    { "baud", 'b', POPT_ARG_INT, &zBaud, 0,
+      "Line rate to pace the replies at, 0 follows the port settings, -1 is no pacing",
+      "BAUD" },
+    { "rxbuf", 0, POPT_ARG_INT, &zRxBuffer, 0,
+      "Characters kept of those received while busy, the rest are lost", "N" },
+    { "image", 'i', POPT_ARG_STRING, &pacImage, 0,
+      "Hex file to load into the flash at start up", "FILE" },
+    { "link", 'l', POPT_ARG_STRING, &pacLink, 0,
+      "Make a symbolic link with this name to the terminal", "PATH" },
+    { "verbose", 'v', POPT_ARG_NONE, &zShowDebug, 0, "Print each record received", 0 },
+
+    POPT_AUTOHELP
+    POPT_TABLEEND
+};
+
+static void emu_Init( tsEmuTarget *psTgt );
+static int emu_Record( tsEmuTarget *psTgt, char *pacLine, char *pacData, int zSize );
+static int emu_Program( tsEmuTarget *psTgt, unsigned short wAddr, unsigned char *pbDat,
+                        int zLen );
+static int emu_Erase( tsEmuTarget *psTgt, unsigned char bType, unsigned short wAddr );
+static int emu_MiscWrite( tsEmuTarget *psTgt, unsigned char bReg, unsigned char bVal );
+static int emu_MiscRead( tsEmuTarget *psTgt, unsigned char bReg, unsigned char *pbVal );
+static void emu_Send( int fdSlave, int fdMaster, const char *pacBuf, int zLen );
+static long emu_Rate( int fdSlave );
+static int emu_Overrun( int fdSlave, int fdMaster, int zBuffered, long long llBusy );
+static long long emu_Usec( void );
+static void emu_Sleep( long long llUs );
+static void emu_Signal( int zSig );
+
+
+int main( const int argc, const char **argv )
+{
+    poptContext optCon;
+    tsEmuTarget sTgt;
+    struct termios sTio;
+    struct sigaction sAct;
+    char acLine[ EMU_LINE_SIZE + 1 ];
+    char acData[ 16 ];
+    char acBuf[ 256 ];
+    long long llBusy;
+    int zLineLen = 0;
+    int zRecLen = 0;
+    int zKeep = 0;
+    int zDrop = 0;
+    int fdMaster;
+    int fdSlave;
+    int zRead;
+    int i;
+    char c;
+
+    optCon = poptGetContext( NULL, argc, argv, optionsTable, 0 );
+    while(( c = poptGetNextOpt( optCon )) >= 0 )
+    {
+        /* All the options are stored straight into their variables */
+    }
+
+    emu_Init( &sTgt );
+    if(( NULL != pacImage ) &&
+       ( 0 > ( int )read_intel_hex( pacImage, sTgt.abFlash, sizeof( sTgt.abFlash ))))
+    {
+        fprintf( stderr, "Image %s not found\n", pacImage );
+        return( 1 );
+    }
+
+    fdMaster = posix_openpt( O_RDWR | O_NOCTTY );
+    if(( 0 > fdMaster ) || ( 0 != grantpt( fdMaster )) || ( 0 != unlockpt( fdMaster )))
+    {
+        perror( "lpc935-emu: posix_openpt" );
+        return( 1 );
+    }
+
+    /* Keep the slave open ourselves so the master does not see a hang up
+       each time the programmer closes the port */
+    fdSlave = open( ptsname( fdMaster ), O_RDWR | O_NOCTTY );
+    if( 0 > fdSlave )
+    {
+        perror( "lpc935-emu: open slave" );
+        return( 1 );
+    }
+    tcgetattr( fdSlave, &sTio );
+    cfmakeraw( &sTio );
+    cfsetispeed( &sTio, B4800 );
+    cfsetospeed( &sTio, B4800 );
+    tcsetattr( fdSlave, TCSANOW, &sTio );
+
+    if( NULL != pacLink )
+    {
+        unlink( pacLink );
+        if( 0 != symlink( ptsname( fdMaster ), pacLink ))
+        {
+            perror( "lpc935-emu: symlink" );
+        }
+    }
+
+    printf( "%s\n", ptsname( fdMaster ));
+    fflush( stdout );
+
+    /* No SA_RESTART so a signal gets us out of the blocking read */
+    memset( &sAct, 0, sizeof( sAct ));
+    sAct.sa_handler = emu_Signal;
+    sigaction( SIGINT, &sAct, NULL );
+    sigaction( SIGTERM, &sAct, NULL );
+    sigaction( SIGHUP, &sAct, NULL );
+
+    while( 0 == zStop )
+    {
+        zRead = read( fdMaster, acBuf, sizeof( acBuf ));
+        if( 0 >= zRead )
+        {
+            if(( 0 > zRead ) && ( EINTR == errno ))
+            {
+                continue;
+            }
+            break;
+        }
+
+        for( i = 0; i < zRead; i++ )
+        {
+            /* Past what the receive buffer held while we were busy */
+            if(( 0 == zKeep ) && ( 0 < zDrop ))
+            {
+                zDrop--;
+                sTgt.zOverruns++;
+                continue;
+            }
+            if( 0 < zKeep )
+            {
+                zKeep--;
+            }
+
+            if( 0 == zLineLen )
+            {
+                /* Between records only the autobaud character and the start
+                   of a record mean anything */
+                if( EMU_AUTO_BAUD == acBuf[ i ])
+                {
+                    emu_Send( fdSlave, fdMaster, &acBuf[ i ], 1 );
+                }
+                else if( ':' == acBuf[ i ])
+                {
+                    acLine[ zLineLen++ ] = ':';
+                    zRecLen = 0;
+                    emu_Send( fdSlave, fdMaster, &acBuf[ i ], 1 );
+                }
+                continue;
+            }
+
+            acLine[ zLineLen++ ] = acBuf[ i ];
+            emu_Send( fdSlave, fdMaster, &acBuf[ i ], 1 );
+
+            /* The length field says how long the record is, a bad one ends
+               the record here */
+            if( 3 == zLineLen )
+            {
+                zRecLen = 3;
+                if( isxdigit(( unsigned char )acLine[ 1 ]) &&
+                    isxdigit(( unsigned char )acLine[ 2 ]))
+                {
+                    zRecLen = 11 + 2 * (( nibble( acLine[ 1 ]) << 4 ) | nibble( acLine[ 2 ]));
+                }
+            }
+
+            if(( 3 <= zLineLen ) && (( zLineLen == zRecLen ) || ( EMU_LINE_SIZE <= zLineLen )))
+            {
+                acLine[ zLineLen ] = '\0';
+                llBusy = emu_Usec();
+                zLineLen = emu_Record( &sTgt, acLine, acData, sizeof( acData ));
+
+                /* Everything that came in while the record was carried out
+                   waited in the UART.  Only what is here before the reply
+                   goes out counts, the programmer may answer the reply at
+                   once */
+                zDrop = emu_Overrun( fdSlave, fdMaster, zRead - i - 1, emu_Usec() - llBusy );
+                zKeep = ( 0 < zDrop ) ? zRxBuffer : 0;
+
+                emu_Send( fdSlave, fdMaster, acData, zLineLen );
+                zLineLen = 0;
+            }
+        }
+    }
+
+    printf( "%d records, %d bytes programmed, %d page and %d sector erases, %d errors, "
+            "%d characters lost\n", sTgt.zRecords, sTgt.zProgBytes, sTgt.zPageErases,
+            sTgt.zSectorErases, sTgt.zBadRecords, sTgt.zOverruns );
+
+    if( NULL != pacLink )
+    {
+        unlink( pacLink );
+    }
+    close( fdSlave );
+    close( fdMaster );
+    poptFreeContext( optCon );
+
+    return( 0 );
+}
+
+
+/*
+  Put the target in the state of an erased part out of the factory.
+ */
+static void emu_Init( tsEmuTarget *psTgt )
+{
+    memset( psTgt, 0, sizeof( *psTgt ));
+    memset( psTgt->abFlash, 0xff, sizeof( psTgt->abFlash ));
+    psTgt->bUcfg1 = EMU_UCFG1;
+    psTgt->bBootV = EMU_BOOTV;
+    psTgt->bStatB = EMU_STATB;
+    psTgt->wOffTime = 100;
+    psTgt->bIcpState = 1;
+}
+
+
+/*
+  Carry out one complete record held in pacLine.  The data of the reply,
+  its status character and the CR/LF are written to pacData.
+  Returns the length of the reply.
+ */
+static int emu_Record( tsEmuTarget *psTgt, char *pacLine, char *pacData, int zSize )
+{
+    unsigned char abRec[ 5 + 255 ];
+    unsigned char bSum = 0;
+    unsigned char bLen;
+    unsigned char bType;
+    unsigned short wAddr;
+    unsigned char *pbDat;
+    unsigned char bVal;
+    char cStatus = EMU_OK;
+    int zBytes;
+    int i;
+
+    psTgt->zRecords++;
+    pacData[ 0 ] = '\0';
+
+    /* Turn the hex back into bytes, a bad digit fails the checksum */
+    zBytes = ( strlen( pacLine ) - 1 ) / 2;
+    for( i = 0; i < zBytes; i++ )
+    {
+        if(( !isxdigit(( unsigned char )pacLine[ 1 + 2 * i ])) ||
+           ( !isxdigit(( unsigned char )pacLine[ 2 + 2 * i ])))
+        {
+            cStatus = EMU_BAD_REC;
+            break;
+        }
+        abRec[ i ] = ( nibble( pacLine[ 1 + 2 * i ]) << 4 ) | nibble( pacLine[ 2 + 2 * i ]);
+        bSum += abRec[ i ];
+    }
+
+    bLen = abRec[ 0 ];
+    wAddr = ( abRec[ 1 ] << 8 ) | abRec[ 2 ];
+    bType = abRec[ 3 ];
+    pbDat = &abRec[ 4 ];
+
+    if(( EMU_OK != cStatus ) || ( 0 != bSum ) || ( zBytes != bLen + 5 ))
+    {
+        cStatus = EMU_BAD_REC;
+    }
+    else
+    {
+        switch( bType )
+        {
+          case( PROGRAM_DATA ) :
+              cStatus = emu_Program( psTgt, wAddr, pbDat, bLen );
+              break;
+
+          case( READ_VERSION_ID ) :
+              snprintf( pacData, zSize, "%02x", EMU_VERSION );
+              break;
+
+          case( MISC_WRITE_FN ) :
+              cStatus = ( 2 == bLen ) ? emu_MiscWrite( psTgt, pbDat[ 0 ], pbDat[ 1 ]) :
+                  EMU_BAD_REC;
+              break;
+
+          case( MISC_READ_FN ) :
+              if(( 1 == bLen ) && ( EMU_OK == ( cStatus = emu_MiscRead( psTgt, pbDat[ 0 ], &bVal ))))
+              {
+                  snprintf( pacData, zSize, "%02x", bVal );
+              }
+              break;
+
+          case( ERASE_SECTOR_PAGE ) :
+              cStatus = ( 3 == bLen ) ?
+                  emu_Erase( psTgt, pbDat[ 0 ], ( pbDat[ 1 ] << 8 ) | pbDat[ 2 ]) :
+                  EMU_BAD_REC;
+              break;
+
+          case( READ_SECTOR_CRC ) :
+              if(( 1 == bLen ) && (( pbDat[ 0 ] << 8 ) < CRC_FLASH_SIZE ))
+              {
+                  snprintf( pacData, zSize, "%08lx",
+                            crc_Sector( psTgt->abFlash, ( pbDat[ 0 ] << 8 ) &
+                                        ~( CRC_SECTOR_SIZE - 1 )));
+              }
+              else
+              {
+                  cStatus = EMU_BAD_REC;
+              }
+              break;
+
+          case( READ_GLOBAL_CRC ) :
+              snprintf( pacData, zSize, "%08lx", crc_Global( psTgt->abFlash ));
+              break;
+
+          case( DIRECT_LOAD_BAUD_RATE ) :
+              /* The terminal rate follows when the programmer changes its
+                 side, only the BRG value is kept */
+              psTgt->wBrg = ( 2 == bLen ) ? (( pbDat[ 0 ] << 8 ) | pbDat[ 1 ]) : psTgt->wBrg;
+              break;
+
+          case( RESET_MCU ) :
+              break;
+
+          case( PROG_GET ) :
+              if(( 1 == bLen ) && ( PROG_PWR_OFF_TIME == pbDat[ 0 ]))
+              {
+                  snprintf( pacData, zSize, "%04x", psTgt->wOffTime );
+              }
+              else if(( 1 == bLen ) && ( PROG_ICP_STATE == pbDat[ 0 ]))
+              {
+                  snprintf( pacData, zSize, "%02x", psTgt->bIcpState );
+              }
+              else
+              {
+                  cStatus = EMU_BAD_REC;
+              }
+              break;
+
+          case( PROG_SET ) :
+              if(( 3 == bLen ) && ( PROG_PWR_OFF_TIME == pbDat[ 0 ]))
+              {
+                  psTgt->wOffTime = ( pbDat[ 1 ] << 8 ) | pbDat[ 2 ];
+              }
+              else if(( 2 == bLen ) && ( PROG_ICP_STATE == pbDat[ 0 ]))
+              {
+                  psTgt->bIcpState = pbDat[ 1 ];
+              }
+              else
+              {
+                  cStatus = EMU_BAD_REC;
+              }
+              break;
+
+          default :
+              cStatus = EMU_BAD_REC;
+              break;
+        }
+    }
+
+    if( EMU_OK != cStatus )
+    {
+        psTgt->zBadRecords++;
+        pacData[ 0 ] = '\0';
+    }
+
+    if( 0 != zShowDebug )
+    {
+        fprintf( stderr, "%s %s%c\n", pacLine, pacData, cStatus );
+    }
+
+    i = strlen( pacData );
+    snprintf( pacData + i, zSize - i, "%c\r\n", cStatus );
+
+    return( i + 3 );
+}
+
+
+/*
+  Program zLen bytes at wAddr.  Flash bits can only be cleared so the data
+  is ANDed in, just like the part.  Takes zProgUs for each page touched.
+  Returns the status character of the reply.
+ */
+static int emu_Program( tsEmuTarget *psTgt, unsigned short wAddr, unsigned char *pbDat,
+                        int zLen )
+{
+    int zPages;
+    int i;
+
+    if(( 0 == zLen ) || ( CRC_FLASH_SIZE < wAddr + zLen ))
+    {
+        return( EMU_BAD_REC );
+    }
+
+    for( i = 0; i < zLen; i++ )
+    {
+        if( 0 != ( psTgt->abSec[( wAddr + i ) / CRC_SECTOR_SIZE ] & eSPEDISx ))
+        {
+            return( EMU_PROTECTED );
+        }
+    }
+
+    for( i = 0; i < zLen; i++ )
+    {
+        psTgt->abFlash[ wAddr + i ] &= pbDat[ i ];
+    }
+    psTgt->zProgBytes += zLen;
+
+    zPages = ( wAddr + zLen - 1 ) / FLASH_PAGE_SIZE - wAddr / FLASH_PAGE_SIZE + 1;
+    emu_Sleep(( long long )zPages * zProgUs );
+
+    return( EMU_OK );
+}
+
+
+/*
+  Erase the page or sector holding wAddr unless its security byte says no.
+  Returns the status character of the reply.
+ */
+static int emu_Erase( tsEmuTarget *psTgt, unsigned char bType, unsigned short wAddr )
+{
+    int zSize;
+
+    if( CRC_FLASH_SIZE <= wAddr )
+    {
+        return( EMU_BAD_REC );
+    }
+    if( 0 != ( psTgt->abSec[ wAddr / CRC_SECTOR_SIZE ] & ( eEDISx | eSPEDISx )))
+    {
+        return( EMU_PROTECTED );
+    }
+
+    if( DO_SECTOR == bType )
+    {
+        zSize = CRC_SECTOR_SIZE;
+        psTgt->zSectorErases++;
+        emu_Sleep( zSectorEraseUs );
+    }
+    else if( DO_PAGE == bType )
+    {
+        zSize = FLASH_PAGE_SIZE;
+        psTgt->zPageErases++;
+        emu_Sleep( zPageEraseUs );
+    }
+    else
+    {
+        return( EMU_BAD_REC );
+    }
+
+    memset( &psTgt->abFlash[ wAddr & ~( zSize - 1 )], 0xff, zSize );
+
+    return( EMU_OK );
+}
+
+
+/*
+  Write one of the configuration registers.  Once CWP is set in the status
+  byte the configuration can no longer be changed.
+  Returns the status character of the reply.
+ */
+static int emu_MiscWrite( tsEmuTarget *psTgt, unsigned char bReg, unsigned char bVal )
+{
+    int zRtnv = EMU_OK;
+
+    if(( 0 != ( psTgt->bStatB & eCWP )) && ( PUT_STATB != bReg ))
+    {
+        zRtnv = EMU_PROTECTED;
+    }
+    else if( PUT_UCFG1 == bReg )
+    {
+        psTgt->bUcfg1 = bVal;
+    }
+    else if( PUT_BOOTV == bReg )
+    {
+        psTgt->bBootV = bVal;
+    }
+    else if( PUT_STATB == bReg )
+    {
+        psTgt->bStatB = bVal;
+    }
+    else if(( PUT_SECB0 <= bReg ) && ( PUT_SECB7 >= bReg ))
+    {
+        /* Security bits can only be set, a chip erase clears them */
+        psTgt->abSec[ bReg - PUT_SECB0 ] |= bVal;
+    }
+    else
+    {
+        zRtnv = EMU_BAD_REC;
+    }
+
+    return( zRtnv );
+}
+
+
+/*
+  Read one of the configuration registers or ids into *pbVal.
+  Returns the status character of the reply.
+ */
+static int emu_MiscRead( tsEmuTarget *psTgt, unsigned char bReg, unsigned char *pbVal )
+{
+    int zRtnv = EMU_OK;
+
+    switch( bReg )
+    {
+      case( GET_UCFG1 ) : *pbVal = psTgt->bUcfg1; break;
+      case( GET_BOOTV ) : *pbVal = psTgt->bBootV; break;
+      case( GET_STATB ) : *pbVal = psTgt->bStatB; break;
+      case( GET_MANID ) : *pbVal = EMU_MANID; break;
+      case( GET_DEVID ) : *pbVal = EMU_DEVID; break;
+      case( GET_DERID ) : *pbVal = EMU_DERID; break;
+
+      default :
+          if(( GET_SECB0 <= bReg ) && ( GET_SECB7 >= bReg ))
+          {
+              *pbVal = psTgt->abSec[ bReg - GET_SECB0 ];
+          }
+          else
+          {
+              zRtnv = EMU_BAD_REC;
+          }
+          break;
+    }
+
+    return( zRtnv );
+}
+
+
+/*
+  Send characters to the programmer no faster than the line rate.  A real
+  UART takes ten bit times per character, the pseudo terminal takes none,
+  so the time each character would have left the wire is tracked and we
+  sleep once we get ahead of it.
+ */
+static void emu_Send( int fdSlave, int fdMaster, const char *pacBuf, int zLen )
+{
+    long long llNow;
+    long zRate;
+
+    zRate = emu_Rate( fdSlave );
+    if( 0 < zRate )
+    {
+        llNow = emu_Usec();
+        if( llWireFree < llNow )
+        {
+            llWireFree = llNow;
+        }
+        llWireFree += ( zLen * 10000000LL ) / zRate;
+        if( llWireFree - llNow > 200 )
+        {
+            emu_Sleep( llWireFree - llNow );
+        }
+    }
+
+    if( zLen != write( fdMaster, pacBuf, zLen ))
+    {
+        zStop = 1;
+    }
+}
+
+
+/*
+  Line rate in use, --baud or else the rate the programmer set on the
+  terminal.  Returns -1 if the characters are not to be paced.
+ */
+static long emu_Rate( int fdSlave )
+{
+    struct termios sTio;
+    long zRate = zBaud;
+
+    if( 0 == zRate )
+    {
+        /* The pty keeps the rate the programmer set even though it ignores it */
+        tcgetattr( fdSlave, &sTio );
+        switch( cfgetospeed( &sTio ))
+        {
+          case( B1200 ) : zRate = 1200; break;
+          case( B2400 ) : zRate = 2400; break;
+          case( B4800 ) : zRate = 4800; break;
+          case( B9600 ) : zRate = 9600; break;
+          case( B19200 ) : zRate = 19200; break;
+          case( B38400 ) : zRate = 38400; break;
+          case( B57600 ) : zRate = 57600; break;
+          case( B115200 ) : zRate = 115200; break;
+          case( B230400 ) : zRate = 230400; break;
+          case( B460800 ) : zRate = 460800; break;
+          default : zRate = -1; break;
+        }
+    }
+
+    return( zRate );
+}
+
+
+/*
+  Work out how many characters were lost while the boot loader spent
+  llBusy microseconds on a record.  The programmer's characters are all
+  waiting at once on the pseudo terminal, zBuffered of them already read,
+  but on a wire only those that fit in llBusy at the line rate would have
+  arrived.  The UART keeps zRxBuffer of them.
+  Returns the number of characters lost, after the zRxBuffer kept ones.
+ */
+static int emu_Overrun( int fdSlave, int fdMaster, int zBuffered, long long llBusy )
+{
+    long long llArrived;
+    long zRate;
+    int zWaiting = 0;
+
+    if( 0 != ioctl( fdMaster, FIONREAD, &zWaiting ))
+    {
+        zWaiting = 0;
+    }
+    llArrived = zBuffered + zWaiting;
+
+    zRate = emu_Rate( fdSlave );
+    if(( 0 < zRate ) && ( llArrived > ( llBusy * zRate ) / 10000000LL ))
+    {
+        llArrived = ( llBusy * zRate ) / 10000000LL;
+    }
+
+    return(( llArrived > zRxBuffer ) ? llArrived - zRxBuffer : 0 );
+}
+
+
+static long long emu_Usec( void )
+{
+    struct timespec sNow;
+
+    clock_gettime( CLOCK_MONOTONIC, &sNow );
+
+    return(( long long )sNow.tv_sec * 1000000LL + sNow.tv_nsec / 1000 );
+}
+
+
+static void emu_Sleep( long long llUs )
+{
+    struct timespec sDelay;
+
+    if( 0 < llUs )
+    {
+        sDelay.tv_sec = llUs / 1000000;
+        sDelay.tv_nsec = ( llUs % 1000000 ) * 1000;
+        while(( 0 != nanosleep( &sDelay, &sDelay )) && ( EINTR == errno ) && ( 0 == zStop ))
+        {
+        }
+    }
+}
+
+
+static void emu_Signal( int zSig )
+{
+    zStop = 1;
+}
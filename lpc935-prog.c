@@ -31,111 +31,58 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <termios.h>
+#include <time.h>
+#endif
+#ifdef LINUX
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <pthread.h>
 #endif
 #if defined(WINDOWS) || defined(WIN32) ||defined(_WIN32)
 #include <windows.h>
+#include <sys/stat.h>
 #include <time.h>
 #endif
 
 #include "ihex.h"
-#include "serial.h"
-
-/* Defines for the reset and power down logic */
-#define LN_LO (0)
-#define LN_HI (1)
-#define PWR_OFF LN_HI
-#define PWR_ON  LN_LO
-#define RST_HI LN_LO
-#define RST_LO LN_HI
-
-/* Defines for the Auto baud resync */
-#define BAUD_SYNC_ERR_CNT 8
-#define AUTO_BAUD_CHAR 'U'
-#define AUTO_BAUD_STR "U"
-
-/* Defines from the user manual for the LPC935 From Table 19-2 page 147 */
-
-/* Record types */
-/* 00 Program used program code memory */
-/* 01 Read version ID */
-#define READ_VERSION_ID 0x01
-/* 02 Misc write functions */
-#define MISC_WRITE_FN 0x02
-#define PUT_UCFG1 0x00
-#define PUT_BOOTV 0x02
-#define PUT_STATB 0x03
-#define PUT_SECB0 0x08
-#define PUT_SECB1 0x09
-#define PUT_SECB2 0x0a
-#define PUT_SECB3 0x0b
-#define PUT_SECB4 0x0c
-#define PUT_SECB5 0x0d
-#define PUT_SECB6 0x0e
-#define PUT_SECB7 0x0f
-/* #define PUT_CCP   0x10 This is a guess based on an error in the manual */
-/* 03 Misc read functions */
-#define MISC_READ_FN 0x03
-#define GET_UCFG1 0x00
-#define GET_BOOTV 0x02
-#define GET_STATB 0x03
-#define GET_SECB0 0x08
-#define GET_SECB1 0x09
-#define GET_SECB2 0x0a
-#define GET_SECB3 0x0b
-#define GET_SECB4 0x0c
-#define GET_SECB5 0x0d
-#define GET_SECB6 0x0e
-#define GET_SECB7 0x0f
-#define GET_MANID 0x10
-#define GET_DEVID 0x11
-#define GET_DERID 0x12
-/* 04 Erase sector page */
-#define ERASE_SECTOR_PAGE 0x04
-#define DO_PAGE   0x00
-#define DO_SECTOR 0x01
-/* 05 Read sector CRC */
-#define READ_SECTOR_CRC 0x05
-/* 06 Read global CRC */
-#define READ_GLOBAL_CRC 0x06
-/* 07 Direct load of baud rate */
-#define DIRECT_LOAD_BAUD_RATE 0x07
-/* 08 Reset MCU */
-#define RESET_MCU 0x08
-
-/* 10 programmer read */
-#define PROG_GET 0x0a
-/* 08 programmer write */
-#define PROG_SET 0x0b
-/* programer get and set sub commands */
-#define PROG_PWR_OFF_TIME 0
-#define PROG_ICP_STATE    1
-
-typedef enum
-{
-    eWDTE = 0x80,  /**< Watchdog time enable */
-    eRPE = 0x40, /**< Reset pin enable */
-    eBOE = 0x20, /**< Brownout detect enable */
-    eWDSE = 0x10, /**< Watchdog Safely enable bit */
-    eFOSC2 = 0x04, /**< Oscillator configuration bit 2 */
-    eFOSC1 = 0x02, /**< Oscillator configuration bit 1 */
-    eFOSC0 = 0x01 /**< Oscillator configuration bit 0 */
-} teUCFG1_BITS;
-
-typedef enum
-{
-    eEDISx = 0x04, /**< Disable the ability to erase the sector prtected by this register  */
-    eSPEDISx = 0x02, /**< Disable the ability to program or erase this sector */
-    eMOVCDISx = 0x01 /**< Disable the movc instruction for this sector */
-} teSECx;
-
-typedef enum
-{
-    eDCCP = 0x80, /**< Disable Clear Configuration Protection command */
-    eCWP = 0x40, /**< Configuration Write protect bit. */
-    eAWP = 0x20, /**< Activate Write protect bit. */
-    eBSB = 0x01 /**< Boot Status Bit. */
-} teBOOTSTAT;
-
+#include "crc.h"
+#include "lpc935.h"
+
+/* Erase planner cost model.  The erase times are starting guesses and can
+   be tuned on real boards with --page-us and --sector-us */
+#define PAGE_ERASE_US   4000
+#define SECTOR_ERASE_US 40000
+/* Characters on the wire for one erase, the command is sent and echoed
+   then followed by the status and CR/LF */
+#define ERASE_CMD_CHARS 37
+/* Characters on the wire for the sector CRC read that checks a page
+   erased sector, the command, its echo, the CRC and the status */
+#define CRC_CMD_CHARS 37
+
+/* Daemon limits */
+#define MAX_DAEMON_PORTS   8 /* Ports one daemon may own */
+#define MAX_DAEMON_CLIENTS 8 /* Clients connected at once */
+#define DAEMON_LINE_SIZE   512 /* Longest request line */
+/* Gang programming, boards programmed at once and how far each one got */
+#define MAX_GANG_PORTS 16
+#define GANG_OPEN    0 /* Opening the port */
+#define GANG_ENTRY   1 /* Entering the boot loader */
+#define GANG_ERASE   2 /* Erasing the sectors the image uses */
+#define GANG_PROGRAM 3 /* Programming the image */
+#define GANG_VERIFY  4 /* Programmed but the CRCs did not match */
+#define GANG_DONE    5 /* Programmed and verified if asked */
+/* Parsed hex files kept in memory, reloaded when the file changes */
+#define IMAGE_CACHE_SIZE   4
+
+/* What the erase planner decided for each sector */
+#define PLAN_SKIP    0 /* Sector matches the image */
+#define PLAN_PROGRAM 1 /* Sector differs and is blank on the device */
+#define PLAN_SECTOR  2 /* Sector differs and is erased as a whole */
+#define PLAN_PAGES   3 /* Sector differs and the pages the image uses are erased */
 
 typedef enum
 {
@@ -145,6 +92,9 @@ typedef enum
     eRESET, /**< Reset the micro-controller */
     eWRITE, /**< Write to a flash based register on the chip */
     ePROG, /**< Program a file to the micro-controller */
+    eSCRIPT, /**< Run a list of commands from a file in one session */
+    eDAEMON, /**< Keep the ports open and take commands from a Unix socket */
+    eGANG, /**< Program one file into boards on several ports at once */
     
     eNO_MORE_COMMANDS /**< End of list token ignore all commands greater than this */
 } tePROG_COMMAND;
@@ -154,10 +104,54 @@ int zShowDebug = 0; /**< If set then print out lots of debug information */
 int zSecBytex = -1; /**< The security byte to read */
 int zOperAddr = 0; /**< The address that a operation will be performed on */
 int zIsSerProg = 1; /**< is set to 1 of we are programming with serial programmer */
+int zTxGuard = 0; /**< Fixed delay in microseconds after each transmit, 0 is reply driven */
+int zProgWindow = 1; /**< Program records in flight at once, 1 is stop and wait */
+int zRxBuffer = LPC_RX_BUFFER; /**< Characters the target holds while it writes flash */
+int zRecSize = 0; /**< Data bytes per program record, 0 uses the largest allowed */
+int zBenchRecords = 0; /**< If set program once per record size and report the data rate */
+int zDiffProg = 0; /**< If set only erase and program sectors whose CRC differs */
+int zVerify = 0; /**< If set check the sector CRCs after programming */
+int zPageEraseUs = PAGE_ERASE_US; /**< Planner estimate of one page erase */
+int zSectorEraseUs = SECTOR_ERASE_US; /**< Planner estimate of one sector erase */
+int zMaxBaud = 0; /**< Fastest rate to switch to after autobaud, 0 stays at zBaud */
+int zOscFreq = 0; /**< Oscillator frequency in Hz when running from a crystal */
 char *pacComPort; /**< The communications port to used to talk to the micro */
 char *pacHexFile; /**< The hex filename to program into the micro-controller */
 char *pacSubCommand = NULL; /**< This is the sub command that is required */
+char *pacScript = NULL; /**< File of commands to run in script mode, - for stdin */
+char *pacDaemon = NULL; /**< Unix socket the daemon listens on */
+char *pacGang = NULL; /**< Comma separated ports to gang program */
 char *pacProgrammer = "bridge"; /**< Programmer to use either serial of bridge default is serial */
+char *pacTiming = NULL; /**< Report phase and command times, json or text */
+char *pacTimingFile = NULL; /**< Where the timing report goes, default stderr */
+tsTiming *psTiming = NULL; /**< Times of this session when --timing is given */
+int zSlowest = 0; /**< Slowest program records to list in the timing report */
+char *pacTrace = NULL; /**< File to capture every chunk on the wire to */
+tsTrace *psTrace = NULL; /**< Open trace when --trace is given */
+
+/* A parsed hex file kept in the image cache */
+typedef struct
+{
+    char acPath[ 256 ]; /**< File name as given by the user */
+    time_t tMtime; /**< Modification time when the file was parsed */
+    off_t lSize; /**< File size when the file was parsed */
+    int zLast; /**< Highest address the file defined */
+    tsImg sImg; /**< Only the bytes the file defined */
+    tsTxImage sTx; /**< Program records, encoded when the file is parsed */
+    unsigned long alCrc[ CRC_FLASH_SIZE / CRC_SECTOR_SIZE ]; /**< CRC of every sector */
+    unsigned long lGlobalCrc; /**< CRC of the whole flash */
+} tsImage;
+
+/* A hex file being parsed and encoded while the board enters the boot loader */
+typedef struct
+{
+    char *pacFilename; /**< File to load */
+    tsImage *psImg; /**< The loaded image, NULL if it could not be loaded */
+#ifdef LINUX
+    pthread_t tThread; /**< Worker doing the load */
+    int zThread; /**< Set while the worker has to be joined */
+#endif
+} tsPrepare;
 
 tePROG_COMMAND eProgCommand; /**< The command to perform on the micro-controller */
 
@@ -170,6 +164,8 @@ typedef enum
     ERASE_SECTOR, ERASE_PAGE,
 
     PROG_OFF_TIME, PROG_ENT_ICP,
+
+    READ_ALL,
     
     END_OF_SUBCMD_LIST
 } teSUB_COMMAND_ID;
@@ -188,6 +184,7 @@ char *pacCommandList[] =
     [ ERASE_PAGE    ] = "page",
     [ PROG_OFF_TIME ] = "pofftime",
     [ PROG_ENT_ICP  ] = "p2icp",
+    [ READ_ALL      ] = "all",
 
     NULL
 };
@@ -205,19 +202,60 @@ struct poptOption optionsTable[] =
       "Write a control register", "ucfg1|bootv|statb|pofftime|p2icp" },
 
     { "read", 'r', POPT_ARG_STRING, &pacSubCommand, eREAD,
-      "Read a control register", "ids|version|statb|bootv|ucfg1|secx|gcrc|scrc|pofftime|p2icp" },
+      "Read a control register", "ids|version|statb|bootv|ucfg1|secx|gcrc|scrc|pofftime|p2icp|all" },
     
     { "erase", 'e', POPT_ARG_STRING, &pacSubCommand, eERASE,
       "Erase a sector or page from the flash", "sector|page" },
     
     { "reset", 's', POPT_ARG_NONE, 0, eRESET, "Reset the micro-controller", NULL },
+
+    { "script", 'S', POPT_ARG_STRING, &pacScript, eSCRIPT,
+      "Run the commands in FILE in one session, - for stdin", "FILE" },
+
+    { "daemon", 0, POPT_ARG_STRING, &pacDaemon, eDAEMON,
+      "Keep the ports open and serve commands on a Unix socket", "SOCKET" },
+
+    { "gang", 0, POPT_ARG_STRING, &pacGang, eGANG,
+      "Program the file into the boards on all PORTS at once", "PORT,PORT,..." },
     
     { "address", 'a', POPT_ARG_INT, &zOperAddr, 0, "Sector address for Op", "SECTOR" },
     { "data", 'd', POPT_ARG_INT, &zSecBytex, 0, "Data byte to write to the micro", "DATA" },
 
     { "baud", 'b', POPT_ARG_INT, &zBaud, 0, "baud rate to communicate with", "BAUD" },
-    { "port", 'p', POPT_ARG_STRING, &pacComPort, 0, "Communications port to use", "PORT" },
+    { "port", 'p', POPT_ARG_STRING, &pacComPort, 0,
+      "Communications port to use, a comma separated list for --daemon", "PORT" },
     { "programmer", 'o', POPT_ARG_STRING, &pacProgrammer, 0, "Use programmer", "serial|bridge" },
+    { "guard", 't', POPT_ARG_INT, &zTxGuard, 0,
+      "Fixed delay after each transmit for slow hosts", "USEC" },
+    { "window", 'W', POPT_ARG_INT, &zProgWindow, 0,
+      "Program records sent ahead of their ACK (1-16)", "N" },
+    { "rxbuf", 0, POPT_ARG_INT, &zRxBuffer, 0,
+      "Characters the target buffers while it writes flash, bounds --window", "N" },
+    { "record", 'R', POPT_ARG_INT, &zRecSize, 0,
+      "Data bytes per program record, 0 picks the largest", "N" },
+    { "bench", 'k', POPT_ARG_NONE, &zBenchRecords, 0,
+      "Program once with each record size and report bytes/s", 0 },
+    { "diff", 'D', POPT_ARG_NONE, &zDiffProg, 0,
+      "Only erase and program the sectors whose CRC differs", 0 },
+    { "verify", 'V', POPT_ARG_NONE, &zVerify, 0,
+      "Check the sector CRCs against the image after programming", 0 },
+    { "page-us", 0, POPT_ARG_INT, &zPageEraseUs, 0,
+      "Erase planner estimate of a page erase", "USEC" },
+    { "sector-us", 0, POPT_ARG_INT, &zSectorEraseUs, 0,
+      "Erase planner estimate of a sector erase", "USEC" },
+    { "maxbaud", 'B', POPT_ARG_INT, &zMaxBaud, 0,
+      "Switch to the fastest rate up to BAUD after autobaud", "BAUD" },
+    { "osc", 'x', POPT_ARG_INT, &zOscFreq, 0,
+      "Crystal or external clock frequency for --maxbaud", "HZ" },
+
+    { "timing", 0, POPT_ARG_STRING, &pacTiming, 0,
+      "Report phase and command times and bytes/s at the end", "json|text" },
+    { "timing-file", 0, POPT_ARG_STRING, &pacTimingFile, 0,
+      "Write the timing report to FILE or fd:N instead of stderr", "FILE" },
+    { "slowest", 0, POPT_ARG_INT, &zSlowest, 0,
+      "List the N slowest program records in the timing report", "N" },
+    { "trace", 0, POPT_ARG_STRING, &pacTrace, 0,
+      "Capture every byte sent and received to FILE for lpc935-replay", "FILE" },
 
     { "verbose", 'v', POPT_ARG_NONE, &zShowDebug, 0, "Print out debug infomation", 0 },
 
@@ -227,45 +265,59 @@ struct poptOption optionsTable[] =
 
 
 /* Private local functions */
-static unsigned char lpc_GetReplyByte( char *pacTxd, char *pacRxd );
-static unsigned short lpc_GetReplyShort( char *pacTxd, char *pacRxd );
-static unsigned long lpc_GetReplyLong( char *pacTxd, char *pacRxd );
+static int lpc_RunCommand( tsLpcCtx *psCtx, tePROG_COMMAND eCommand,
+                           char *pacSubCommand, char *pacArg );
+static int lpc_RunScript( tsLpcCtx *psCtx, char *pacFilename );
+static int lpc_RunLine( tsLpcCtx *psCtx, char *pacLine, int zLineNo );
+static int lpc_StartSession( tsLpcCtx *psCtx, char *pacPort );
+static int lpc_Daemon( char *pacSocket, char *pacPorts );
+static int lpc_Gang( char *pacPorts, char *pacFilename );
+static tsImage *lpc_LoadImage( char *pacFilename );
+static void *lpc_PrepareImage( void *pvPrep );
+static void lpc_PrepareStart( tsPrepare *psPrep, char *pacFilename );
+static tsImage *lpc_PrepareWait( tsPrepare *psPrep );
+static int lpc_TimingReport( tsTiming *psTim );
 static void debug_printf( const char *format, ... );
-static int lpc_ReadIds( tsSerialPort *psSerPrt );
-static int lpc_ReadUcfg1( tsSerialPort *psSerPrt );
-static int lpc_ReadBootV( tsSerialPort *psSerPrt );
-static int lpc_ReadStatB( tsSerialPort *psSerPrt );
-static int lpc_ReadSecX( tsSerialPort *psSerPrt, unsigned char bSecX );
-static int lpc_ReadVersion( tsSerialPort *psSerPrt );
-static int lpc_ReadGlobalCrc( tsSerialPort *psSerPrt );
-static int lpc_ReadSectorCrc( tsSerialPort *psSerPrt, unsigned short wSectorAddr );
-static int lpc_EraseSector( tsSerialPort *psSerPrt, unsigned short wSectorAddr );
-static int lpc_ErasePage( tsSerialPort *psSerPrt, unsigned short wPageAddr );
-static int lpc_Reset( tsSerialPort *psSerPrt );
-static int lpc_WriteUcfg1( tsSerialPort *psSerPrt, unsigned char bNewCfg1 );
-static int lpc_WriteBootV( tsSerialPort *psSerPrt, unsigned char bNewBootV );
-static int lpc_WriteStatB( tsSerialPort *psSerPrt, unsigned char bNewStatB );
-static int lpc_WriteSecx( tsSerialPort *psSerPrt, unsigned char bSecxReg, unsigned char bSecxDat );
-static int lpc_ReadIcpState( tsSerialPort *psSerPrt, int do_print );
-static int lpc_ReadOffTime( tsSerialPort *psSerPrt );
-static int lpc_WriteIcpState( tsSerialPort *psSerPrt, unsigned char bState );
-static int lpc_WriteOffTime( tsSerialPort *psSerPrt, unsigned short wTime );
-static int lpc_PlaceInBootLoaderMode( tsSerialPort *psSerPrt );
-static int lpc_SyncBaud( tsSerialPort *psSerPrt );
-static int lpc_Program( tsSerialPort *psSerPrt, char *pacFilename );
-static void udelay( unsigned int uS );
-int lpc_RxdPacket( void *pvBuf, int zLen );
+static int lpc_ReadIds( tsLpcCtx *psCtx );
+static int lpc_ReadUcfg1( tsLpcCtx *psCtx );
+static int lpc_ReadBootV( tsLpcCtx *psCtx );
+static int lpc_ReadStatB( tsLpcCtx *psCtx );
+static int lpc_ReadSecX( tsLpcCtx *psCtx, unsigned char bSecX );
+static int lpc_ReadVersion( tsLpcCtx *psCtx );
+static int lpc_ReadAll( tsLpcCtx *psCtx );
+static int lpc_ReadGlobalCrc( tsLpcCtx *psCtx );
+static int lpc_ReadSectorCrc( tsLpcCtx *psCtx, unsigned short wSectorAddr );
+static int lpc_ErasePage( tsLpcCtx *psCtx, unsigned short wPageAddr );
+static int lpc_WriteUcfg1( tsLpcCtx *psCtx, unsigned char bNewCfg1 );
+static int lpc_WriteBootV( tsLpcCtx *psCtx, unsigned char bNewBootV );
+static int lpc_WriteStatB( tsLpcCtx *psCtx, unsigned char bNewStatB );
+static int lpc_WriteSecx( tsLpcCtx *psCtx, unsigned char bSecxReg, unsigned char bSecxDat );
+static int lpc_ReadIcpState( tsLpcCtx *psCtx, int do_print );
+static int lpc_ReadOffTime( tsLpcCtx *psCtx );
+static int lpc_WriteIcpState( tsLpcCtx *psCtx, unsigned char bState );
+static int lpc_WriteOffTime( tsLpcCtx *psCtx, unsigned short wTime );
+static int lpc_Program( tsLpcCtx *psCtx, char *pacFilename, int zErase );
+static int lpc_PlanErase( tsLpcCtx *psCtx, const tsImg *psImg, int zLast,
+                          unsigned long alDevCrc[], unsigned char abPlan[] );
+static int lpc_VerifyImage( tsLpcCtx *psCtx, tsImage *psImg );
+static int lpc_ProgramDiff( tsLpcCtx *psCtx, tsImage *psImg );
+static int lpc_BenchRecords( tsLpcCtx *psCtx, tsImage *psImg );
+static int lpc_EraseImage( tsLpcCtx *psCtx, tsImage *psImg );
 
 
 int main( const int argc, const char **argv)
 {
+    static tsTiming sTiming;
+    static tsTrace sTrace;
     poptContext optCon; /* context for parsing command-line options */
     char c; /* used for argument parsing */
-    tsSerialPort sSerPrt;
+    tsLpcCtx sCtx;
+    tsPrepare sPrep;
+    FILE *psFile;
     char *pacArg;
-    unsigned char bDat;
-    unsigned short wDat;
+    int zRtnv = 0;
     
+    lpc_Init( &sCtx );
     eProgCommand = ePROG;
     optCon = poptGetContext( NULL, argc, argv, optionsTable, 0 );
     poptSetOtherOptionHelp( optCon, "[OPTIONS]* <filename>" );
@@ -302,6 +354,21 @@ int main( const int argc, const char **argv)
               eProgCommand = ePROG;
               pacSubCommand = "program";
               break;
+
+          case( eSCRIPT ) :
+              eProgCommand = eSCRIPT;
+              pacSubCommand = "script";
+              break;
+
+          case( eDAEMON ) :
+              eProgCommand = eDAEMON;
+              pacSubCommand = "daemon";
+              break;
+
+          case( eGANG ) :
+              eProgCommand = eGANG;
+              pacSubCommand = "gang";
+              break;
         }
     }
 
@@ -310,449 +377,1315 @@ int main( const int argc, const char **argv)
         zBaud = 19200;
         zIsSerProg = 0;
     }
+
+    if( NULL != pacTiming )
+    {
+        if(( 0 != strcmp( "json", pacTiming )) && ( 0 != strcmp( "text", pacTiming )))
+        {
+            fprintf( stderr, "Unknown timing format %s, use json or text\n", pacTiming );
+            exit( 1 );
+        }
+        tim_Init( &sTiming );
+        sTiming.zSlowest = ( zSlowest > TIM_MAX_SLOW ) ? TIM_MAX_SLOW : zSlowest;
+        psTiming = &sTiming;
+    }
     
-    if((pacSubCommand != NULL ) && ( -1 != ser_Open( &sSerPrt, pacComPort, zBaud )))
+    if(( NULL != pacTrace ) && ( eGANG != eProgCommand ))
     {
-        /* Once the serial port is opened it must also power up the board and force entry into the
-           boodloader mode */
-        if( 0 != zIsSerProg )
+        if( 0 != trc_Open( &sTrace, pacTrace ))
         {
-            if( 0 == lpc_PlaceInBootLoaderMode( &sSerPrt ))
-            {
-                debug_printf( "Micro placed in boot loader mode successfully\n" );
-            }
-            else
+            fprintf( stderr, "Unable to create trace file %s\n", pacTrace );
+            exit( 1 );
+        }
+        psTrace = &sTrace;
+    }
+    
+    if(( eDAEMON == eProgCommand ) && ( NULL == pacComPort ))
+    {
+        fprintf( stderr, "--daemon needs --port\n" );
+        exit( 1 );
+    }
+
+    if( eDAEMON == eProgCommand )
+    {
+        zRtnv = lpc_Daemon( pacDaemon, pacComPort );
+        lpc_TimingReport( psTiming );
+        if( NULL != psTrace )
+        {
+            trc_Close( psTrace );
+        }
+        return(( 0 == zRtnv ) ? 0 : -1 );
+    }
+
+    if( eGANG == eProgCommand )
+    {
+        /* The boards of a gang each run in their own process and can not
+           share one trace file */
+        if( NULL != pacTrace )
+        {
+            fprintf( stderr, "--trace is ignored with --gang\n" );
+        }
+        return(( 0 == lpc_Gang( pacGang, (void *)poptGetArg( optCon ))) ? 0 : -1 );
+    }
+
+    if( pacSubCommand != NULL )
+    {
+        /* Parse the hex file and encode its records while the board is
+           power cycled into the boot loader, so programming can start as
+           soon as autobaud is done */
+        pacArg = (void *)poptGetArg( optCon );
+
+        /* A file that is not there is the user's mistake, say so before
+           the board is power cycled rather than after */
+        if( ePROG == eProgCommand )
+        {
+            psFile = ( NULL == pacArg ) ? NULL : fopen( pacArg, "rt" );
+            if( NULL == psFile )
             {
-                fprintf( stderr, "Failed to place micro in bootloader mode\n" );
+                fprintf( stderr, "File %s not found\n", ( NULL == pacArg ) ? "" : pacArg );
                 exit( -1 );
             }
+            fclose( psFile );
         }
-        else
+        lpc_PrepareStart( &sPrep, ( ePROG == eProgCommand ) ? pacArg : NULL );
+
+        if( 0 != lpc_StartSession( &sCtx, pacComPort ))
         {
-            if( 0 == lpc_ReadIcpState( &sSerPrt, 0 ))
-            {
-                /* error not in ICP state */
-                debug_printf( "Not in ICP mode\n" );
-            }
+            lpc_PrepareWait( &sPrep );
+            lpc_Close( &sCtx );
+            exit( -1 );
         }
         
         /* Then perform the required command */
-        switch( eProgCommand )
+        if(( NULL != sPrep.pacFilename ) && ( NULL == lpc_PrepareWait( &sPrep )))
         {
-          case( ePROG ) :
-              pacArg = (void *)poptGetArg( optCon );
-              if( 0 > lpc_Program( &sSerPrt, pacArg ))
-              {
-                  fprintf( stderr, "File %s not found\n", pacArg );
-                  return -1;
-              }
-              break;
-              
-          case( eWRITE ) :
-              pacArg = (void *)poptGetArg( optCon );
-              if( 0 == strcasecmp( pacCommandList[ RW_UCFG1 ], pacSubCommand ))
-              {
-                  bDat = strtol( pacArg, NULL, 0 );
-                  lpc_WriteUcfg1( &sSerPrt, bDat );
-              }
-              else if( 0 == strcasecmp( pacCommandList[ RW_BOOTV ], pacSubCommand ))
-              {
-                  bDat = strtol( pacArg, NULL, 0 );
-                  lpc_WriteBootV( &sSerPrt, bDat );
-              }
-              else if( 0 == strcasecmp( pacCommandList[ RW_STATB ], pacSubCommand ))
-              {
-                  bDat = strtol( pacArg, NULL, 0 );
-                  lpc_WriteStatB( &sSerPrt, bDat );
-              }
-              else if(( 0 == strcasecmp( pacCommandList[ RW_SECX ], pacSubCommand )) &&
-                      ( -1 != zSecBytex ))
-              {
-                  bDat = strtol( pacArg, NULL, 0 );
-                  lpc_WriteSecx( &sSerPrt, zSecBytex, bDat );
-              }
-              else if(( 0 == strcasecmp( pacCommandList[ PROG_OFF_TIME ], pacSubCommand )) &&
-                      ( 0 == zIsSerProg ))
-              {
-                  wDat = strtol( pacArg, NULL, 0 );
-                  lpc_WriteOffTime( &sSerPrt, wDat );
-              }
-              else if(( 0 == strcasecmp( pacCommandList[ PROG_ENT_ICP ], pacSubCommand )) &&
-                      ( 0 == zIsSerProg ))
-              {
-                  bDat = strtol( pacArg, NULL, 0 );
-                  lpc_WriteIcpState( &sSerPrt, bDat );
-              }
-              else
-              {
-                  printf( "Unknown write sub-command: %s\n", pacSubCommand );
-              }
-              break;
-
-          case( eREAD ) :
-              if( 0 == strcasecmp( pacCommandList[ READ_IDS ], pacSubCommand ))
-              {
-                  lpc_ReadIds( &sSerPrt );
-              }
-              else if( 0 == strcasecmp( pacCommandList[ READ_VER ], pacSubCommand ))
-              {
-                  lpc_ReadVersion( &sSerPrt );
-              }
-              else if( 0 == strcasecmp( pacCommandList[ RW_STATB ], pacSubCommand ))
-              {
-                  lpc_ReadStatB( &sSerPrt );
-              }
-              else if( 0 == strcasecmp( pacCommandList[ RW_BOOTV ], pacSubCommand ))
-              {
-                  lpc_ReadBootV( &sSerPrt );
-              }
-              else if( 0 == strcasecmp( pacCommandList[ RW_UCFG1 ], pacSubCommand ))
-              {
-                  lpc_ReadUcfg1( &sSerPrt );
-              }
-              else if(( 0 == strcasecmp( pacCommandList[ RW_SECX ], pacSubCommand )) &&
-                      ( -1 != zSecBytex ))
-              {
-                  lpc_ReadSecX( &sSerPrt, zSecBytex );
-              }
-              else if( 0 == strcasecmp( pacCommandList[ READ_GCRC ], pacSubCommand ))
-              {
-                  lpc_ReadGlobalCrc( &sSerPrt );
-              }
-              else if( 0 == strcasecmp( pacCommandList[ READ_SCRC ], pacSubCommand ))
-              {
-                  lpc_ReadSectorCrc( &sSerPrt, zOperAddr );
-              }
-              else if(( 0 == strcasecmp( pacCommandList[ PROG_OFF_TIME ], pacSubCommand )) &&
-                      ( 0 == zIsSerProg ))
-              {
-                  lpc_ReadOffTime( &sSerPrt );
-              }
-              else if(( 0 == strcasecmp( pacCommandList[ PROG_ENT_ICP ], pacSubCommand )) &&
-                      ( 0 == zIsSerProg ))
-              {
-                  lpc_ReadIcpState( &sSerPrt, 1 );
-              }
-              else
-              {
-                  printf( "Unknown read sub-command: %s\n", pacSubCommand );
-              }
-              break;
-
-          case( eERASE ) :
-              if( 0 == strcasecmp( pacCommandList[ ERASE_SECTOR ], pacSubCommand ))
-              {
-                  lpc_EraseSector( &sSerPrt, zOperAddr );
-              }
-              else if( 0 == strcasecmp( pacCommandList[ ERASE_PAGE ], pacSubCommand ))
-              {
-                  lpc_ErasePage( &sSerPrt, zOperAddr );
-              }
-              else
-              {
-                  printf( "Unknown erase sub-command: %s\n", pacSubCommand );
-              }
-              break;
-
-          case( eRESET ) :
-              if( 0 != zIsSerProg )
-              {
-                  lpc_Reset( &sSerPrt );
-              }
-              else
-              {
-                  lpc_WriteIcpState( &sSerPrt, 0 );
-              }
-              break;
-
-          default :
-              printf( "Command not implemented yet\n" );
-              break;
+            /* The file was there, the parser has said what is wrong with it */
+            fprintf( stderr, "Unable to load %s\n", pacArg );
+            zRtnv = -1;
+        }
+        else if( eSCRIPT == eProgCommand )
+        {
+            zRtnv = lpc_RunScript( &sCtx, pacScript );
+        }
+        else
+        {
+            zRtnv = lpc_RunCommand( &sCtx, eProgCommand, pacSubCommand, pacArg );
         }
     }
 
-    ser_Close( &sSerPrt );
+    lpc_Close( &sCtx );
+    lpc_TimingReport( psTiming );
+    if( NULL != psTrace )
+    {
+        trc_Close( psTrace );
+    }
     
-    return( 0 );
+    return(( 0 == zRtnv ) ? 0 : -1 );
 }
 
 
-static unsigned char lpc_GetReplyByte( char *pacTxd, char *pacRxd )
+/*
+  Set up a context from the command line options, open the port and get
+  the micro ready to take commands.
+  Returns 0 on success or -1 if the port could not be opened or the micro
+  would not enter the boot loader.
+ */
+static int lpc_StartSession( tsLpcCtx *psCtx, char *pacPort )
 {
-    unsigned char bRplyByte = 0;
-    char *pacRply;
-    
-    if(( 0 < strlen( pacRxd )) &&
-       ( '.' == *( pacRxd + strlen( pacRxd ) - 3 )) &&
-       ( 0 == strncasecmp( pacTxd, pacRxd, strlen( pacTxd ))))
+    lpc_Init( psCtx );
+    psCtx->zBaud = zBaud;
+    psCtx->zIsSerProg = zIsSerProg;
+    psCtx->zTxGuard = zTxGuard;
+    psCtx->zProgWindow = zProgWindow;
+    psCtx->zRxBuffer = zRxBuffer;
+    psCtx->zRecSize = zRecSize;
+    psCtx->zMaxBaud = zMaxBaud;
+    psCtx->lOscFreq = zOscFreq;
+    psCtx->zDebug = zShowDebug;
+    psCtx->psTiming = psTiming;
+    psCtx->psTrace = psTrace;
+
+    if(( NULL == pacPort ) || ( 0 != lpc_Open( psCtx, pacPort )))
     {
-        /* Received reply and the replay was OK */
-        pacRply = pacRxd + strlen( pacTxd ); 
-        bRplyByte = nibble( *( pacRply )) << 4;
-        bRplyByte |= nibble( *( pacRply + 1 ));
+        return( -1 );
     }
 
-    return( bRplyByte );
-}
-
-
-static unsigned short lpc_GetReplyShort( char *pacTxd, char *pacRxd )
-{
-    unsigned short lRplyShort = 0xbad0;
-    char *pacRply;
-    int i;
-
-    if(( 0 < strlen( pacRxd )) &&
-       ( '.' == *( pacRxd + strlen( pacRxd ) - 3 )) &&
-       ( 0 == strncasecmp( pacTxd, pacRxd, strlen( pacTxd ))))
+    /* Once the serial port is opened it must also power up the board and force entry into the
+       boodloader mode */
+    if( 0 != lpc_Sync( psCtx ))
     {
-        pacRply = pacRxd + strlen( pacTxd );
-        for( i = 0; i < 4; i++ )
-        {
-            lRplyShort <<= 4;
-            lRplyShort |= nibble( *( pacRply + i ));
-        }
+        fprintf( stderr, "Failed to place micro on %s in bootloader mode\n", pacPort );
+        return( -1 );
     }
 
-    return( lRplyShort );
+    return( 0 );
 }
 
 
-static unsigned long lpc_GetReplyLong( char *pacTxd, char *pacRxd )
+/*
+  Write the --timing report to --timing-file, or stderr so it does not mix
+  with the normal output.  The file may be fd:N to use a descriptor the
+  caller has already opened.
+  Returns 0 if the report was written or there was nothing to report.
+ */
+static int lpc_TimingReport( tsTiming *psTim )
 {
-    unsigned long lRplyLong = 0xbad0bad0;
-    char *pacRply;
-    int i;
+    FILE *psOut = stderr;
+
+    if( NULL == psTim )
+    {
+        return( 0 );
+    }
 
-    if(( 0 < strlen( pacRxd )) &&
-       ( '.' == *( pacRxd + strlen( pacRxd ) - 3 )) &&
-       ( 0 == strncasecmp( pacTxd, pacRxd, strlen( pacTxd ))))
+    if( NULL != pacTimingFile )
     {
-        pacRply = pacRxd + strlen( pacTxd );
-        for( i = 0; i < 8; i++ )
+        if( 0 == strncmp( "fd:", pacTimingFile, 3 ))
+        {
+            psOut = fdopen( atoi( &pacTimingFile[ 3 ]), "w" );
+        }
+        else
         {
-            lRplyLong <<= 4;
-            lRplyLong |= nibble( *( pacRply + i ));
+            psOut = fopen( pacTimingFile, "wt" );
         }
+        if( NULL == psOut )
+        {
+            fprintf( stderr, "Unable to open timing file %s\n", pacTimingFile );
+            return( -1 );
+        }
+    }
+
+    tim_Report( psTim, psOut, 0 == strcmp( "json", pacTiming ));
+    if( stderr != psOut )
+    {
+        fclose( psOut );
     }
 
-    return( lRplyLong );
+    return( 0 );
 }
 
 
-static void debug_printf( const char *pacFormat, ... )
+/*
+  Carry out one command on a micro that is already in boot loader mode.
+  This is shared by the command line and by script mode.
+  Parameters
+    psCtx - the open port to the micro
+    eCommand - the main command to perform
+    pacSubCommand - the sub command, register or erase type
+    pacArg - the data or file name for the command, may be NULL
+  Returns 0 if the command completed or -1 on error.
+ */
+static int lpc_RunCommand( tsLpcCtx *psCtx, tePROG_COMMAND eCommand,
+                           char *pacSubCommand, char *pacArg )
 {
-    char p[ 2048 ];
-    va_list ap;
+    unsigned char bDat;
+    unsigned short wDat;
+    int zRtnv = 0;
+    int zShowWas = zShowDebug;
+    int zDebugWas = psCtx->zDebug;
 
-    if( 0 != zShowDebug )
+    switch( eCommand )
     {
+      case( ePROG ) :
+          zRtnv = lpc_Program( psCtx, pacArg, 1 );
+          if( -1 == zRtnv )
+          {
+              fprintf( stderr, "Unable to load %s\n", pacArg );
+              zRtnv = -1;
+          }
+          else if( -3 == zRtnv )
+          {
+              fprintf( stderr, "Verify of %s failed\n", pacArg );
+              zRtnv = -1;
+          }
+          else if( 0 > zRtnv )
+          {
+              fprintf( stderr, "Programming %s failed\n", pacArg );
+              zRtnv = -1;
+          }
+          break;
+          
+      case( eWRITE ) :
+          if( NULL == pacArg )
+          {
+              printf( "No data given for write sub-command: %s\n", pacSubCommand );
+              zRtnv = -1;
+          }
+          else if( 0 == strcasecmp( pacCommandList[ RW_UCFG1 ], pacSubCommand ))
+          {
+              bDat = strtol( pacArg, NULL, 0 );
+              zRtnv = lpc_WriteUcfg1( psCtx, bDat );
+          }
+          else if( 0 == strcasecmp( pacCommandList[ RW_BOOTV ], pacSubCommand ))
+          {
+              bDat = strtol( pacArg, NULL, 0 );
+              zRtnv = lpc_WriteBootV( psCtx, bDat );
+          }
+          else if( 0 == strcasecmp( pacCommandList[ RW_STATB ], pacSubCommand ))
+          {
+              bDat = strtol( pacArg, NULL, 0 );
+              zRtnv = lpc_WriteStatB( psCtx, bDat );
+          }
+          else if(( 0 == strcasecmp( pacCommandList[ RW_SECX ], pacSubCommand )) &&
+                  ( -1 != zSecBytex ))
+          {
+              bDat = strtol( pacArg, NULL, 0 );
+              zRtnv = lpc_WriteSecx( psCtx, zSecBytex, bDat );
+          }
+          else if(( 0 == strcasecmp( pacCommandList[ PROG_OFF_TIME ], pacSubCommand )) &&
+                  ( 0 == zIsSerProg ))
+          {
+              wDat = strtol( pacArg, NULL, 0 );
+              zRtnv = lpc_WriteOffTime( psCtx, wDat );
+          }
+          else if(( 0 == strcasecmp( pacCommandList[ PROG_ENT_ICP ], pacSubCommand )) &&
+                  ( 0 == zIsSerProg ))
+          {
+              bDat = strtol( pacArg, NULL, 0 );
+              zRtnv = lpc_WriteIcpState( psCtx, bDat );
+          }
+          else
+          {
+              printf( "Unknown write sub-command: %s\n", pacSubCommand );
+              zRtnv = -1;
+          }
+          break;
+
+      case( eREAD ) :
+          if( 0 == strcasecmp( pacCommandList[ READ_IDS ], pacSubCommand ))
+          {
+              zRtnv = lpc_ReadIds( psCtx );
+          }
+          else if( 0 == strcasecmp( pacCommandList[ READ_VER ], pacSubCommand ))
+          {
+              zRtnv = lpc_ReadVersion( psCtx );
+          }
+          else if( 0 == strcasecmp( pacCommandList[ RW_STATB ], pacSubCommand ))
+          {
+              zRtnv = lpc_ReadStatB( psCtx );
+          }
+          else if( 0 == strcasecmp( pacCommandList[ RW_BOOTV ], pacSubCommand ))
+          {
+              zRtnv = lpc_ReadBootV( psCtx );
+          }
+          else if( 0 == strcasecmp( pacCommandList[ RW_UCFG1 ], pacSubCommand ))
+          {
+              zRtnv = lpc_ReadUcfg1( psCtx );
+          }
+          else if(( 0 == strcasecmp( pacCommandList[ RW_SECX ], pacSubCommand )) &&
+                  ( -1 != zSecBytex ))
+          {
+              zRtnv = lpc_ReadSecX( psCtx, zSecBytex );
+          }
+          else if( 0 == strcasecmp( pacCommandList[ READ_GCRC ], pacSubCommand ))
+          {
+              zRtnv = lpc_ReadGlobalCrc( psCtx );
+          }
+          else if( 0 == strcasecmp( pacCommandList[ READ_ALL ], pacSubCommand ))
+          {
+              zRtnv = lpc_ReadAll( psCtx );
+          }
+          else if( 0 == strcasecmp( pacCommandList[ READ_SCRC ], pacSubCommand ))
+          {
+              zRtnv = lpc_ReadSectorCrc( psCtx, zOperAddr );
+          }
+          else if(( 0 == strcasecmp( pacCommandList[ PROG_OFF_TIME ], pacSubCommand )) &&
+                  ( 0 == zIsSerProg ))
+          {
+              lpc_ReadOffTime( psCtx );
+          }
+          else if(( 0 == strcasecmp( pacCommandList[ PROG_ENT_ICP ], pacSubCommand )) &&
+                  ( 0 == zIsSerProg ))
+          {
+              lpc_ReadIcpState( psCtx, 1 );
+          }
+          else
+          {
+              printf( "Unknown read sub-command: %s\n", pacSubCommand );
+              zRtnv = -1;
+          }
+          break;
+
+      case( eERASE ) :
+          if( 0 == strcasecmp( pacCommandList[ ERASE_SECTOR ], pacSubCommand ))
+          {
+              zRtnv = lpc_Erase( psCtx, DO_SECTOR, zOperAddr );
+          }
+          else if( 0 == strcasecmp( pacCommandList[ ERASE_PAGE ], pacSubCommand ))
+          {
+              zRtnv = lpc_ErasePage( psCtx, zOperAddr );
+          }
+          else
+          {
+              printf( "Unknown erase sub-command: %s\n", pacSubCommand );
+              zRtnv = -1;
+          }
+          break;
+
+      case( eRESET ) :
+          if( 0 != zIsSerProg )
+          {
+              zRtnv = lpc_Reset( psCtx );
+          }
+          else
+          {
+              zRtnv = lpc_WriteIcpState( psCtx, 0 );
+          }
+          break;
+
+      default :
+          printf( "Command not implemented yet\n" );
+          zRtnv = -1;
+          break;
+    }
 
-        /* Try to print in the allocated space. */
-        va_start( ap, pacFormat );
-        vsnprintf( p, sizeof( p ), pacFormat, ap );
-        va_end( ap );
+    /* The erase and write helpers switch debug on for themselves, do not
+       let that leak into the commands a script or daemon runs after */
+    zShowDebug = zShowWas;
+    psCtx->zDebug = zDebugWas;
 
-        printf( "%s", p );
-        fflush( stdout );
-    }
+    return(( 0 <= zRtnv ) ? 0 : -1 );
 }
 
 
-static int lpc_ReadIds( tsSerialPort *psSerPrt )
+/*
+  Run a list of commands from a file, or stdin if the name is "-", over the
+  one open port and boot loader session.  Each line holds one command in
+  the same words as the command line options:
+      read ids|version|statb|bootv|ucfg1|gcrc|all|pofftime|p2icp
+      read secx N
+      read scrc ADDRESS
+      write ucfg1|bootv|statb|pofftime|p2icp DATA
+      write secx N DATA
+      erase sector|page ADDRESS
+      program FILE
+      reset
+  Blank lines and lines starting with # are skipped.  The time each
+  command took is reported and the script stops at the first error.
+  Returns 0 if every command completed or -1 on error.
+ */
+static int lpc_RunScript( tsLpcCtx *psCtx, char *pacFilename )
 {
-    char acIhexStr[ 20 ];
-    char acRply[ 100 ];
-    unsigned char bDat;
-    unsigned char bReplySize;
-        
-    debug_printf( "Read lpc935 system ids from port %s baud = %d\n", pacComPort, zBaud );
+    FILE *psIn;
+    char acLine[ 512 ];
+    int zLineNo = 0;
+    int zRtnv = 0;
 
-    /* Read manufacture id */
-    bDat = GET_MANID;
-    snintel_hex( acIhexStr, sizeof( acIhexStr ), MISC_READ_FN, &bDat, sizeof( bDat ), 0 );
-    debug_printf( "Sending %s\n", acIhexStr );
-    memset( acRply, 0, sizeof( acRply ));
-    ser_Write( psSerPrt, acIhexStr, strlen( acIhexStr ));
-    bReplySize = ser_Read( psSerPrt, acRply, sizeof( acRply ), 1000000, lpc_RxdPacket );
-    debug_printf( "Read %s\n", acRply );
-    if( 0 < bReplySize )
+    if( 0 == strcmp( "-", pacFilename ))
     {
-        bDat = lpc_GetReplyByte( acIhexStr, acRply );
-        printf( "Manufacture Id: 0x%02x\n", bDat );
+        psIn = stdin;
+    }
+    else if( NULL == ( psIn = fopen( pacFilename, "rt" )))
+    {
+        fprintf( stderr, "Script %s not found\n", pacFilename );
+        return( -1 );
     }
 
-    /* Read device id */
-    bDat = GET_DEVID;
-    snintel_hex( acIhexStr, sizeof( acIhexStr ), MISC_READ_FN, &bDat, sizeof( bDat ), 0 );
-    debug_printf( "Sending %s\n", acIhexStr );
-    memset( acRply, 0, sizeof( acRply ));
-    ser_Write( psSerPrt, acIhexStr, strlen( acIhexStr ));
-    bReplySize = ser_Read( psSerPrt, acRply, sizeof( acRply ), 1000000, lpc_RxdPacket );
-    debug_printf( "Read %s\n", acRply );
-    if( 0 < bReplySize )
+    while(( 0 <= zRtnv ) && ( NULL != fgets( acLine, sizeof( acLine ), psIn )))
     {
-        bDat = lpc_GetReplyByte( acIhexStr, acRply );
-        printf( "Device Id:..... 0x%02x\n", bDat );
+        zLineNo++;
+        zRtnv = lpc_RunLine( psCtx, acLine, zLineNo );
     }
 
-    /* read derivitive id */
-    bDat = GET_DERID;
-    snintel_hex( acIhexStr, sizeof( acIhexStr ), MISC_READ_FN, &bDat, sizeof( bDat ), 0 );
-    debug_printf( "Sending %s\n", acIhexStr );
-    memset( acRply, 0, sizeof( acRply ));
-    ser_Write( psSerPrt, acIhexStr, strlen( acIhexStr ));
-    bReplySize = ser_Read( psSerPrt, acRply, sizeof( acRply ), 1000000, lpc_RxdPacket );
-    debug_printf( "Read %s\n", acRply );
-    if( 0 < bReplySize )
+    if( 0 > zRtnv )
     {
-        bDat = lpc_GetReplyByte( acIhexStr, acRply );
-        printf( "Derivative Id:. 0x%02x\n", bDat );
+        fprintf( stderr, "Script stopped at line %d\n", zLineNo );
     }
 
-    return( 0 );
+    if( stdin != psIn )
+    {
+        fclose( psIn );
+    }
+
+    return(( 0 <= zRtnv ) ? 0 : -1 );
 }
 
 
-static int lpc_ReadUcfg1( tsSerialPort *psSerPrt )
+/*
+  Parse and run one script line, used by script mode and by the daemon.
+  The line is split into words in place and the time the command took is
+  reported after it.
+  Returns 0 if the command completed, 1 for a blank or comment line, -1 if
+  the command failed or -2 if the line was not understood.
+ */
+static int lpc_RunLine( tsLpcCtx *psCtx, char *pacLine, int zLineNo )
 {
-    char acIhexStr[ 20 ];
-    char acRply[ 100 ];
-    unsigned char bDat;
-    unsigned char bReplySize;
-        
-    debug_printf( "Read lpc935 system UCFG1 from port %s baud = %d\n", pacComPort, zBaud );
+    static const struct
+    {
+        char *pacName;
+        tePROG_COMMAND eCommand;
+    } asCmds[] =
+    {
+        { "read", eREAD }, { "write", eWRITE }, { "erase", eERASE },
+        { "program", ePROG }, { "reset", eRESET }
+    };
+    char *apacWord[ 4 ];
+    char *pacSub;
+    char *pacArg;
+    tePROG_COMMAND eCommand;
+    long long llStart;
+    long long llTime;
+    int zWords = 0;
+    int zRtnv;
+    int i;
 
-    /* Read manufacture id */
-    bDat = GET_UCFG1;
-    snintel_hex( acIhexStr, sizeof( acIhexStr ), MISC_READ_FN, &bDat, sizeof( bDat ), 0 );
-    debug_printf( "Sending %s\n", acIhexStr );
-    memset( acRply, 0, sizeof( acRply ));
-    ser_Write( psSerPrt, acIhexStr, strlen( acIhexStr ));
-    bReplySize = ser_Read( psSerPrt, acRply, sizeof( acRply ), 1000000, lpc_RxdPacket );
-    debug_printf( "Read %s\n", acRply );
-    if( 0 < bReplySize )
+    apacWord[ 0 ] = strtok( pacLine, " \t\r\n" );
+    while(( NULL != apacWord[ zWords ]) && ( zWords < 3 ))
     {
-        bDat = lpc_GetReplyByte( acIhexStr, acRply );
-        printf( "UCFG1 returned is 0x%02x\nDecoding...\n", bDat );
-        if(( bDat & eWDTE ) == eWDTE )
-        {
-            printf( "WDTE is enabled\n" );
-        }
-        else
-        {
-            printf( "WDTE is disabled\n" );
-        }
-        if(( bDat & eRPE ) == eRPE )
-        {
-            printf( "RPE  is enabled\n" );
-        }
-        else
-        {
-            printf( "RPE  is disabled\n" );
-        }
-        if(( bDat & eBOE ) == eBOE )
-        {
-            printf( "BOE  is enabled\n" );
-        }
-        else
-        {
-            printf( "BOE  is disabled\n" );
-        }
-        if(( bDat & eWDSE ) == eWDSE )
-        {
-            printf( "WDSE is enabled\n" );
-        }
-        else
+        zWords++;
+        apacWord[ zWords ] = strtok( NULL, " \t\r\n" );
+    }
+    if(( 0 == zWords ) || ( '#' == apacWord[ 0 ][ 0 ]))
+    {
+        return( 1 );
+    }
+    if( 3 == zWords )
+    {
+        zWords += ( NULL != apacWord[ 3 ]) ? 1 : 0;
+    }
+
+    for( i = 0; i < sizeof( asCmds ) / sizeof( asCmds[ 0 ]); i++ )
+    {
+        if( 0 == strcasecmp( asCmds[ i ].pacName, apacWord[ 0 ]))
         {
-            printf( "WDSE is disabled\n" );
+            break;
         }
+    }
+    if( i == sizeof( asCmds ) / sizeof( asCmds[ 0 ]))
+    {
+        fprintf( stderr, "Line %d: unknown command %s\n", zLineNo, apacWord[ 0 ]);
+        return( -2 );
+    }
+    eCommand = asCmds[ i ].eCommand;
+
+    /* Turn the words into the same sub command, globals and argument
+       the command line options would have set.  Nothing carries over from
+       an earlier line, a line without an address works on 0 */
+    zOperAddr = 0;
+    zSecBytex = -1;
+    pacSub = ( zWords > 1 ) ? apacWord[ 1 ] : NULL;
+    pacArg = ( zWords > 2 ) ? apacWord[ 2 ] : NULL;
+    switch( eCommand )
+    {
+      case( ePROG ) :
+          pacArg = pacSub;
+          pacSub = "program";
+          break;
+
+      case( eRESET ) :
+          pacSub = "reset";
+          break;
+
+      case( eERASE ) :
+      case( eREAD ) :
+          if( NULL != pacArg )
+          {
+              zOperAddr = strtol( pacArg, NULL, 0 );
+              zSecBytex = zOperAddr;
+          }
+          break;
+
+      case( eWRITE ) :
+          if(( NULL != pacSub ) && ( 0 == strcasecmp( pacCommandList[ RW_SECX ], pacSub )) &&
+             ( NULL != pacArg ))
+          {
+              zSecBytex = strtol( pacArg, NULL, 0 );
+              pacArg = ( zWords > 3 ) ? apacWord[ 3 ] : NULL;
+          }
+          break;
+
+      default :
+          break;
+    }
 
-        printf( "Oscillator configuration is:\n" );
-        switch( bDat & ( eFOSC2 | eFOSC1 | eFOSC0 ))
-        {
-          case( 7 ) :
-              printf( "    External input on XTAL1\n" );
-              break;
+    if(( NULL == pacSub ) || (( ePROG == eCommand ) && ( NULL == pacArg )))
+    {
+        fprintf( stderr, "Line %d: %s needs more arguments\n", zLineNo, apacWord[ 0 ]);
+        return( -2 );
+    }
 
-          case( 4 ) :
-              printf( "    Watchdog Oscillator, 400 kHz (+20/ -30%% tolerance).\n" );
-              break;
+    llStart = lpc_Usec();
+    zRtnv = lpc_RunCommand( psCtx, eCommand, pacSub, pacArg );
+    llTime = lpc_Usec() - llStart;
 
-          case( 3 ) :
-              printf( "    Internal RC oscillator, 7.373 MHz +-2.5%%.\n" );
-              break;
+    printf( "[%d]", zLineNo );
+    for( i = 0; i < zWords; i++ )
+    {
+        printf( " %s", apacWord[ i ]);
+    }
+    printf( ": %s in %lld.%03lld ms\n", ( 0 == zRtnv ) ? "ok" : "FAILED",
+            llTime / 1000, llTime % 1000 );
+    fflush( stdout );
 
-          case( 2 ) :
-              printf( "    Low frequency crystal, 20 kHz to 100 kHz.\n" );
-              break;
+    return( zRtnv );
+}
 
-          case( 1 ) :
-              printf( "    Medium frequency crystal or resonator, 100 kHz to 4 MHz.\n" );
-              break;
+#ifdef LINUX
+/* A port owned by the daemon */
+typedef struct
+{
+    char *pacPort; /**< Device name */
+    tsLpcCtx sCtx; /**< Context of the open port */
+    int zSynced; /**< Set while the micro is known to be in the boot loader */
+} tsDaemonPort;
 
-          case( 0 ) :
-              printf( "    High frequency crystal or resonator, 4 MHz to 12 MHz.\n" );
-              break;
+/* A connected client and the part of a request line it has sent so far */
+typedef struct
+{
+    int zFd; /**< Socket, -1 if the slot is free */
+    int zLen; /**< Bytes waiting in acBuf */
+    int zReqNo; /**< Requests served, used as the line number */
+    char acBuf[ DAEMON_LINE_SIZE ];
+} tsDaemonClient;
+
+
+/*
+  Remove the daemon socket left by an earlier run.  Only a socket is ever
+  removed, the path is whatever the user typed.
+  Returns 0 if there is nothing at the path now or -1 if something other
+  than a socket is there.
+ */
+static int lpc_DaemonUnlink( char *pacSocket )
+{
+    struct stat sSt;
 
-          default :
-              printf( "    Bad FOSC value we've got problems here...(hk stv)\n" );
-              break;
-        }
+    if( 0 != lstat( pacSocket, &sSt ))
+    {
+        return( 0 );
     }
+    if( !S_ISSOCK( sSt.st_mode ))
+    {
+        return( -1 );
+    }
+    unlink( pacSocket );
 
     return( 0 );
 }
 
 
-static int lpc_ReadBootV( tsSerialPort *psSerPrt )
+/*
+  Make sure the micro on a daemon port is in the boot loader.  The port is
+  reopened and the boot loader entered again after any error so one bad
+  command does not leave the port out of step with the micro.
+  Returns 0 if the micro is ready or -1 on error.
+ */
+static int lpc_DaemonSync( tsDaemonPort *psPort, int zForce )
 {
-    char acIhexStr[ 20 ];
-    char acRply[ 100 ];
-    unsigned char bDat;
-    unsigned char bReplySize;
+    if(( 0 != psPort->zSynced ) && ( 0 == zForce ))
+    {
+        return( 0 );
+    }
 
-    debug_printf( "Read lpc935 boot vector from port %s baud = %d\n", pacComPort, zBaud );
+    lpc_Close( &psPort->sCtx );
+    psPort->zSynced = 0;
 
-    /* Read manufacture id */
-    bDat = GET_BOOTV;
-    snintel_hex( acIhexStr, sizeof( acIhexStr ), MISC_READ_FN, &bDat, sizeof( bDat ), 0 );
-    debug_printf( "Sending %s\n", acIhexStr );
-    memset( acRply, 0, sizeof( acRply ));
-    ser_Write( psSerPrt, acIhexStr, strlen( acIhexStr ));
-    bReplySize = ser_Read( psSerPrt, acRply, sizeof( acRply ), 1000000, lpc_RxdPacket );
-    debug_printf( "Read %s\n", acRply );
-    if( 0 < bReplySize )
+    if( 0 == lpc_StartSession( &psPort->sCtx, psPort->pacPort ))
     {
-        bDat = lpc_GetReplyByte( acIhexStr, acRply );
-
-        printf( "The boot vector returned was: 0x%02x\n", bDat );
+        psPort->zSynced = 1;
     }
 
-    return( 0 );
+    return(( 0 != psPort->zSynced ) ? 0 : -1 );
 }
 
 
-static int lpc_ReadStatB( tsSerialPort *psSerPrt )
+/*
+  Serve one request line from a client.  The line is a script line
+  optionally prefixed with @N or @PORT to pick the port, default the
+  first, or one of the daemon commands:
+      ports    - list the ports and whether each micro is synced
+      sync     - enter the boot loader again
+      quit     - close this connection
+      shutdown - stop the daemon
+  Everything the command prints goes to the client and the reply ends with
+  a line "OK <usec>" or "ERR <usec>".
+  Returns 0 to keep the connection, 1 to close it or 2 to stop the daemon.
+ */
+static int lpc_DaemonRequest( tsDaemonPort asPorts[], int zPorts, tsDaemonClient *psClient,
+                              char *pacLine )
 {
-    char acIhexStr[ 20 ];
-    char acRply[ 100 ];
-    unsigned char bDat;
-    unsigned char bReplySize = 0;
+    tsDaemonPort *psPort = &asPorts[ 0 ];
+    char acStatus[ 64 ];
+    char *pacPort;
+    char *pacEnd;
+    long long llStart;
+    int zSavedOut;
+    int zSavedErr;
+    int zRtnv = -1;
+    int zKeep = 0;
+    int i;
 
-    debug_printf( "Read lpc935 status byte from port %s baud = %d\n", pacComPort, zBaud );
+    llStart = lpc_Usec();
+    psClient->zReqNo++;
 
-    /* Read manufacture id */
-    bDat = GET_STATB;
-    snintel_hex( acIhexStr, sizeof( acIhexStr ), MISC_READ_FN, &bDat, sizeof( bDat ), 0 );
-    debug_printf( "Sending %s\n", acIhexStr );
-    memset( acRply, 0, sizeof( acRply ));
-    ser_Write( psSerPrt, acIhexStr, strlen( acIhexStr ));
-    bReplySize = ser_Read( psSerPrt, acRply, sizeof( acRply ), 1000000, lpc_RxdPacket );
-    debug_printf( "Read %s - len=%d\n", acRply, bReplySize );
-    if( 0 < bReplySize )
+    /* Replies go to the client for the length of the request */
+    fflush( stdout );
+    fflush( stderr );
+    zSavedOut = dup( STDOUT_FILENO );
+    zSavedErr = dup( STDERR_FILENO );
+    dup2( psClient->zFd, STDOUT_FILENO );
+    dup2( psClient->zFd, STDERR_FILENO );
+
+    pacLine += strspn( pacLine, " \t" );
+    if( '@' == *pacLine )
+    {
+        pacPort = pacLine + 1;
+        pacLine = pacPort + strcspn( pacPort, " \t" );
+        if( '\0' != *pacLine )
+        {
+            *pacLine++ = '\0';
+        }
+        psPort = NULL;
+        i = strtol( pacPort, &pacEnd, 0 );
+        if(( '\0' == *pacEnd ) && ( pacEnd != pacPort ) && ( 0 <= i ) && ( i < zPorts ))
+        {
+            psPort = &asPorts[ i ];
+        }
+        for( i = 0; ( NULL == psPort ) && ( i < zPorts ); i++ )
+        {
+            if( 0 == strcmp( asPorts[ i ].pacPort, pacPort ))
+            {
+                psPort = &asPorts[ i ];
+            }
+        }
+        pacLine += strspn( pacLine, " \t" );
+    }
+    pacLine[ strcspn( pacLine, "\r\n" )] = '\0';
+
+    if( NULL == psPort )
+    {
+        printf( "Unknown port %s\n", pacPort );
+    }
+    else if( 0 == strcmp( "ports", pacLine ))
+    {
+        for( i = 0; i < zPorts; i++ )
+        {
+            printf( "%d %s %s\n", i, asPorts[ i ].pacPort,
+                    ( 0 != asPorts[ i ].zSynced ) ? "synced" : "not-synced" );
+        }
+        zRtnv = 0;
+    }
+    else if( 0 == strcmp( "sync", pacLine ))
+    {
+        zRtnv = lpc_DaemonSync( psPort, 1 );
+    }
+    else if( 0 == strcmp( "quit", pacLine ))
+    {
+        zRtnv = 0;
+        zKeep = 1;
+    }
+    else if( 0 == strcmp( "shutdown", pacLine ))
+    {
+        zRtnv = 0;
+        zKeep = 2;
+    }
+    else if( 0 == lpc_DaemonSync( psPort, 0 ))
+    {
+        pacComPort = psPort->pacPort;
+        zRtnv = lpc_RunLine( &psPort->sCtx, pacLine, psClient->zReqNo );
+        if( -1 == zRtnv )
+        {
+            /* Resync before the next command rather than guess the state */
+            psPort->zSynced = 0;
+        }
+    }
+
+    fflush( stdout );
+    fflush( stderr );
+    dup2( zSavedOut, STDOUT_FILENO );
+    dup2( zSavedErr, STDERR_FILENO );
+    close( zSavedOut );
+    close( zSavedErr );
+
+    i = snprintf( acStatus, sizeof( acStatus ), "%s %lld\n", ( 0 <= zRtnv ) ? "OK" : "ERR",
+                  lpc_Usec() - llStart );
+    if( i != write( psClient->zFd, acStatus, i ))
+    {
+        zKeep = 1;
+    }
+
+    return( zKeep );
+}
+
+
+/*
+  Keep one or more ports open with their micros in the boot loader and take
+  script lines from clients connected to a Unix socket, so each command
+  only costs its own ISP records.  Clients are served one line at a time in
+  the order the lines arrive.  The daemon is serial: while one line runs,
+  a long program or erase included, every other client and port waits, so
+  run one daemon per port where that matters.
+  Returns 0 when shut down by a client or -1 if the socket could not be
+  set up.
+ */
+static int lpc_Daemon( char *pacSocket, char *pacPorts )
+{
+    static tsDaemonPort asPorts[ MAX_DAEMON_PORTS ];
+    tsDaemonClient asClients[ MAX_DAEMON_CLIENTS ];
+    struct pollfd asPoll[ MAX_DAEMON_CLIENTS + 1 ];
+    struct sockaddr_un sAddr;
+    char *pacList;
+    char *pacNl;
+    int zListen;
+    int zPorts = 0;
+    int zRun = 1;
+    int zGot;
+    int zKeep;
+    int i;
+
+    pacList = strdup( pacPorts );
+    for( pacPorts = strtok( pacList, "," );
+         ( NULL != pacPorts ) && ( zPorts < MAX_DAEMON_PORTS );
+         pacPorts = strtok( NULL, "," ))
+    {
+        asPorts[ zPorts ].pacPort = pacPorts;
+        zPorts++;
+    }
+
+    memset( &sAddr, 0, sizeof( sAddr ));
+    sAddr.sun_family = AF_UNIX;
+    strncpy( sAddr.sun_path, pacSocket, sizeof( sAddr.sun_path ) - 1 );
+    if( 0 != lpc_DaemonUnlink( pacSocket ))
+    {
+        fprintf( stderr, "%s exists and is not a socket\n", pacSocket );
+        free( pacList );
+        return( -1 );
+    }
+
+    zListen = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if(( 0 > zListen ) ||
+       ( 0 != bind( zListen, ( struct sockaddr * )&sAddr, sizeof( sAddr ))) ||
+       ( 0 != listen( zListen, MAX_DAEMON_CLIENTS )))
+    {
+        fprintf( stderr, "Unable to listen on %s\n", pacSocket );
+        if( 0 <= zListen )
+        {
+            close( zListen );
+        }
+        free( pacList );
+        return( -1 );
+    }
+    signal( SIGPIPE, SIG_IGN );
+
+    /* Sync up front so the first request does not pay for it, a micro that
+       fails here is tried again when it is next used */
+    for( i = 0; i < zPorts; i++ )
+    {
+        lpc_DaemonSync( &asPorts[ i ], 1 );
+        printf( "%s %s\n", asPorts[ i ].pacPort,
+                ( 0 != asPorts[ i ].zSynced ) ? "ready" : "not in boot loader" );
+    }
+    printf( "Listening on %s\n", pacSocket );
+    fflush( stdout );
+
+    for( i = 0; i < MAX_DAEMON_CLIENTS; i++ )
+    {
+        asClients[ i ].zFd = -1;
+    }
+
+    while( 0 != zRun )
+    {
+        asPoll[ 0 ].fd = zListen;
+        asPoll[ 0 ].events = POLLIN;
+        for( i = 0; i < MAX_DAEMON_CLIENTS; i++ )
+        {
+            asPoll[ i + 1 ].fd = asClients[ i ].zFd;
+            asPoll[ i + 1 ].events = POLLIN;
+        }
+
+        if( 0 >= poll( asPoll, MAX_DAEMON_CLIENTS + 1, -1 ))
+        {
+            continue;
+        }
+
+        if( 0 != ( asPoll[ 0 ].revents & POLLIN ))
+        {
+            for( i = 0; ( i < MAX_DAEMON_CLIENTS ) && ( -1 != asClients[ i ].zFd ); i++ )
+            {
+            }
+            zGot = accept( zListen, NULL, NULL );
+            if(( 0 <= zGot ) && ( i < MAX_DAEMON_CLIENTS ))
+            {
+                asClients[ i ].zFd = zGot;
+                asClients[ i ].zLen = 0;
+                asClients[ i ].zReqNo = 0;
+            }
+            else if( 0 <= zGot )
+            {
+                close( zGot );
+            }
+        }
+
+        for( i = 0; ( 0 != zRun ) && ( i < MAX_DAEMON_CLIENTS ); i++ )
+        {
+            if(( -1 == asClients[ i ].zFd ) || ( 0 == asPoll[ i + 1 ].revents ))
+            {
+                continue;
+            }
+
+            zGot = read( asClients[ i ].zFd, asClients[ i ].acBuf + asClients[ i ].zLen,
+                         DAEMON_LINE_SIZE - 1 - asClients[ i ].zLen );
+            zKeep = ( 0 >= zGot ) ? 1 : 0;
+            if( 0 < zGot )
+            {
+                asClients[ i ].zLen += zGot;
+                asClients[ i ].acBuf[ asClients[ i ].zLen ] = '\0';
+            }
+
+            /* Serve every complete line */
+            while(( 0 == zKeep ) &&
+                  ( NULL != ( pacNl = strchr( asClients[ i ].acBuf, '\n' ))))
+            {
+                *pacNl = '\0';
+                zKeep = lpc_DaemonRequest( asPorts, zPorts, &asClients[ i ],
+                                           asClients[ i ].acBuf );
+                asClients[ i ].zLen -= pacNl + 1 - asClients[ i ].acBuf;
+                memmove( asClients[ i ].acBuf, pacNl + 1, asClients[ i ].zLen + 1 );
+            }
+
+            /* A line too long for the buffer can not be served */
+            if( DAEMON_LINE_SIZE - 1 == asClients[ i ].zLen )
+            {
+                zKeep = 1;
+            }
+
+            if( 0 != zKeep )
+            {
+                close( asClients[ i ].zFd );
+                asClients[ i ].zFd = -1;
+            }
+            if( 2 == zKeep )
+            {
+                zRun = 0;
+            }
+        }
+    }
+
+    for( i = 0; i < MAX_DAEMON_CLIENTS; i++ )
+    {
+        if( -1 != asClients[ i ].zFd )
+        {
+            close( asClients[ i ].zFd );
+        }
+    }
+    for( i = 0; i < zPorts; i++ )
+    {
+        lpc_Close( &asPorts[ i ].sCtx );
+    }
+    close( zListen );
+    lpc_DaemonUnlink( pacSocket );
+    free( pacList );
+
+    return( 0 );
+}
+#else
+static int lpc_Daemon( char *pacSocket, char *pacPorts )
+{
+    fprintf( stderr, "--daemon needs Unix domain sockets and is not available here\n" );
+
+    return( -1 );
+}
+#endif
+
+
+#ifdef LINUX
+/* Outcome of programming one board in gang mode, shared with the children */
+typedef struct
+{
+    char *pacPort; /**< Device name */
+    int zStage; /**< Last GANG_xxx stage reached */
+    int zRtnv; /**< 0 on pass or the lpc_Program error */
+    long long llEntryUs; /**< Time to open the port and enter the boot loader */
+    long long llProgUs; /**< Time to erase, program and verify */
+    int zSignal; /**< Signal that killed the child, 0 if it exited */
+    char acError[ 80 ]; /**< Last error the child printed, without -v */
+} tsGangResult;
+
+
+/*
+  Keep the last line that is not blank of what a quiet gang child wrote
+  to stderr, so the table can say why the board failed.
+ */
+static void lpc_GangLastError( tsGangResult *psRes, FILE *psErr )
+{
+    char acLine[ 256 ];
+    char *pacEol;
+
+    fflush( stderr );
+    rewind( psErr );
+    while( NULL != fgets( acLine, sizeof( acLine ), psErr ))
+    {
+        pacEol = strchr( acLine, '\n' );
+        if( NULL != pacEol )
+        {
+            *pacEol = '\0';
+        }
+        if( '\0' != acLine[ 0 ])
+        {
+            strncpy( psRes->acError, acLine, sizeof( psRes->acError ) - 1 );
+            psRes->acError[ sizeof( psRes->acError ) - 1 ] = '\0';
+        }
+    }
+}
+
+
+/*
+  Erase, program and verify one board of the gang.  This runs in its own
+  process so the globals belong to this board alone.  With -D the erase
+  is left to the planner in lpc_Program, otherwise every sector the image
+  uses is erased first.
+ */
+static void lpc_GangChild( tsGangResult *psRes, char *pacFilename )
+{
+    tsLpcCtx sCtx;
+    tsImage *psImg;
+    FILE *psErr = NULL;
+    long long llStart;
+    int zSynced;
+    int zNull;
+
+    /* Keep the children quiet unless asked, the table says how it went.
+       Errors go to a scratch file so the last one can go in the table */
+    if( 0 == zShowDebug )
+    {
+        zNull = open( "/dev/null", O_WRONLY );
+        dup2( zNull, STDOUT_FILENO );
+        dup2( zNull, STDERR_FILENO );
+        close( zNull );
+        psErr = tmpfile();
+        if( NULL != psErr )
+        {
+            dup2( fileno( psErr ), STDERR_FILENO );
+        }
+    }
+
+    pacComPort = psRes->pacPort;
+    llStart = lpc_Usec();
+    psRes->zStage = GANG_OPEN;
+    zSynced = lpc_StartSession( &sCtx, psRes->pacPort );
+    if( 0 != sCtx.zOpen )
+    {
+        psRes->zStage = GANG_ENTRY;
+    }
+
+    if( 0 == zSynced )
+    {
+        psRes->llEntryUs = lpc_Usec() - llStart;
+        psRes->zStage = GANG_ERASE;
+        llStart = lpc_Usec();
+        psImg = lpc_LoadImage( pacFilename );
+        if(( NULL != psImg ) && (( 0 != zDiffProg ) || ( 0 == lpc_EraseImage( &sCtx, psImg ))))
+        {
+            psRes->zStage = GANG_PROGRAM;
+            psRes->zRtnv = lpc_Program( &sCtx, pacFilename, 0 );
+            psRes->llProgUs = lpc_Usec() - llStart;
+            if( 0 <= psRes->zRtnv )
+            {
+                psRes->zRtnv = 0;
+                psRes->zStage = GANG_DONE;
+            }
+            else if( -3 == psRes->zRtnv )
+            {
+                psRes->zStage = GANG_VERIFY;
+            }
+        }
+    }
+
+    lpc_Close( &sCtx );
+    if( NULL != psErr )
+    {
+        if( GANG_DONE != psRes->zStage )
+        {
+            lpc_GangLastError( psRes, psErr );
+        }
+        fclose( psErr );
+    }
+}
+
+
+/*
+  Program the same hex file into a board on each of a comma separated list
+  of ports at the same time.  The file is parsed once before the boards
+  are started and each board is run by its own process, which shares the
+  parsed image with the parent until it exits.  A table of the result and
+  time for each board is printed at the end.
+  Returns 0 if every board passed or -1 otherwise.
+ */
+static int lpc_Gang( char *pacPorts, char *pacFilename )
+{
+    static const char *apacStage[] =
+    {
+        [ GANG_OPEN    ] = "open",
+        [ GANG_ENTRY   ] = "boot loader",
+        [ GANG_ERASE   ] = "erase",
+        [ GANG_PROGRAM ] = "program",
+        [ GANG_VERIFY  ] = "verify",
+        [ GANG_DONE    ] = "pass"
+    };
+    tsGangResult *psRes;
+    pid_t azPid[ MAX_GANG_PORTS ];
+    const char *pacResult;
+    char *pacList;
+    long long llStart;
+    long long llWall;
+    int zPorts = 0;
+    int zFailed = 0;
+    int zStatus;
+    int i;
+
+    if(( NULL == pacFilename ) || ( NULL == lpc_LoadImage( pacFilename )))
+    {
+        fprintf( stderr, "Unable to load hex file %s\n",
+                 ( NULL == pacFilename ) ? "" : pacFilename );
+        return( -1 );
+    }
+
+    psRes = mmap( NULL, sizeof( tsGangResult ) * MAX_GANG_PORTS, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    if( MAP_FAILED == psRes )
+    {
+        return( -1 );
+    }
+    memset( psRes, 0, sizeof( tsGangResult ) * MAX_GANG_PORTS );
+
+    pacList = strdup( pacPorts );
+    for( pacPorts = strtok( pacList, "," );
+         ( NULL != pacPorts ) && ( zPorts < MAX_GANG_PORTS );
+         pacPorts = strtok( NULL, "," ))
+    {
+        psRes[ zPorts ].pacPort = pacPorts;
+        psRes[ zPorts ].zRtnv = -1;
+        zPorts++;
+    }
+
+    fflush( stdout );
+    llStart = lpc_Usec();
+    for( i = 0; i < zPorts; i++ )
+    {
+        azPid[ i ] = fork();
+        if( 0 == azPid[ i ])
+        {
+            lpc_GangChild( &psRes[ i ], pacFilename );
+            /* _exit skips the stdio flush and -v output may be in a pipe */
+            fflush( NULL );
+            _exit( 0 );
+        }
+    }
+
+    for( i = 0; i < zPorts; i++ )
+    {
+        if(( 0 < azPid[ i ]) && ( azPid[ i ] == waitpid( azPid[ i ], &zStatus, 0 )) &&
+           ( 0 != WIFSIGNALED( zStatus )))
+        {
+            psRes[ i ].zSignal = WTERMSIG( zStatus );
+        }
+    }
+    llWall = lpc_Usec() - llStart;
+
+    printf( "%-20s %-12s %10s %10s  %s\n", "Port", "Result", "Entry ms", "Program ms", "Error" );
+    for( i = 0; i < zPorts; i++ )
+    {
+        /* A child killed part way through crashed, it did not fail that stage */
+        pacResult = apacStage[ psRes[ i ].zStage ];
+        if( 0 != psRes[ i ].zSignal )
+        {
+            pacResult = "crash";
+            snprintf( psRes[ i ].acError, sizeof( psRes[ i ].acError ),
+                      "killed by signal %d during %s", psRes[ i ].zSignal,
+                      apacStage[ psRes[ i ].zStage ]);
+        }
+        printf( "%-20s %-12s %10lld %10lld  %s\n", psRes[ i ].pacPort, pacResult,
+                psRes[ i ].llEntryUs / 1000, psRes[ i ].llProgUs / 1000, psRes[ i ].acError );
+        zFailed += (( GANG_DONE == psRes[ i ].zStage ) && ( 0 == psRes[ i ].zSignal )) ? 0 : 1;
+    }
+    printf( "%d of %d boards passed in %lld ms\n", zPorts - zFailed, zPorts, llWall / 1000 );
+
+    munmap( psRes, sizeof( tsGangResult ) * MAX_GANG_PORTS );
+    free( pacList );
+
+    return(( 0 == zFailed ) ? 0 : -1 );
+}
+#else
+static int lpc_Gang( char *pacPorts, char *pacFilename )
+{
+    fprintf( stderr, "--gang needs fork() and is not available here\n" );
+
+    return( -1 );
+}
+#endif
+
+
+
+static void debug_printf( const char *pacFormat, ... )
+{
+    char p[ 2048 ];
+    va_list ap;
+
+    if( 0 != zShowDebug )
+    {
+
+        /* Try to print in the allocated space. */
+        va_start( ap, pacFormat );
+        vsnprintf( p, sizeof( p ), pacFormat, ap );
+        va_end( ap );
+
+        printf( "%s", p );
+        fflush( stdout );
+    }
+}
+
+
+static int lpc_ReadIds( tsLpcCtx *psCtx )
+{
+    unsigned char bDat;
+    int zRtnv = 0;
+        
+    debug_printf( "Read lpc935 system ids from port %s baud = %d\n",
+                  psCtx->acPort, psCtx->zBaud );
+
+    /* Read manufacture id */
+    if( 0 == lpc_GetReg( psCtx, GET_MANID, &bDat ))
+    {
+        printf( "Manufacture Id: 0x%02x\n", bDat );
+    }
+    else
+    {
+        zRtnv = -1;
+    }
+
+    /* Read device id */
+    if( 0 == lpc_GetReg( psCtx, GET_DEVID, &bDat ))
+    {
+        printf( "Device Id:..... 0x%02x\n", bDat );
+    }
+    else
+    {
+        zRtnv = -1;
+    }
+
+    /* read derivitive id */
+    if( 0 == lpc_GetReg( psCtx, GET_DERID, &bDat ))
+    {
+        printf( "Derivative Id:. 0x%02x\n", bDat );
+    }
+    else
+    {
+        zRtnv = -1;
+    }
+
+    return( zRtnv );
+}
+
+
+static int lpc_ReadUcfg1( tsLpcCtx *psCtx )
+{
+    unsigned char bDat;
+    int zRtnv;
+        
+    debug_printf( "Read lpc935 system UCFG1 from port %s baud = %d\n",
+                  psCtx->acPort, psCtx->zBaud );
+
+    zRtnv = lpc_GetReg( psCtx, GET_UCFG1, &bDat );
+    if( 0 == zRtnv )
+    {
+        printf( "UCFG1 returned is 0x%02x\nDecoding...\n", bDat );
+        if(( bDat & eWDTE ) == eWDTE )
+        {
+            printf( "WDTE is enabled\n" );
+        }
+        else
+        {
+            printf( "WDTE is disabled\n" );
+        }
+        if(( bDat & eRPE ) == eRPE )
+        {
+            printf( "RPE  is enabled\n" );
+        }
+        else
+        {
+            printf( "RPE  is disabled\n" );
+        }
+        if(( bDat & eBOE ) == eBOE )
+        {
+            printf( "BOE  is enabled\n" );
+        }
+        else
+        {
+            printf( "BOE  is disabled\n" );
+        }
+        if(( bDat & eWDSE ) == eWDSE )
+        {
+            printf( "WDSE is enabled\n" );
+        }
+        else
+        {
+            printf( "WDSE is disabled\n" );
+        }
+
+        printf( "Oscillator configuration is:\n" );
+        switch( bDat & ( eFOSC2 | eFOSC1 | eFOSC0 ))
+        {
+          case( 7 ) :
+              printf( "    External input on XTAL1\n" );
+              break;
+
+          case( 4 ) :
+              printf( "    Watchdog Oscillator, 400 kHz (+20/ -30%% tolerance).\n" );
+              break;
+
+          case( 3 ) :
+              printf( "    Internal RC oscillator, 7.373 MHz +-2.5%%.\n" );
+              break;
+
+          case( 2 ) :
+              printf( "    Low frequency crystal, 20 kHz to 100 kHz.\n" );
+              break;
+
+          case( 1 ) :
+              printf( "    Medium frequency crystal or resonator, 100 kHz to 4 MHz.\n" );
+              break;
+
+          case( 0 ) :
+              printf( "    High frequency crystal or resonator, 4 MHz to 12 MHz.\n" );
+              break;
+
+          default :
+              printf( "    Bad FOSC value we've got problems here...(hk stv)\n" );
+              break;
+        }
+    }
+
+    return( zRtnv );
+}
+
+
+static int lpc_ReadBootV( tsLpcCtx *psCtx )
+{
+    unsigned char bDat;
+    int zRtnv;
+
+    debug_printf( "Read lpc935 boot vector from port %s baud = %d\n",
+                  psCtx->acPort, psCtx->zBaud );
+
+    zRtnv = lpc_GetReg( psCtx, GET_BOOTV, &bDat );
+    if( 0 == zRtnv )
+    {
+        printf( "The boot vector returned was: 0x%02x\n", bDat );
+    }
+
+    return( zRtnv );
+}
+
+
+static int lpc_ReadStatB( tsLpcCtx *psCtx )
+{
+    unsigned char bDat;
+    int zRtnv;
+
+    debug_printf( "Read lpc935 status byte from port %s baud = %d\n",
+                  psCtx->acPort, psCtx->zBaud );
+
+    zRtnv = lpc_GetReg( psCtx, GET_STATB, &bDat );
+    if( 0 == zRtnv )
     {
-        bDat = lpc_GetReplyByte( acIhexStr, acRply );
         printf( "Status byte is 0x%02x\nDecoding...\n", bDat );
         if(( bDat & eDCCP ) == eDCCP )
         {
@@ -788,35 +1721,27 @@ static int lpc_ReadStatB( tsSerialPort *psSerPrt )
         }
     }
 
-    return( 0 );
+    return( zRtnv );
 }
 
 
 
-static int lpc_ReadSecX( tsSerialPort *psSerPrt, unsigned char bSecX )
+static int lpc_ReadSecX( tsLpcCtx *psCtx, unsigned char bSecX )
 {
     unsigned char abSecByteAddr[] = { GET_SECB0, GET_SECB1, GET_SECB2, GET_SECB3,
                                       GET_SECB4, GET_SECB5, GET_SECB6, GET_SECB7 };
-    char acIhexStr[ 20 ];
-    char acRply[ 100 ];
     unsigned char bDat;
-    unsigned char bReplySize;
+    int zRtnv = -1;
 
-    debug_printf( "Read lpc935 security byte from port %s baud = %d\n", pacComPort, zBaud );
+    debug_printf( "Read lpc935 security byte from port %s baud = %d\n",
+                  psCtx->acPort, psCtx->zBaud );
 
     if( bSecX < sizeof( abSecByteAddr ))
     {
         /* Read security byte X */
-        bDat = abSecByteAddr[ bSecX ];
-        snintel_hex( acIhexStr, sizeof( acIhexStr ), MISC_READ_FN, &bDat, sizeof( bDat ), 0 );
-        debug_printf( "Sending %s\n", acIhexStr );
-        memset( acRply, 0, sizeof( acRply ));
-        ser_Write( psSerPrt, acIhexStr, strlen( acIhexStr ));
-        bReplySize = ser_Read( psSerPrt, acRply, sizeof( acRply ), 1000000, lpc_RxdPacket );
-        debug_printf( "Read %s\n", acRply );
-        if( 0 < bReplySize )
-        {
-            bDat = lpc_GetReplyByte( acIhexStr, acRply );
+        zRtnv = lpc_GetReg( psCtx, abSecByteAddr[ bSecX ], &bDat );
+        if( 0 == zRtnv )
+        {
             printf( "SEC%d readback 0x%02x\nDecoding...\n", bSecX, bDat );
             if(( bDat & eEDISx ) == eEDISx )
             {
@@ -845,289 +1770,218 @@ static int lpc_ReadSecX( tsSerialPort *psSerPrt, unsigned char bSecX )
         }
     }
     
-    return( 0 );
+    return( zRtnv );
 }
 
 
-static int lpc_ReadVersion( tsSerialPort *psSerPrt )
+static int lpc_ReadVersion( tsLpcCtx *psCtx )
 {
-    char acIhexStr[ 20 ];
-    char acRply[ 100 ];
-    unsigned char bReplySize;
+    char acVer[ 80 ];
+    int zRtnv;
 
-    debug_printf( "Read lpc935 version number from port %s baud = %d\n", pacComPort, zBaud );
+    debug_printf( "Read lpc935 version number from port %s baud = %d\n",
+                  psCtx->acPort, psCtx->zBaud );
 
-    /* Read security byte X */
-    snintel_hex( acIhexStr, sizeof( acIhexStr ), READ_VERSION_ID, 0, 0, 0 );
-    debug_printf( "Sending %s\n", acIhexStr );
-    memset( acRply, 0, sizeof( acRply ));
-    ser_Write( psSerPrt, acIhexStr, strlen( acIhexStr ));
-    bReplySize = ser_Read( psSerPrt, acRply, sizeof( acRply ), 1000000, lpc_RxdPacket );
-    debug_printf( "Read %s - size = %d\n", acRply, bReplySize );
-    if( 0 < bReplySize )
+    zRtnv = lpc_GetVersion( psCtx, acVer, sizeof( acVer ));
+    if( 0 == zRtnv )
     {
-        printf( "Version String returned was %s", &acRply[ strlen( acIhexStr )]);
+        printf( "Version String returned was %s\n", acVer );
     }
     
-    return( 0 );
+    return( zRtnv );
 }
 
-static int lpc_ReadGlobalCrc( tsSerialPort *psSerPrt )
+/*
+  Dump every configuration register in one boot loader session.  The reads
+  go out back to back and the result is printed one name=value per line so
+  it can be parsed by a test script.
+  Returns 0 if every read was acknowledged.
+ */
+static int lpc_ReadAll( tsLpcCtx *psCtx )
 {
-    char acIhexStr[ 20 ];
-    char acRply[ 100 ];
-    unsigned char bReplySize;
+    static const struct
+    {
+        char *pacName;
+        unsigned char bReg;
+    } asRegs[] =
+    {
+        { "manid", GET_MANID }, { "devid", GET_DEVID }, { "derid", GET_DERID },
+        { "ucfg1", GET_UCFG1 }, { "bootv", GET_BOOTV }, { "statb", GET_STATB },
+        { "sec0", GET_SECB0 }, { "sec1", GET_SECB1 }, { "sec2", GET_SECB2 },
+        { "sec3", GET_SECB3 }, { "sec4", GET_SECB4 }, { "sec5", GET_SECB5 },
+        { "sec6", GET_SECB6 }, { "sec7", GET_SECB7 }
+    };
+    unsigned char abVal[ sizeof( asRegs ) / sizeof( asRegs[ 0 ]) ];
+    signed char abOk[ sizeof( asRegs ) / sizeof( asRegs[ 0 ]) ];
+    unsigned long lCrc;
+    int zGcrcOk;
+    int zRtnv = 0;
+    int i;
+
+    debug_printf( "Read all lpc935 registers from port %s baud = %d\n",
+                  psCtx->acPort, psCtx->zBaud );
+
+    /* Do all the I/O first so the reads really are back to back */
+    for( i = 0; i < sizeof( asRegs ) / sizeof( asRegs[ 0 ]); i++ )
+    {
+        abOk[ i ] = lpc_GetReg( psCtx, asRegs[ i ].bReg, &abVal[ i ]);
+    }
+    zGcrcOk = lpc_GetGlobalCrc( psCtx, &lCrc );
 
-    debug_printf( "Read lpc935 global CRC from port %s baud = %d\n", pacComPort, zBaud );
+    for( i = 0; i < sizeof( asRegs ) / sizeof( asRegs[ 0 ]); i++ )
+    {
+        if( 0 == abOk[ i ])
+        {
+            printf( "%s=0x%02x\n", asRegs[ i ].pacName, abVal[ i ]);
+        }
+        else
+        {
+            printf( "%s=error\n", asRegs[ i ].pacName );
+            zRtnv = -1;
+        }
+    }
 
-    /* Read security byte X */
-    snintel_hex( acIhexStr, sizeof( acIhexStr ), READ_GLOBAL_CRC, 0, 0, 0 );
-    debug_printf( "Sending %s\n", acIhexStr );
-    memset( acRply, 0, sizeof( acRply ));
-    ser_Write( psSerPrt, acIhexStr, strlen( acIhexStr ));
-    bReplySize = ser_Read( psSerPrt, acRply, sizeof( acRply ), 1000000, lpc_RxdPacket );
-    debug_printf( "Read %s - size = %d\n", acRply, bReplySize );
-    if( 0 < bReplySize )
+    if( 0 == zGcrcOk )
     {
-        printf( "Global chip CRC is: 0x%08x\n", (unsigned int)lpc_GetReplyLong( acIhexStr, acRply ));
+        printf( "gcrc=0x%08lx\n", lCrc );
+    }
+    else
+    {
+        printf( "gcrc=error\n" );
+        zRtnv = -1;
+    }
+
+    return( zRtnv );
+}
+
+
+static int lpc_ReadGlobalCrc( tsLpcCtx *psCtx )
+{
+    unsigned long lCrc;
+    int zRtnv;
+
+    debug_printf( "Read lpc935 global CRC from port %s baud = %d\n",
+                  psCtx->acPort, psCtx->zBaud );
+
+    zRtnv = lpc_GetGlobalCrc( psCtx, &lCrc );
+    if( 0 == zRtnv )
+    {
+        printf( "Global chip CRC is: 0x%08x\n", (unsigned int)lCrc );
     }
     
-    return( 0 );
+    return( zRtnv );
 }
 
 
-static int lpc_ReadSectorCrc( tsSerialPort *psSerPrt, unsigned short wSectorAddr )
+static int lpc_ReadSectorCrc( tsLpcCtx *psCtx, unsigned short wSectorAddr )
 {
-    char acIhexStr[ 20 ];
-    char acRply[ 100 ];
-    unsigned char bDat;
-    unsigned char bReplySize;
+    unsigned long lCrc;
+    int zRtnv;
 
-    debug_printf( "Read lpc935 sector CRC from port %s baud = %d\n", pacComPort, zBaud );
+    debug_printf( "Read lpc935 sector CRC from port %s baud = %d\n",
+                  psCtx->acPort, psCtx->zBaud );
 
     if( wSectorAddr > 0xff )
     {
         /* If usig a full address just use hi-byte */
         wSectorAddr >>= 8;
     }
-    bDat = wSectorAddr & 0xff;
     
     /* Read sector CRC */
-    snintel_hex( acIhexStr, sizeof( acIhexStr ), READ_SECTOR_CRC, &bDat, sizeof( bDat ), 0 );
-    debug_printf( "Sending %s\n", acIhexStr );
-    memset( acRply, 0, sizeof( acRply ));
-    ser_Write( psSerPrt, acIhexStr, strlen( acIhexStr ));
-    bReplySize = ser_Read( psSerPrt, acRply, sizeof( acRply ), 1000000, lpc_RxdPacket );
-    debug_printf( "Read %s - size = %d\n", acRply, bReplySize );
-    if( 0 < bReplySize )
+    zRtnv = lpc_GetSectorCrc( psCtx, wSectorAddr << 8, &lCrc );
+    if( 0 == zRtnv )
     {
-        printf( "Sector 0x%02x00 CRC is: 0x%08x\n", wSectorAddr,
-                (unsigned int)lpc_GetReplyLong( acIhexStr, acRply ));
+        printf( "Sector 0x%02x00 CRC is: 0x%08x\n", wSectorAddr, (unsigned int)lCrc );
     }
     
-    return( 0 );
-}
-
-
-static int lpc_EraseSector( tsSerialPort *psSerPrt, unsigned short wSectorAddr )
-{
-    char acIhexStr[ 20 ];
-    char acRply[ 100 ];
-    unsigned char bReplySize;
-    unsigned char abDat[ 3 ];
-    
-    debug_printf( "Read lpc935 security byte from port %s baud = %d\n", pacComPort, zBaud );
-
-    /* Erase sector */
-    abDat[ 0 ] = DO_SECTOR; /* Command */
-    abDat[ 1 ] = ( wSectorAddr >> 8 ) & 0xff; /* Hi-byte */
-    abDat[ 2 ] = wSectorAddr & 0xff; /* Lo-byte */
-    
-    snintel_hex( acIhexStr, sizeof( acIhexStr ), ERASE_SECTOR_PAGE, abDat, sizeof( abDat ), 0 );
-    debug_printf( "Sending %s\n", acIhexStr );
-    memset( acRply, 0, sizeof( acRply ));
-    ser_Write( psSerPrt, acIhexStr, strlen( acIhexStr ));
-    bReplySize = ser_Read( psSerPrt, acRply, sizeof( acRply ), 1000000, lpc_RxdPacket );
-    debug_printf( "Read %s - len = %d\n", acRply, bReplySize );
-
-    return( 0 );
+    return( zRtnv );
 }
 
 
-static int lpc_ErasePage( tsSerialPort *psSerPrt, unsigned short wPageAddr )
+static int lpc_ErasePage( tsLpcCtx *psCtx, unsigned short wPageAddr )
 {
-    char acIhexStr[ 20 ];
-    char acRply[ 100 ];
-    unsigned char bReplySize;
-    unsigned char abDat[ 3 ];
-
     zShowDebug = 1; /* Switch on debug I don't know what is going to happen */
+    psCtx->zDebug = 1;
     
-    debug_printf( "Read lpc935 security byte from port %s baud = %d\n", pacComPort, zBaud );
-
-    /* Erase page */
-    abDat[ 0 ] = DO_PAGE; /* Command */
-    abDat[ 1 ] = ( wPageAddr >> 8 ) & 0xff; /* Hi-byte */
-    abDat[ 2 ] = wPageAddr & 0xff; /* Lo-byte */
-
-    snintel_hex( acIhexStr, sizeof( acIhexStr ), ERASE_SECTOR_PAGE, abDat, sizeof( abDat ), 0 );
-    debug_printf( "Sending %s\n", acIhexStr );
-    memset( acRply, 0, sizeof( acRply ));
-    ser_Write( psSerPrt, acIhexStr, strlen( acIhexStr ));
-    bReplySize = ser_Read( psSerPrt, acRply, sizeof( acRply ), 1000000, lpc_RxdPacket );
-    debug_printf( "Read %s\n", acRply );
-
-    return( 0 );
-}
-
-
-static int lpc_Reset( tsSerialPort *psSerPrt )
-{
-    char acIhexStr[ 20 ];
-    char acRply[ 100 ];
-    unsigned char bReplySize;
-
-    debug_printf( "Reset the micro-controller on port %s baud = %d\n", pacComPort, zBaud );
-    snintel_hex( acIhexStr, sizeof( acIhexStr ), RESET_MCU, 0, 0, 0 );
-    debug_printf( "Sending %s\n", acIhexStr );
-    memset( acRply, 0, sizeof( acRply ));
-    ser_Write( psSerPrt, acIhexStr, strlen( acIhexStr ));
-    bReplySize = ser_Read( psSerPrt, acRply, sizeof( acRply ), 1000000, lpc_RxdPacket );
-    debug_printf( "Read %s\n", acRply );
+    debug_printf( "Erase lpc935 page 0x%04x on port %s baud = %d\n",
+                  wPageAddr, psCtx->acPort, psCtx->zBaud );
 
-    return( 0 );
+    return( lpc_Erase( psCtx, DO_PAGE, wPageAddr ));
 }
 
 
-static int lpc_WriteUcfg1( tsSerialPort *psSerPrt, unsigned char bNewCfg1 )
+static int lpc_WriteUcfg1( tsLpcCtx *psCtx, unsigned char bNewCfg1 )
 {
-    char acIhexStr[ 20 ];
-    char acRply[ 100 ];
-    unsigned char bReplySize;
-    unsigned char abDat[ 2 ];
-
     zShowDebug = 1; /* Switch on debug I don't know what is going to happen */
-
-    abDat[ 0 ] = PUT_UCFG1;
-    abDat[ 1 ] = bNewCfg1;
+    psCtx->zDebug = 1;
 
     debug_printf( "set the UCFG1 register to 0x%02x on port %s baud = %d\n",
-                  bNewCfg1, pacComPort, zBaud );
-    snintel_hex( acIhexStr, sizeof( acIhexStr ), MISC_WRITE_FN, abDat, sizeof( abDat ), 0 );
-    debug_printf( "Sending %s\n", acIhexStr );
-    memset( acRply, 0, sizeof( acRply ));
-    ser_Write( psSerPrt, acIhexStr, strlen( acIhexStr ));
-    bReplySize = ser_Read( psSerPrt, acRply, sizeof( acRply ), 1000000, lpc_RxdPacket );
-    debug_printf( "Read %s\n", acRply );
+                  bNewCfg1, psCtx->acPort, psCtx->zBaud );
 
-    return( 0 );
+    return( lpc_SetReg( psCtx, PUT_UCFG1, bNewCfg1 ));
 }
 
 
-static int lpc_WriteBootV( tsSerialPort *psSerPrt, unsigned char bNewBootV )
+static int lpc_WriteBootV( tsLpcCtx *psCtx, unsigned char bNewBootV )
 {
-    char acIhexStr[ 20 ];
-    char acRply[ 100 ];
-    unsigned char bReplySize;
-    unsigned char abDat[ 2 ];
-
     zShowDebug = 1; /* Switch on debug I don't know what is going to happen */
-
-    abDat[ 0 ] = PUT_BOOTV;
-    abDat[ 1 ] = bNewBootV;
+    psCtx->zDebug = 1;
 
     debug_printf( "set the BOOTV register to 0x%02x on port %s baud = %d\n",
-                  bNewBootV, pacComPort, zBaud );
-    snintel_hex( acIhexStr, sizeof( acIhexStr ), MISC_WRITE_FN, abDat, sizeof( abDat ), 0 );
-    debug_printf( "Sending %s\n", acIhexStr );
-    memset( acRply, 0, sizeof( acRply ));
-    ser_Write( psSerPrt, acIhexStr, strlen( acIhexStr ));
-    bReplySize = ser_Read( psSerPrt, acRply, sizeof( acRply ), 1000000, lpc_RxdPacket );
-    debug_printf( "Read %s\n", acRply );
+                  bNewBootV, psCtx->acPort, psCtx->zBaud );
 
-    return( 0 );
+    return( lpc_SetReg( psCtx, PUT_BOOTV, bNewBootV ));
 }
 
 
-static int lpc_WriteStatB( tsSerialPort *psSerPrt, unsigned char bNewStatB )
+static int lpc_WriteStatB( tsLpcCtx *psCtx, unsigned char bNewStatB )
 {
-    char acIhexStr[ 20 ];
-    char acRply[ 100 ];
-    unsigned char bReplySize;
-    unsigned char abDat[ 2 ];
-
     zShowDebug = 1; /* Switch on debug I don't know what is going to happen */
-
-    abDat[ 0 ] = PUT_STATB;
-    abDat[ 1 ] = bNewStatB;
+    psCtx->zDebug = 1;
 
     debug_printf( "set the STATB register to 0x%02x on port %s baud = %d\n",
-                  bNewStatB, pacComPort, zBaud );
-    snintel_hex( acIhexStr, sizeof( acIhexStr ), MISC_WRITE_FN, abDat, sizeof( abDat ), 0 );
-    debug_printf( "Sending %s\n", acIhexStr );
-    memset( acRply, 0, sizeof( acRply ));
-    ser_Write( psSerPrt, acIhexStr, strlen( acIhexStr ));
-    bReplySize = ser_Read( psSerPrt, acRply, sizeof( acRply ), 1000000, lpc_RxdPacket );
-    debug_printf( "Read %s\n", acRply );
+                  bNewStatB, psCtx->acPort, psCtx->zBaud );
 
-    return( 0 );
+    return( lpc_SetReg( psCtx, PUT_STATB, bNewStatB ));
 }
 
 
-static int lpc_WriteSecx( tsSerialPort *psSerPrt, unsigned char bSecxReg, unsigned char bSecxDat )
+static int lpc_WriteSecx( tsLpcCtx *psCtx, unsigned char bSecxReg, unsigned char bSecxDat )
 {
     unsigned char abSecCmd[] = { PUT_SECB0, PUT_SECB1, PUT_SECB2, PUT_SECB3,
                                  PUT_SECB4, PUT_SECB5, PUT_SECB6, PUT_SECB7 };
-    char acIhexStr[ 20 ];
-    char acRply[ 100 ];
-    unsigned char bReplySize;
-    unsigned char abDat[ 2 ];
+    int zRtnv = -1;
 
     zShowDebug = 1; /* Switch on debug I don't know what is going to happen */
-
-    abDat[ 0 ] = abSecCmd[ bSecxReg ];
-    abDat[ 1 ] = bSecxDat;
+    psCtx->zDebug = 1;
 
     debug_printf( "set the Sec%d register to 0x%02x on port %s baud = %d\n",
-                  bSecxReg, bSecxDat, pacComPort, zBaud );
+                  bSecxReg, bSecxDat, psCtx->acPort, psCtx->zBaud );
     if( bSecxReg < sizeof( abSecCmd ))
     {
-        snintel_hex( acIhexStr, sizeof( acIhexStr ), MISC_WRITE_FN, abDat, sizeof( abDat ), 0 );
-        debug_printf( "Sending %s\n", acIhexStr );
-        memset( acRply, 0, sizeof( acRply ));
-        ser_Write( psSerPrt, acIhexStr, strlen( acIhexStr ));
-        bReplySize = ser_Read( psSerPrt, acRply, sizeof( acRply ), 1000000, lpc_RxdPacket );
-        debug_printf( "Read %s\n", acRply );
+        zRtnv = lpc_SetReg( psCtx, abSecCmd[ bSecxReg ], bSecxDat );
     }
     
-    return( 0 );
+    return( zRtnv );
 }
 
 
-static int lpc_ReadIcpState( tsSerialPort *psSerPrt, int do_print )
+static int lpc_ReadIcpState( tsLpcCtx *psCtx, int do_print )
 {
     char acIhexStr[ 20 ];
     char acRply[ 100 ];
     unsigned char bDat;
-    unsigned char bReplySize;
 
     if( do_print != 0 )
     {
         debug_printf( "Read programmer ICP state from port %s baud = %d\n",
-                      pacComPort, zBaud );
+                      psCtx->acPort, psCtx->zBaud );
     }
 
     /* Read programmer ICP */
     bDat = PROG_ICP_STATE;
-    snintel_hex( acIhexStr, sizeof( acIhexStr ), PROG_GET, &bDat, sizeof( bDat ),
-                 zOperAddr );
-    debug_printf( "Sending %s\n", acIhexStr );
-    memset( acRply, 0, sizeof( acRply ));
-    ser_Write( psSerPrt, acIhexStr, strlen( acIhexStr ));
-    bReplySize = ser_Read( psSerPrt, acRply, sizeof( acRply ), 1000000,
-                           lpc_RxdPacket );
-    debug_printf( "Read %s\n", acRply );
-    if( 0 < bReplySize )
+    if( 0 < lpc_Command( psCtx, PROG_GET, zOperAddr, &bDat, sizeof( bDat ),
+                         acIhexStr, sizeof( acIhexStr ), acRply, sizeof( acRply )))
     {
         bDat = lpc_GetReplyByte( acIhexStr, acRply );
 
@@ -1141,25 +1995,20 @@ static int lpc_ReadIcpState( tsSerialPort *psSerPrt, int do_print )
 }
 
 
-static int lpc_ReadOffTime( tsSerialPort *psSerPrt )
+static int lpc_ReadOffTime( tsLpcCtx *psCtx )
 {
     char acIhexStr[ 20 ];
     char acRply[ 100 ];
     unsigned char bDat;
-    unsigned char bReplySize;
     unsigned short wOffTime = 0;
 
-    debug_printf( "Read programmer off time from port %s baud = %d\n", pacComPort, zBaud );
+    debug_printf( "Read programmer off time from port %s baud = %d\n",
+                  psCtx->acPort, psCtx->zBaud );
 
     /* Read programmer off timer */
     bDat = PROG_PWR_OFF_TIME;
-    snintel_hex( acIhexStr, sizeof( acIhexStr ), PROG_GET, &bDat, sizeof( bDat ), zOperAddr );
-    debug_printf( "Sending %s\n", acIhexStr );
-    memset( acRply, 0, sizeof( acRply ));
-    ser_Write( psSerPrt, acIhexStr, strlen( acIhexStr ));
-    bReplySize = ser_Read( psSerPrt, acRply, sizeof( acRply ), 1000000, lpc_RxdPacket );
-    debug_printf( "Read %s\n", acRply );
-    if( 0 < bReplySize )
+    if( 0 < lpc_Command( psCtx, PROG_GET, zOperAddr, &bDat, sizeof( bDat ),
+                         acIhexStr, sizeof( acIhexStr ), acRply, sizeof( acRply )))
     {
         wOffTime = lpc_GetReplyShort( acIhexStr, acRply );
 
@@ -1170,13 +2019,13 @@ static int lpc_ReadOffTime( tsSerialPort *psSerPrt )
 }
 
 
-static int lpc_WriteIcpState( tsSerialPort *psSerPrt, unsigned char bState )
+static int lpc_WriteIcpState( tsLpcCtx *psCtx, unsigned char bState )
 {
     char acIhexStr[ 20 ];
     char acRply[ 100 ];
-    unsigned char bReplySize;
     unsigned char abDat[ 2 ];
     unsigned int zICPEntryTime = 3000;
+    int zRtnv;
 
     abDat[ 0 ] = PROG_ICP_STATE;
     abDat[ 1 ] = bState;
@@ -1184,33 +2033,28 @@ static int lpc_WriteIcpState( tsSerialPort *psSerPrt, unsigned char bState )
     if( bState != 0 )
     {
         /* Need to delay the power up time */
-        zICPEntryTime = lpc_ReadOffTime( psSerPrt );
+        zICPEntryTime = lpc_ReadOffTime( psCtx );
     }
 
     debug_printf( "set the ICP state to 0x%02x on port %s baud = %d\n",
-                  bState, pacComPort, zBaud );
-    snintel_hex( acIhexStr, sizeof( acIhexStr ), PROG_SET, abDat, sizeof( abDat ), zOperAddr );
-    debug_printf( "Sending %s\n", acIhexStr );
-    memset( acRply, 0, sizeof( acRply ));
-    ser_Write( psSerPrt, acIhexStr, strlen( acIhexStr ));
-    bReplySize = ser_Read( psSerPrt, acRply, sizeof( acRply ), 1000000, lpc_RxdPacket );
-    debug_printf( "Read %s\n", acRply );
+                  bState, psCtx->acPort, psCtx->zBaud );
+    zRtnv = lpc_Command( psCtx, PROG_SET, zOperAddr, abDat, sizeof( abDat ),
+                         acIhexStr, sizeof( acIhexStr ), acRply, sizeof( acRply ));
 
     if( bState != 0 )
     {
         debug_printf( "Sleeping ICP entry time of %d\n", zICPEntryTime );
-        udelay( zICPEntryTime * 1000 );
+        lpc_Udelay( zICPEntryTime * 1000 );
     }
     
-    return( 0 );
+    return(( 0 < zRtnv ) ? 0 : -1 );
 }
 
 
-static int lpc_WriteOffTime( tsSerialPort *psSerPrt, unsigned short wTime )
+static int lpc_WriteOffTime( tsLpcCtx *psCtx, unsigned short wTime )
 {
     char acIhexStr[ 20 ];
     char acRply[ 100 ];
-    unsigned char bReplySize;
     unsigned char abDat[ 3 ];
 
     abDat[ 0 ] = PROG_PWR_OFF_TIME;
@@ -1218,215 +2062,585 @@ static int lpc_WriteOffTime( tsSerialPort *psSerPrt, unsigned short wTime )
     abDat[ 2 ] = ( unsigned char )( wTime & 0xff );
 
     debug_printf( "set the off delay time of the programmer to 0x%04x on port %s baud = %d\n",
-                  wTime, pacComPort, zBaud );
-    snintel_hex( acIhexStr, sizeof( acIhexStr ), PROG_SET, abDat, sizeof( abDat ), zOperAddr );
-    debug_printf( "Sending %s\n", acIhexStr );
-    memset( acRply, 0, sizeof( acRply ));
-    ser_Write( psSerPrt, acIhexStr, strlen( acIhexStr ));
-    bReplySize = ser_Read( psSerPrt, acRply, sizeof( acRply ), 1000000, lpc_RxdPacket );
-    debug_printf( "Read %s\n", acRply );
+                  wTime, psCtx->acPort, psCtx->zBaud );
 
-    return( 0 );
+    return(( 0 < lpc_Command( psCtx, PROG_SET, zOperAddr, abDat, sizeof( abDat ),
+                              acIhexStr, sizeof( acIhexStr ),
+                              acRply, sizeof( acRply ))) ? 0 : -1 );
 }
 
 
-static int lpc_PlaceInBootLoaderMode( tsSerialPort *psSerPrt )
+/*
+  Program a hex file into the micro.  Only the bytes the file defines are
+  sent, so unless zErase is 0, because the caller already did it, the
+  sectors the image uses are erased first and the gaps read 0xff as the
+  image CRCs expect.
+  Returns the image size, -1 if the file could not be loaded, -2 if an
+  erase or a record failed or -3 if the verify failed.
+ */
+static int lpc_Program( tsLpcCtx *psCtx, char *pacFilename, int zErase )
 {
+    tsImage *psImg;
     int zRtnv = -1;
+    int zFileSize;
+    int zRecLen;
     
-    /*
-      Ok so hardware Activation of the bootloader is to power down the board
-      wait a bit then power up the board with the reset line low and then toggling
-      the reset line three times
-      VDD XXX\_______/--------------------------------- DTR
-      RST XXX_________/-\_/-\_/-\_/-------------------- RTS
-
-      see section Hardware activation of the Boot Loader page 145 of the user manual
-    */
-
-    ser_SetDtrTo( psSerPrt, PWR_OFF ); /* power off */
-    ser_SetRtsTo( psSerPrt, RST_LO ); /* reset low */
-    udelay( 1000000 );
-        
-    ser_SetDtrTo( psSerPrt, PWR_ON ); /* power up */
-    udelay( 100000 );
-    ser_SetRtsTo( psSerPrt, RST_HI ); /* reset hi */
-        
-    udelay( 16 );
+    psImg = lpc_LoadImage( pacFilename );
+    if( NULL != psImg )
+    {
+        zFileSize = psImg->zLast;
 
-    ser_SetRtsTo( psSerPrt, RST_LO ); /* reset lo 1 */
-    udelay( 48 );
-    ser_SetRtsTo( psSerPrt, RST_HI ); /* reset hi */
-        
-    udelay( 16 );
-        
-    ser_SetRtsTo( psSerPrt, RST_LO ); /* reset lo 2 */
-    udelay( 48 );
-    ser_SetRtsTo( psSerPrt, RST_HI ); /* reset hi */
-        
-    udelay( 16 );
-        
-    ser_SetRtsTo( psSerPrt, RST_LO ); /* reset lo 3 */
-    udelay( 48 );
-    ser_SetRtsTo( psSerPrt, RST_HI ); /* reset hi */
+        /* The records were encoded with the global record size, a session
+           may use another one */
+        zRecLen = psCtx->zRecSize;
+        if(( zRecLen <= 0 ) || ( zRecLen > MAX_ISP_RECORD ))
+        {
+            zRecLen = MAX_ISP_RECORD;
+        }
+        if(( zRecLen != psImg->sTx.zRecSize ) &&
+           ( 0 != lpc_BuildTxImageSparse( &psImg->sTx, &psImg->sImg, zRecLen )))
+        {
+            return( -2 );
+        }
+
+        printf( "Program chip file size is: %d - 0x%04x\n", zFileSize, zFileSize );
+        if( 0 != zBenchRecords )
+        {
+            zRtnv = lpc_BenchRecords( psCtx, psImg );
+        }
+        else if( 0 != zDiffProg )
+        {
+            zRtnv = lpc_ProgramDiff( psCtx, psImg );
+        }
+        else if(( 0 != zErase ) && ( 0 != lpc_EraseImage( psCtx, psImg )))
+        {
+            zRtnv = -2;
+        }
+        else
+        {
+            zRtnv = lpc_SendTxImage( psCtx, &psImg->sTx, 0, zFileSize );
+        }
+
+        if(( 0 <= zRtnv ) && ( 0 != zVerify ) && ( 0 == zBenchRecords ))
+        {
+            zRtnv = lpc_VerifyImage( psCtx, psImg );
+        }
+
+        if( 0 <= zRtnv )
+        {
+            zRtnv = zFileSize;
+        }
+    }
 
-    udelay( 100 );
-    zRtnv = lpc_SyncBaud( psSerPrt );
-    
     return( zRtnv );
 }
 
 
-static int lpc_SyncBaud( tsSerialPort *psSerPrt )
+/*
+  Return the parsed image of a hex file.  Parsed files are kept in a small
+  cache and only parsed again when the file size or modification time
+  changes, so a daemon programming the same file many times reads it once.
+  A missing file or a parse error is reported here.
+  Returns NULL if the file could not be read.
+ */
+static tsImage *lpc_LoadImage( char *pacFilename )
 {
-    unsigned char cRply = 0;
-    int zErrCnt = 0;
-    int zRtnv = -1;
+    static tsImage *apsCache[ IMAGE_CACHE_SIZE ];
+    static int zNext = 0;
+    struct stat sSt;
+    tsIhexError sErr;
+    tsImage *psImg = NULL;
+    int zLast;
+    int i;
 
-    /* Discovered by trial and error and then a big margin for error.
-       It normally takes two goes from Hyperterm so I'll try four times
-       and then error out */
-    while(( cRply != AUTO_BAUD_CHAR ) && ( zErrCnt < BAUD_SYNC_ERR_CNT ))
+    if( 0 != stat( pacFilename, &sSt ))
     {
-        ser_Write( psSerPrt, AUTO_BAUD_STR, 1 );
-        ser_Read( psSerPrt, &cRply, 1, 250000, lpc_RxdPacket );
-        zErrCnt++;
+        fprintf( stderr, "File %s not found\n", pacFilename );
+        return( NULL );
     }
-    
-    if( AUTO_BAUD_CHAR == cRply )
+
+    for( i = 0; i < IMAGE_CACHE_SIZE; i++ )
     {
-        zRtnv = 0;
+        if(( NULL != apsCache[ i ]) && ( 0 == strcmp( apsCache[ i ]->acPath, pacFilename )))
+        {
+            psImg = apsCache[ i ];
+            if(( psImg->tMtime == sSt.st_mtime ) && ( psImg->lSize == sSt.st_size ))
+            {
+                debug_printf( "Using cached image of %s\n", pacFilename );
+                return( psImg );
+            }
+            break;
+        }
     }
-    debug_printf( " Received %c - %d - 0x%02x ErrCnt = %d\n", cRply,
-                  cRply & 0xff, cRply & 0xff, zErrCnt );
 
-    /* Flush serial buffer */
-    while( ser_RxPoll( psSerPrt ))
+    /* Not cached or changed, reuse its slot or take the oldest one */
+    if( NULL == psImg )
     {
-        ser_Read( psSerPrt, &cRply, 1, 250000, lpc_RxdPacket );
-    } 
-    return( zRtnv );
+        if( NULL == apsCache[ zNext ])
+        {
+            apsCache[ zNext ] = calloc( 1, sizeof( tsImage ));
+            if( NULL != apsCache[ zNext ])
+            {
+                img_Init( &apsCache[ zNext ]->sImg );
+            }
+        }
+        psImg = apsCache[ zNext ];
+        zNext = ( zNext + 1 ) % IMAGE_CACHE_SIZE;
+        if( NULL == psImg )
+        {
+            return( NULL );
+        }
+    }
+
+    lpc_FreeTxImage( &psImg->sTx );
+    img_Free( &psImg->sImg );
+    psImg->acPath[ 0 ] = '\0';
+
+    zLast = img_ReadHex( &psImg->sImg, pacFilename, &sErr );
+    if(( 0 > zLast ) && ( 0 != sErr.lLine ))
+    {
+        fprintf( stderr, "%s:%u:%u: %s\n", pacFilename, sErr.lLine, sErr.lColumn,
+                 sErr.pacMsg );
+    }
+    if( 0 >= zLast )
+    {
+        return( NULL );
+    }
+
+    /* Work out the CRCs and encode every program record now so that
+       programming is only serial I/O */
+    img_Crc( &psImg->sImg, psImg->alCrc, &psImg->lGlobalCrc );
+    if( 0 != lpc_BuildTxImageSparse( &psImg->sTx, &psImg->sImg, zRecSize ))
+    {
+        fprintf( stderr, "No memory for the program records of %s\n", pacFilename );
+        return( NULL );
+    }
+
+    strncpy( psImg->acPath, pacFilename, sizeof( psImg->acPath ) - 1 );
+    psImg->acPath[ sizeof( psImg->acPath ) - 1 ] = '\0';
+    psImg->tMtime = sSt.st_mtime;
+    psImg->lSize = sSt.st_size;
+    psImg->zLast = zLast;
+
+    return( psImg );
 }
 
 
-static int lpc_Program( tsSerialPort *psSerPrt, char *pacFilename )
+/*
+  Worker for lpc_PrepareStart, loads the image into the cache
+ */
+static void *lpc_PrepareImage( void *pvPrep )
 {
-    static unsigned char abRom[ 65536 ]; /* overkill but you never know */
-    int zRtnv = -1;
-    char acLineBuf[ 1024 ];
-    char acRply[ 1024 ];
-    int zFileSize;
-    int i;
-    int zRplySize;
-    
-    memset( abRom, 0xff, sizeof( abRom ));
+    tsPrepare *psPrep = pvPrep;
+    long long llStart;
+
+    llStart = lpc_Usec();
+    psPrep->psImg = lpc_LoadImage( psPrep->pacFilename );
+    tim_Phase( psTiming, eTIM_PREPARE, llStart );
+
+    return( NULL );
+}
+
 
-    zFileSize = read_intel_hex( pacFilename, abRom, sizeof( abRom ));
-    if( 0 < zFileSize )
+/*
+  Start loading pacFilename, NULL for nothing to load.  On Linux the load
+  runs on its own thread so it overlaps entry to the boot loader, which
+  spends over a second waiting on the board.  The image cache is only
+  used by the worker until lpc_PrepareWait returns.
+ */
+static void lpc_PrepareStart( tsPrepare *psPrep, char *pacFilename )
+{
+    memset( psPrep, 0, sizeof( *psPrep ));
+    psPrep->pacFilename = pacFilename;
+    if( NULL == pacFilename )
     {
-        printf( "Program chip file size is: %d - 0x%04x\n", zFileSize, zFileSize );
-        for( i = 0; i < zFileSize; i += 16 )
-        {
-            snintel_hex( acLineBuf, sizeof( acLineBuf ), 0, &abRom[ i ], 16, i );
-            ser_Write( psSerPrt, acLineBuf, strlen( acLineBuf ));
-            debug_printf( "Written: %s\n", acLineBuf );
-            memset( acLineBuf, 0, sizeof( acLineBuf ));
-            memset( acRply, 0, sizeof( acRply ));
-            
-            zRplySize = ser_Read( psSerPrt, acRply, sizeof( acRply ), 2000000, lpc_RxdPacket );
-            debug_printf( "Read:    %s", acRply );
-
-            if( 0 < zRplySize )
+        return;
+    }
+
+#ifdef LINUX
+    if( 0 == pthread_create( &psPrep->tThread, NULL, lpc_PrepareImage, psPrep ))
+    {
+        psPrep->zThread = 1;
+        return;
+    }
+#endif
+    lpc_PrepareImage( psPrep );
+}
+
+
+/*
+  Wait for lpc_PrepareStart to finish.
+  Returns the loaded image or NULL if there was none or it failed.
+ */
+static tsImage *lpc_PrepareWait( tsPrepare *psPrep )
+{
+#ifdef LINUX
+    if( 0 != psPrep->zThread )
+    {
+        pthread_join( psPrep->tThread, NULL );
+        psPrep->zThread = 0;
+    }
+#endif
+
+    return( psPrep->psImg );
+}
+
+
+/*
+  Bring the device in line with the image touching only the sectors that
+  differ.  The global CRC is checked first and if it matches there is
+  nothing to do.  Otherwise every sector the image uses has its CRC read
+  and compared with the one worked out on the host.  The erase planner
+  picks the cheapest erases for the sectors that differ and only those
+  sectors are programmed.
+  Returns the number of data bytes sent or a negative number on error.
+ */
+static int lpc_ProgramDiff( tsLpcCtx *psCtx, tsImage *psImg )
+{
+    unsigned long alDevCrc[ CRC_FLASH_SIZE / CRC_SECTOR_SIZE ];
+    unsigned char abPlan[ CRC_FLASH_SIZE / CRC_SECTOR_SIZE ];
+    unsigned long *alImgCrc = psImg->alCrc;
+    const tsTxImage *psTx = &psImg->sTx;
+    int zLast = psImg->zLast;
+    unsigned long lDevCrc;
+    int zSector;
+    int zIdx;
+    int zSent = 0;
+    int zRtnv;
+    int zChanged = 0;
+    int zUsedSectors = 0;
+
+    if( zLast >= CRC_FLASH_SIZE )
+    {
+        fprintf( stderr, "Image ends at 0x%04x, past the end of flash\n", zLast );
+        return( -2 );
+    }
+
+    if(( 0 == lpc_GetGlobalCrc( psCtx, &lDevCrc )) && ( psImg->lGlobalCrc == lDevCrc ))
+    {
+        printf( "Global CRC 0x%08lx matches, device is up to date\n", lDevCrc );
+        return( 0 );
+    }
+
+    memset( abPlan, PLAN_SKIP, sizeof( abPlan ));
+    for( zSector = img_NextBlock( &psImg->sImg, 0, CRC_SECTOR_SIZE ); 0 <= zSector;
+         zSector = img_NextBlock( &psImg->sImg, zSector + CRC_SECTOR_SIZE, CRC_SECTOR_SIZE ))
+    {
+        zIdx = zSector / CRC_SECTOR_SIZE;
+        zUsedSectors++;
+
+        if( 0 != lpc_GetSectorCrc( psCtx, zSector, &alDevCrc[ zIdx ]))
+        {
+            fprintf( stderr, "Could not read CRC of sector 0x%04x\n", zSector );
+            return( -2 );
+        }
+
+        if( alImgCrc[ zIdx ] == alDevCrc[ zIdx ])
+        {
+            debug_printf( "Sector 0x%04x unchanged, CRC 0x%08lx\n", zSector, alDevCrc[ zIdx ]);
+            continue;
+        }
+
+        printf( "Sector 0x%04x differs (device 0x%08lx, image 0x%08lx)\n",
+                zSector, alDevCrc[ zIdx ], alImgCrc[ zIdx ]);
+        abPlan[ zIdx ] = PLAN_PROGRAM;
+        zChanged++;
+    }
+
+    if( 0 != lpc_PlanErase( psCtx, &psImg->sImg, zLast, alDevCrc, abPlan ))
+    {
+        return( -2 );
+    }
+
+    for( zSector = 0; zSector <= zLast; zSector += CRC_SECTOR_SIZE )
+    {
+        zIdx = zSector / CRC_SECTOR_SIZE;
+        if( PLAN_SKIP == abPlan[ zIdx ])
+        {
+            continue;
+        }
+
+        zRtnv = lpc_SendTxImage( psCtx, psTx, zSector, zSector + CRC_SECTOR_SIZE - 1 );
+        if( 0 > zRtnv )
+        {
+            return( zRtnv );
+        }
+        zSent += zRtnv;
+
+        /* Page erases leave the pages the image does not use alone.  If
+           they were not blank the sector will not match, so fall back to
+           erasing the whole sector and doing it again */
+        if(( PLAN_PAGES == abPlan[ zIdx ]) &&
+           (( 0 != lpc_GetSectorCrc( psCtx, zSector, &lDevCrc )) ||
+            ( lDevCrc != alImgCrc[ zIdx ])))
+        {
+            printf( "Sector 0x%04x still differs after page erase, erasing sector\n", zSector );
+            if( 0 != lpc_Erase( psCtx, DO_SECTOR, zSector ))
             {
-                printf( "%c", acRply[ strlen( acRply ) - 3 ]);
-                fflush( stdout );
+                fprintf( stderr, "Erase of sector 0x%04x failed\n", zSector );
+                return( -2 );
             }
+            zRtnv = lpc_SendTxImage( psCtx, psTx, zSector, zSector + CRC_SECTOR_SIZE - 1 );
+            if( 0 > zRtnv )
+            {
+                return( zRtnv );
+            }
+            zSent += zRtnv;
         }
-        zRtnv = zFileSize;
-        printf( "\n" );
     }
 
-    return( zRtnv );
+    printf( "%d of %d sectors reprogrammed\n", zChanged, zUsedSectors );
+
+    return( zSent );
 }
 
-#if defined(WINDOWS) || defined(WIN32) ||defined(_WIN32)
-static void udelay( unsigned int uS )
+
+/*
+  Work out and carry out the cheapest set of erases for the sectors marked
+  PLAN_PROGRAM in abPlan.  A sector the device reports as blank needs no
+  erase at all.  Otherwise the cost of one sector erase is compared with
+  the cost of erasing each page the image uses, where each erase costs its
+  command and reply on the wire plus the flash erase time, and the page
+  erases also cost the sector CRC read that checks them afterwards.  The
+  sector erase and second pass lpc_ProgramDiff falls back to when that
+  check fails are not counted, a sector CRC cannot tell whether the pages
+  the image leaves alone are blank.  abPlan is updated to say which was
+  chosen.  The estimated and the measured erase time are both reported so
+  the cost model can be tuned.
+  Returns 0 if every erase was acknowledged.
+ */
+static int lpc_PlanErase( tsLpcCtx *psCtx, const tsImg *psImg, int zLast,
+                          unsigned long alDevCrc[], unsigned char abPlan[] )
 {
-    LARGE_INTEGER llPerfCount;
-    LONGLONG llPerfCount2;
-    LONGLONG llCurUsec;
-    LONGLONG llDestUsec;
+    unsigned char abBlank[ CRC_SECTOR_SIZE ];
+    unsigned long lBlankCrc;
+    long long llWire;
+    long long llCheck;
+    long long llPages;
+    long long llEst = 0;
+    long long llStart;
+    long long llTime;
+    int zSector;
+    int zPage;
+    int zIdx;
+    int zPages;
+    int zSectorOps = 0;
+    int zPageOps = 0;
+
+    memset( abBlank, 0xff, sizeof( abBlank ));
+    lBlankCrc = crc_Sector( abBlank, 0 );
+    llWire = ( ERASE_CMD_CHARS * 10000000LL ) / psCtx->zBaud;
+    llCheck = ( CRC_CMD_CHARS * 10000000LL ) / psCtx->zBaud;
+
+    for( zSector = 0; zSector <= zLast; zSector += CRC_SECTOR_SIZE )
+    {
+        zIdx = zSector / CRC_SECTOR_SIZE;
+        if( PLAN_PROGRAM != abPlan[ zIdx ])
+        {
+            continue;
+        }
+
+        if( lBlankCrc == alDevCrc[ zIdx ])
+        {
+            debug_printf( "Sector 0x%04x is blank, no erase needed\n", zSector );
+            continue;
+        }
+
+        zPages = 0;
+        for( zPage = img_NextBlock( psImg, zSector, FLASH_PAGE_SIZE );
+             ( 0 <= zPage ) && ( zPage < zSector + CRC_SECTOR_SIZE );
+             zPage = img_NextBlock( psImg, zPage + FLASH_PAGE_SIZE, FLASH_PAGE_SIZE ))
+        {
+            zPages++;
+        }
+
+        llPages = zPages * ( llWire + zPageEraseUs ) + llCheck;
+        if( llPages < llWire + zSectorEraseUs )
+        {
+            abPlan[ zIdx ] = PLAN_PAGES;
+            zPageOps += zPages;
+            llEst += llPages;
+        }
+        else
+        {
+            abPlan[ zIdx ] = PLAN_SECTOR;
+            zSectorOps++;
+            llEst += llWire + zSectorEraseUs;
+        }
+    }
 
-    static int qFirstTime = 1;
-    static LARGE_INTEGER llPerfFreq;
-    static LONGLONG llPerfFreq2;
+    printf( "Erase plan: %d sector and %d page erases, estimated %lld.%03lld ms\n",
+            zSectorOps, zPageOps, llEst / 1000, llEst % 1000 );
 
-    /* First time through, get frequency of high-resolution
-       performance counter */
-    if( 0 != qFirstTime )
+    llStart = lpc_Usec();
+    for( zSector = 0; zSector <= zLast; zSector += CRC_SECTOR_SIZE )
     {
-         QueryPerformanceFrequency( &llPerfFreq );
-         llPerfFreq2 = *(LONGLONG *) &llPerfFreq;
-         qFirstTime = 0;
-         /*debug_printf( "Freq = %ld\n", llPerfFreq2 );*/
+        zIdx = zSector / CRC_SECTOR_SIZE;
+        if( PLAN_SECTOR == abPlan[ zIdx ])
+        {
+            debug_printf( "Erase sector 0x%04x\n", zSector );
+            if( 0 != lpc_Erase( psCtx, DO_SECTOR, zSector ))
+            {
+                fprintf( stderr, "Erase of sector 0x%04x failed\n", zSector );
+                return( -1 );
+            }
+        }
+        else if( PLAN_PAGES == abPlan[ zIdx ])
+        {
+            for( zPage = img_NextBlock( psImg, zSector, FLASH_PAGE_SIZE );
+                 ( 0 <= zPage ) && ( zPage < zSector + CRC_SECTOR_SIZE );
+                 zPage = img_NextBlock( psImg, zPage + FLASH_PAGE_SIZE, FLASH_PAGE_SIZE ))
+            {
+                debug_printf( "Erase page 0x%04x\n", zPage );
+                if( 0 != lpc_Erase( psCtx, DO_PAGE, zPage ))
+                {
+                    fprintf( stderr, "Erase of page 0x%04x failed\n", zPage );
+                    return( -1 );
+                }
+            }
+        }
     }
+    tim_Phase( psCtx->psTiming, eTIM_ERASE, llStart );
+    llTime = lpc_Usec() - llStart;
+
+    printf( "Erase took %lld.%03lld ms, estimated %lld.%03lld ms\n",
+            llTime / 1000, llTime % 1000, llEst / 1000, llEst % 1000 );
 
-    /* Get current value of high-resolution performance counter */
-    QueryPerformanceCounter( &llPerfCount );
-    llPerfCount2 = *(LONGLONG *)&llPerfCount;
+    return( 0 );
+}
 
-    /* Calculate the finish time in uSeconds */
-    llDestUsec = (( llPerfCount2 * (LONGLONG) 1000000 ) / llPerfFreq2 ) + (LONGLONG) uS;
-    /*debug_printf( "uS = %d\n", uS );
-    debug_printf( "llPerfCount2 = %lu\n", llPerfCount2 );*/
 
+/*
+  Check the device against the image by reading back the CRC of every
+  sector the image uses in this session.  No data is sent again so this
+  costs one short command per sector.  A sector CRC covers the whole
+  sector, with 0xff for the bytes the file did not define, which holds
+  because lpc_Program erased each such sector, or left it alone with -D
+  when it already matched, before programming it.
+  Returns 0 if every sector matched or -3 if any did not.
+ */
+static int lpc_VerifyImage( tsLpcCtx *psCtx, tsImage *psImg )
+{
+    unsigned long *alImgCrc = psImg->alCrc;
+    int zLast = psImg->zLast;
+    unsigned long lDevCrc;
+    long long llStart;
+    long long llRead;
+    long long llTotal;
+    int zSector;
+    int zChecked = 0;
+    int zBad = 0;
+
+    if( zLast >= CRC_FLASH_SIZE )
+    {
+        fprintf( stderr, "Image ends at 0x%04x, past the end of flash\n", zLast );
+        return( -3 );
+    }
+
+    llTotal = lpc_Usec();
 
-    do 
+    for( zSector = img_NextBlock( &psImg->sImg, 0, CRC_SECTOR_SIZE ); 0 <= zSector;
+         zSector = img_NextBlock( &psImg->sImg, zSector + CRC_SECTOR_SIZE, CRC_SECTOR_SIZE ))
     {
-         /* Get current value of high-resolution performance
-            counter */
-         QueryPerformanceCounter( &llPerfCount );
-         llPerfCount2 = *(LONGLONG *) &llPerfCount;
+        zChecked++;
+
+        llStart = lpc_Usec();
+        if( 0 != lpc_GetSectorCrc( psCtx, zSector, &lDevCrc ))
+        {
+            printf( "Sector 0x%04x CRC read failed\n", zSector );
+            zBad++;
+            continue;
+        }
+        llRead = lpc_Usec() - llStart;
+
+        if( alImgCrc[ zSector / CRC_SECTOR_SIZE ] != lDevCrc )
+        {
+            printf( "Sector 0x%04x MISMATCH device 0x%08lx image 0x%08lx (%lld.%03lld ms)\n",
+                    zSector, lDevCrc, alImgCrc[ zSector / CRC_SECTOR_SIZE ],
+                    llRead / 1000, llRead % 1000 );
+            zBad++;
+        }
+        else
+        {
+            debug_printf( "Sector 0x%04x OK 0x%08lx (%lld.%03lld ms)\n",
+                          zSector, lDevCrc, llRead / 1000, llRead % 1000 );
+        }
+    }
+
+    tim_Phase( psCtx->psTiming, eTIM_VERIFY, llTotal );
+    llTotal = lpc_Usec() - llTotal;
+    printf( "Verify %s: %d sectors checked, %d mismatched in %lld.%03lld ms\n",
+            ( 0 == zBad ) ? "passed" : "FAILED", zChecked, zBad,
+            llTotal / 1000, llTotal % 1000 );
 
-         /* Calculate current count in uSeconds */
-         llCurUsec = ( llPerfCount2 * (LONGLONG) 1000000 / llPerfFreq2 );
-    } while( llCurUsec < llDestUsec );
+    return(( 0 == zBad ) ? 0 : -3 );
 }
-#endif
 
-#ifdef LINUX
-#include <sys/time.h>
-static void udelay( unsigned int uS )
+
+/*
+  Program the image once with each power of two record size up to the
+  largest the boot loader takes and report the data rate of each pass.
+  The sectors of the image are erased before each pass, outside the time
+  taken, so every pass programs blank flash.
+ */
+static int lpc_BenchRecords( tsLpcCtx *psCtx, tsImage *psImg )
 {
-    struct timeval sTv;
-    unsigned long lCurUsec;
-    unsigned long lOldUsec;
-
-    gettimeofday( &sTv, 0 );
-    lOldUsec = (sTv.tv_sec * 1000000 ) + sTv.tv_usec;
-    do
-    {        
-        gettimeofday( &sTv, 0 );
-        lCurUsec = (sTv.tv_sec * 1000000 ) + sTv.tv_usec;
-    } while(( lCurUsec - lOldUsec ) < uS );
-    /* debug_printf( "cur %lu, old %lu, cur - old = %lu\n", lCurUsec, lOldUsec,
-       lCurUsec - lOldUsec ); */
+    tsTxImage sTx;
+    long long llStart;
+    long long llTime;
+    int zRecLen;
+    int zSent;
+
+    printf( "Record  Bytes   Time(ms)  Bytes/s\n" );
+    for( zRecLen = 4; zRecLen <= MAX_ISP_RECORD; zRecLen <<= 1 )
+    {
+        if( 0 != lpc_BuildTxImageSparse( &sTx, &psImg->sImg, zRecLen ))
+        {
+            return( -2 );
+        }
+        if( 0 != lpc_EraseImage( psCtx, psImg ))
+        {
+            lpc_FreeTxImage( &sTx );
+            return( -1 );
+        }
+        llStart = lpc_Usec();
+        zSent = lpc_SendTxImage( psCtx, &sTx, 0, psImg->zLast );
+        llTime = lpc_Usec() - llStart;
+        lpc_FreeTxImage( &sTx );
+        if( 0 > zSent )
+        {
+            return( zSent );
+        }
+
+        printf( "%6d  %6d  %8lld  %7lld\n", zRecLen, zSent, llTime / 1000,
+                ( llTime > 0 ) ? ( zSent * 1000000LL ) / llTime : 0 );
+    }
+
+    return( 0 );
 }
-#endif
 
-int lpc_RxdPacket( void *pvBuf, int zLen )
+
+/*
+  Erase every sector that holds a byte of the image.
+  Returns 0 on success or -1 if an erase failed.
+ */
+static int lpc_EraseImage( tsLpcCtx *psCtx, tsImage *psImg )
 {
-    int zRtnv = -1;
-    char *pacBuf = pvBuf;
-    
-    /* from GDB acRply = ":0100000310ec15.\r\n" */
-    if(( zLen > 3 ) && ( ':' == *pacBuf ) &&
-       ( '\n' == *( pacBuf + zLen - 1 )) &&
-       ( '\r' == *( pacBuf + zLen - 2 )))
+    long long llStart;
+    int zSector;
+
+    llStart = lpc_Usec();
+    for( zSector = img_NextBlock( &psImg->sImg, 0, CRC_SECTOR_SIZE ); 0 <= zSector;
+         zSector = img_NextBlock( &psImg->sImg, zSector + CRC_SECTOR_SIZE, CRC_SECTOR_SIZE ))
     {
-        /* These bits are the same for every packet */
-        zRtnv = 0;
+        debug_printf( "Erase sector 0x%04x\n", zSector );
+        if( 0 != lpc_Erase( psCtx, DO_SECTOR, zSector ))
+        {
+            fprintf( stderr, "Erase of sector 0x%04x failed\n", zSector );
+            return( -1 );
+        }
     }
+    tim_Phase( psCtx->psTiming, eTIM_ERASE, llStart );
 
-    return( zRtnv );
+    return( 0 );
 }
@@ -0,0 +1,421 @@
+/*
+  File:         lpc935-replay.c
+  Written by:   Rod Boyce
+  e-mail:       rod@boyce.net.nz
+
+  This file is part of lpc935-prog
+
+  lpc935-prog is free software; you can redistribute it and/or modify
+  it under the terms of the Lesser GNU General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  lpc935-prog is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser
+  GNU General Public License for more details.
+
+  You should have received a copy of the Lesser GNU General Public
+  License along with lpc935-prog; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+  USA
+*/
+/*
+  Replay a wire trace captured with lpc935-prog --trace=FILE.  The chunks
+  are fed back in order through the same reply framing and decoders the
+  programmer uses (lpc_RxdPacket, lpc_ReplyOk and lpc_GetReplyByte, Short
+  and Long) and each exchange is printed with its time stamp and how long
+  the reply took:
+
+      lpc935-replay [-t USEC] [-v] trace.bin
+
+  Replies matched to a record are taken oldest first, as the boot loader
+  answers them in order.  Replies slower than -t, by default the command
+  time out of the programmer, are flagged LATE so time outs seen on the
+  bench can be reproduced offline.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <popt.h>
+#include <string.h>
+
+#include "ihex.h"
+#include "lpc935.h"
+
+/* Records that can be waiting for a reply, as many as the program window */
+#define RPL_PENDING ( MAX_PROG_WINDOW + 4 )
+/* Longest reply line kept, a full page record echoed with its status */
+#define RPL_LINE_SIZE 1024
+/* Default reply time out, the same as lpc_Init uses for commands */
+#define RPL_TIMEOUT 1000000
+
+/* A record that has been sent and not yet answered */
+typedef struct
+{
+    char acTxd[ RPL_LINE_SIZE ]; /**< The record, an empty string for an autobaud character */
+    long long llTime; /**< When it was sent */
+} tsPending;
+
+/* Everything seen so far */
+typedef struct
+{
+    tsPending asPend[ RPL_PENDING ];
+    int zPend; /**< Entries in asPend, oldest first */
+    char acRxd[ RPL_LINE_SIZE ]; /**< Received bytes not yet part of a whole line */
+    int zRxd; /**< Bytes in acRxd */
+    long long llTxBytes;
+    long long llRxBytes;
+    long long llMaxLat; /**< Slowest reply */
+    int zReplies; /**< Reply lines decoded */
+    int zFailed; /**< Replies that were not acknowledged with '.' */
+    int zLate; /**< Replies slower than the time out */
+    int zLost; /**< Records or autobaud characters that got no reply */
+} tsReplay;
+
+int zTimeout = RPL_TIMEOUT; /**< Replies slower than this are flagged */
+int zShowDebug = 0; /**< If set print every chunk as it is read */
+
+struct poptOption optionsTable[] =
+{
+    { "timeout", 't', POPT_ARG_INT, &zTimeout, 0,
+      "Flag replies slower than this many microseconds", "USEC" },
+    { "verbose", 'v', POPT_ARG_NONE, &zShowDebug, 0, "Print every chunk in the trace", 0 },
+
+    POPT_AUTOHELP
+    POPT_TABLEEND
+};
+
+static void rpl_Sent( tsReplay *psRpl, const tsTraceRec *psRec );
+static void rpl_Received( tsReplay *psRpl, const tsTraceRec *psRec );
+static void rpl_Line( tsReplay *psRpl, char *pacLine, int zLen, long long llTime );
+static void rpl_Decode( char *pacTxd, char *pacRxd, char *pacOut, int zSize );
+static void rpl_Pop( tsReplay *psRpl, tsPending *psPend );
+static void rpl_Chunk( const tsTraceRec *psRec );
+
+
+int main( const int argc, const char **argv )
+{
+    static tsTraceRec sRec;
+    static tsReplay sRpl;
+    poptContext optCon;
+    const char *pacFile;
+    tsTrace sTrc;
+    int zRtnv;
+    int c;
+
+    optCon = poptGetContext( NULL, argc, argv, optionsTable, 0 );
+    poptSetOtherOptionHelp( optCon, "[OPTIONS]* <trace>" );
+    while(( c = poptGetNextOpt( optCon )) >= 0 )
+    {
+    }
+
+    pacFile = poptGetArg( optCon );
+    if(( NULL == pacFile ) || ( 0 != trc_OpenRead( &sTrc, pacFile )))
+    {
+        fprintf( stderr, "No trace file given or %s is not a trace\n",
+                 ( NULL == pacFile ) ? "" : pacFile );
+        poptFreeContext( optCon );
+        return( 1 );
+    }
+
+    while( 1 == ( zRtnv = trc_Next( &sTrc, &sRec )))
+    {
+        if( 0 != zShowDebug )
+        {
+            rpl_Chunk( &sRec );
+        }
+        if( 0 == sRec.zLen )
+        {
+            continue;
+        }
+
+        if( SER_TX == sRec.zDir )
+        {
+            rpl_Sent( &sRpl, &sRec );
+        }
+        else
+        {
+            rpl_Received( &sRpl, &sRec );
+        }
+    }
+    if( 0 > zRtnv )
+    {
+        printf( "Trace is cut short\n" );
+    }
+
+    while( 0 < sRpl.zPend )
+    {
+        printf( "%12.6f no reply to %s\n", sRpl.asPend[ 0 ].llTime / 1e6,
+                ( '\0' == sRpl.asPend[ 0 ].acTxd[ 0 ]) ? "autobaud" : sRpl.asPend[ 0 ].acTxd );
+        rpl_Pop( &sRpl, NULL );
+        sRpl.zLost++;
+    }
+
+    printf( "%lld bytes sent, %lld received, %d replies, %d failed, %d late, %d lost, "
+            "slowest %lld us\n", sRpl.llTxBytes, sRpl.llRxBytes, sRpl.zReplies, sRpl.zFailed,
+            sRpl.zLate, sRpl.zLost, sRpl.llMaxLat );
+
+    trc_Close( &sTrc );
+    poptFreeContext( optCon );
+
+    return(( 0 == sRpl.zFailed + sRpl.zLate + sRpl.zLost ) ? 0 : 1 );
+}
+
+
+/*
+  A chunk was written.  Each write is one whole record or one autobaud
+  character, so it is queued to be matched with the reply that follows.
+ */
+static void rpl_Sent( tsReplay *psRpl, const tsTraceRec *psRec )
+{
+    tsPending *psPend;
+    int zLen = psRec->zLen;
+
+    psRpl->llTxBytes += zLen;
+
+    /* Autobaud characters that were never echoed are not waited for once
+       a record goes out */
+    if( ':' == psRec->abData[ 0 ])
+    {
+        while(( 0 < psRpl->zPend ) && ( '\0' == psRpl->asPend[ 0 ].acTxd[ 0 ]))
+        {
+            rpl_Pop( psRpl, NULL );
+        }
+    }
+
+    if( RPL_PENDING == psRpl->zPend )
+    {
+        printf( "%12.6f too many records without a reply, dropping %s\n",
+                psRpl->asPend[ 0 ].llTime / 1e6, psRpl->asPend[ 0 ].acTxd );
+        rpl_Pop( psRpl, NULL );
+        psRpl->zLost++;
+    }
+
+    psPend = &psRpl->asPend[ psRpl->zPend++ ];
+    psPend->llTime = psRec->llTime;
+    psPend->acTxd[ 0 ] = '\0';
+    if( ':' == psRec->abData[ 0 ])
+    {
+        if( zLen > RPL_LINE_SIZE - 1 )
+        {
+            zLen = RPL_LINE_SIZE - 1;
+        }
+        memcpy( psPend->acTxd, psRec->abData, zLen );
+        psPend->acTxd[ zLen ] = '\0';
+        psPend->acTxd[ strcspn( psPend->acTxd, "\r\n" )] = '\0';
+    }
+}
+
+
+/*
+  A chunk was read.  It is added to what is waiting and every whole reply
+  line is handed on, anything in front of a line is an autobaud echo or
+  noise.
+ */
+static void rpl_Received( tsReplay *psRpl, const tsTraceRec *psRec )
+{
+    tsPending sPend;
+    char *pacEol;
+    int zLineLen;
+    int zCopy;
+    int i;
+
+    psRpl->llRxBytes += psRec->zLen;
+    zCopy = psRec->zLen;
+    if( zCopy > RPL_LINE_SIZE - 1 - psRpl->zRxd )
+    {
+        printf( "%12.6f reply too long, lost framing\n", psRec->llTime / 1e6 );
+        psRpl->zRxd = 0;
+        zCopy = ( zCopy < RPL_LINE_SIZE - 1 ) ? zCopy : RPL_LINE_SIZE - 1;
+    }
+    memcpy( &psRpl->acRxd[ psRpl->zRxd ], psRec->abData, zCopy );
+    psRpl->zRxd += zCopy;
+
+    while( 0 < psRpl->zRxd )
+    {
+        /* Bytes outside a line answer autobaud characters or are noise */
+        for( i = 0; ( i < psRpl->zRxd ) && ( ':' != psRpl->acRxd[ i ]); i++ )
+        {
+            if(( 0 < psRpl->zPend ) && ( '\0' == psRpl->asPend[ 0 ].acTxd[ 0 ]))
+            {
+                rpl_Pop( psRpl, &sPend );
+                printf( "%12.6f %8lld us autobaud echo '%c'\n", psRec->llTime / 1e6,
+                        psRec->llTime - sPend.llTime,
+                        ( ' ' <= psRpl->acRxd[ i ]) ? psRpl->acRxd[ i ] : '?' );
+            }
+            else if(( '\r' != psRpl->acRxd[ i ]) && ( '\n' != psRpl->acRxd[ i ]))
+            {
+                printf( "%12.6f noise 0x%02x\n", psRec->llTime / 1e6,
+                        psRpl->acRxd[ i ] & 0xff );
+            }
+        }
+        psRpl->zRxd -= i;
+        memmove( psRpl->acRxd, &psRpl->acRxd[ i ], psRpl->zRxd );
+
+        pacEol = memchr( psRpl->acRxd, '\n', psRpl->zRxd );
+        if( NULL == pacEol )
+        {
+            break;
+        }
+
+        zLineLen = pacEol - psRpl->acRxd + 1;
+        rpl_Line( psRpl, psRpl->acRxd, zLineLen, psRec->llTime );
+        psRpl->zRxd -= zLineLen;
+        memmove( psRpl->acRxd, &psRpl->acRxd[ zLineLen ], psRpl->zRxd );
+    }
+}
+
+
+/*
+  One whole reply line.  It is framed the way ser_Read sees it, matched
+  to the oldest record waiting and decoded for that record's type.
+ */
+static void rpl_Line( tsReplay *psRpl, char *pacLine, int zLen, long long llTime )
+{
+    char acLine[ RPL_LINE_SIZE ];
+    char acDecoded[ 64 ];
+    tsPending sPend;
+    long long llLat;
+    int zFramed;
+
+    memcpy( acLine, pacLine, zLen );
+    acLine[ zLen ] = '\0';
+    zFramed = ( 0 == lpc_RxdPacket( acLine, zLen ));
+    psRpl->zReplies++;
+
+    /* Autobaud characters still waiting were never echoed */
+    while(( 0 < psRpl->zPend ) && ( '\0' == psRpl->asPend[ 0 ].acTxd[ 0 ]))
+    {
+        rpl_Pop( psRpl, NULL );
+    }
+    if( 0 == psRpl->zPend )
+    {
+        printf( "%12.6f unexpected reply %.*s\n", llTime / 1e6, zLen - 2, acLine );
+        psRpl->zFailed++;
+        return;
+    }
+    rpl_Pop( psRpl, &sPend );
+
+    llLat = llTime - sPend.llTime;
+    if( llLat > psRpl->llMaxLat )
+    {
+        psRpl->llMaxLat = llLat;
+    }
+
+    if( 0 == zFramed )
+    {
+        strcpy( acDecoded, "bad framing" );
+    }
+    else
+    {
+        rpl_Decode( sPend.acTxd, acLine, acDecoded, sizeof( acDecoded ));
+    }
+    if(( 0 == zFramed ) || ( 0 != lpc_ReplyOk( sPend.acTxd, acLine )))
+    {
+        psRpl->zFailed++;
+    }
+    if( llLat > zTimeout )
+    {
+        psRpl->zLate++;
+    }
+
+    printf( "%12.6f %8lld us %s%s\n", llTime / 1e6, llLat, acDecoded,
+            ( llLat > zTimeout ) ? " LATE" : "" );
+}
+
+
+/*
+  Describe the reply to one record using the decoder the programmer uses
+  for that record type.
+ */
+static void rpl_Decode( char *pacTxd, char *pacRxd, char *pacOut, int zSize )
+{
+    unsigned char bType;
+    int zEnd = strlen( pacRxd );
+    char cStatus = ( 3 <= zEnd ) ? pacRxd[ zEnd - 3 ] : '?';
+
+    bType = ( nibble( pacTxd[ 7 ]) << 4 ) | nibble( pacTxd[ 8 ]);
+
+    if( 0 != lpc_ReplyOk( pacTxd, pacRxd ))
+    {
+        snprintf( pacOut, zSize, "%02x %s status '%c'",
+                  bType, ( 0 == strncasecmp( pacTxd, pacRxd, strlen( pacTxd ))) ?
+                  "failed with" : "echo mismatch,", cStatus );
+        return;
+    }
+
+    switch( bType )
+    {
+      case( MISC_READ_FN ) :
+          snprintf( pacOut, zSize, "%02x read 0x%02x", bType,
+                    lpc_GetReplyByte( pacTxd, pacRxd ));
+          break;
+
+      case( READ_SECTOR_CRC ) :
+      case( READ_GLOBAL_CRC ) :
+          snprintf( pacOut, zSize, "%02x crc 0x%08lx", bType,
+                    lpc_GetReplyLong( pacTxd, pacRxd ) & 0xffffffffUL );
+          break;
+
+      case( PROG_GET ) :
+          if( PROG_PWR_OFF_TIME == (( nibble( pacTxd[ 9 ]) << 4 ) | nibble( pacTxd[ 10 ])))
+          {
+              snprintf( pacOut, zSize, "%02x read 0x%04x", bType,
+                        lpc_GetReplyShort( pacTxd, pacRxd ));
+          }
+          else
+          {
+              snprintf( pacOut, zSize, "%02x read 0x%02x", bType,
+                        lpc_GetReplyByte( pacTxd, pacRxd ));
+          }
+          break;
+
+      case( READ_VERSION_ID ) :
+          snprintf( pacOut, zSize, "%02x version %.*s", bType,
+                    zEnd - 3 - ( int )strlen( pacTxd ), pacRxd + strlen( pacTxd ));
+          break;
+
+      default :
+          snprintf( pacOut, zSize, "%02x ok", bType );
+          break;
+    }
+}
+
+
+/*
+  Take the oldest record off the waiting list, copying it to psPend if
+  that is not NULL.
+ */
+static void rpl_Pop( tsReplay *psRpl, tsPending *psPend )
+{
+    if( NULL != psPend )
+    {
+        *psPend = psRpl->asPend[ 0 ];
+    }
+    psRpl->zPend--;
+    memmove( &psRpl->asPend[ 0 ], &psRpl->asPend[ 1 ], sizeof( tsPending ) * psRpl->zPend );
+}
+
+
+/*
+  Print a chunk as it is in the trace for -v
+ */
+static void rpl_Chunk( const tsTraceRec *psRec )
+{
+    int i;
+
+    printf( "%12.6f %s %4d ", psRec->llTime / 1e6,
+            ( SER_TX == psRec->zDir ) ? "TX" : "RX", psRec->zLen );
+    for( i = 0; i < psRec->zLen; i++ )
+    {
+        if(( ' ' <= psRec->abData[ i ]) && ( '~' >= psRec->abData[ i ]))
+        {
+            putchar( psRec->abData[ i ]);
+        }
+        else
+        {
+            printf( "\\x%02x", psRec->abData[ i ]);
+        }
+    }
+    putchar( '\n' );
+}
@@ -0,0 +1,1417 @@
+/*
+  File:         lpc935.c
+  Written by:   Rod Boyce
+  e-mail:       rod@boyce.net.nz
+
+  This file is part of lpc935-prog
+
+  lpc935-prog is free software; you can redistribute it and/or modify
+  it under the terms of the Lesser GNU General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  lpc935-prog is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser
+  GNU General Public License for more details.
+
+  You should have received a copy of the Lesser GNU General Public
+  License along with lpc935-prog; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+  USA
+*/
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef LINUX
+#include <sys/time.h>
+#include <time.h>
+#endif
+#if defined(WINDOWS) || defined(WIN32) ||defined(_WIN32)
+#include <windows.h>
+#endif
+
+#include "ihex.h"
+#include "lpc935.h"
+
+/* Defines for the reset and power down logic */
+#define LN_LO (0)
+#define LN_HI (1)
+#define PWR_OFF LN_HI
+#define PWR_ON  LN_LO
+#define RST_HI LN_LO
+#define RST_LO LN_HI
+
+/* Defines for the Auto baud resync */
+#define BAUD_SYNC_ERR_CNT 8
+#define AUTO_BAUD_CHAR 'U'
+#define AUTO_BAUD_STR "U"
+#define AUTO_BAUD_TIMEOUT 250000
+
+/* Largest BRG rate error allowed in 1/1000 when escalating the baud rate */
+#define BAUD_MAX_ERROR 20
+
+/* Default reply timeouts in microseconds */
+#define CMD_TIMEOUT  1000000
+#define PROG_TIMEOUT 2000000
+
+/* Finds the next program record at or after zAddr of a source image, see
+   lpc_NextRecord, and copies its data to pbData unless that is NULL.
+   Returns the record address, with its length in *pzLen, or -1 if there
+   are no more records */
+typedef int (*tfNextRecord)( const void *pvSrc, int zAddr, int zMaxLen, int *pzLen,
+                             unsigned char *pbData );
+
+/* A flat image for lpc_NextFlatRecord */
+typedef struct
+{
+    const unsigned char *pabRom; /**< Image of the flash */
+    const unsigned char *pabUsed; /**< Non zero for the bytes the image defines, NULL for all */
+    int zLast; /**< Highest address to send */
+} tsFlatSource;
+
+/* A program record that has been sent but not yet acknowledged */
+typedef struct
+{
+    int zUsed; /**< Set while the slot holds a record waiting for its reply */
+    unsigned short wAddr; /**< Flash address of the record, echoed back in the reply */
+    unsigned char bLen; /**< Data bytes in the record */
+    int zTxLen; /**< Characters in the record, the length of its echo */
+    long long llSent; /**< When the write of the record started */
+    long long llWritten; /**< When the write returned */
+    long long llEcho; /**< When the whole echo had arrived, 0 until then */
+} tsInFlight;
+
+static int lpc_PlaceInBootLoaderMode( tsLpcCtx *psCtx );
+static long lpc_OscFreq( tsLpcCtx *psCtx, unsigned char bUcfg1 );
+static int lpc_SetTargetBaud( tsLpcCtx *psCtx, unsigned short wBrgr, int zNewBaud );
+static int lpc_EscalateBaud( tsLpcCtx *psCtx );
+static int lpc_AckRecord( tsLpcCtx *psCtx, tsInFlight asWin[], int zWindow, char *pacLine,
+                          long long llNow );
+static void lpc_EchoDone( tsInFlight asWin[], int zWindow, int zPartial, long long llNow );
+static int lpc_SentAhead( const tsInFlight asWin[], int zWindow );
+static int lpc_RxdAny( void *pvBuf, int zLen );
+static int lpc_BuildTx( tsTxImage *psTx, tfNextRecord fNext, const void *pvSrc, int zFirst,
+                        int zRecSize );
+static int lpc_NextFlatRecord( const void *pvSrc, int zAddr, int zMaxLen, int *pzLen,
+                               unsigned char *pbData );
+static int lpc_NextImgRecord( const void *pvSrc, int zAddr, int zMaxLen, int *pzLen,
+                              unsigned char *pbData );
+
+
+/**
+   Fill in a context with the defaults, 4800 baud through the serial
+   programmer with stop and wait programming.
+ */
+void lpc_Init( tsLpcCtx *psCtx )
+{
+    memset( psCtx, 0, sizeof( *psCtx ));
+    psCtx->zBaud = 4800;
+    psCtx->zIsSerProg = 1;
+    psCtx->zTimeout = CMD_TIMEOUT;
+    psCtx->zProgTimeout = PROG_TIMEOUT;
+    psCtx->zProgWindow = 1;
+    psCtx->zRxBuffer = LPC_RX_BUFFER;
+}
+
+
+/**
+   Open the port named in pacPort at the context baud rate.
+   Returns 0 on success or -1 if the port could not be opened.
+ */
+int lpc_Open( tsLpcCtx *psCtx, const char *pacPort )
+{
+    strncpy( psCtx->acPort, pacPort, sizeof( psCtx->acPort ) - 1 );
+    psCtx->acPort[ sizeof( psCtx->acPort ) - 1 ] = '\0';
+
+    if( -1 == ser_Open( &psCtx->sSerPrt, psCtx->acPort, psCtx->zBaud ))
+    {
+        lpc_Log( psCtx, eLOG_ERROR, "Unable to open %s\n", psCtx->acPort );
+        return( -1 );
+    }
+    ser_SetTxGuard( &psCtx->sSerPrt, psCtx->zTxGuard );
+    if( NULL != psCtx->psTrace )
+    {
+        ser_SetTrace( &psCtx->sSerPrt, trc_Chunk, psCtx->psTrace );
+    }
+    psCtx->zOpen = 1;
+
+    return( 0 );
+}
+
+
+/**
+   Close the port if it is open.
+ */
+int lpc_Close( tsLpcCtx *psCtx )
+{
+    if( 0 != psCtx->zOpen )
+    {
+        ser_Close( &psCtx->sSerPrt );
+        psCtx->zOpen = 0;
+    }
+
+    return( 0 );
+}
+
+
+/**
+   Get the micro on an open port ready to take commands.  With the serial
+   programmer the board is powered up into the boot loader, autobauded and
+   moved to a faster rate if zMaxBaud allows.  With the bridge the
+   programmer is asked whether the micro is in ICP mode.
+   Returns 0 on success or -1 if the micro would not enter the boot loader.
+ */
+int lpc_Sync( tsLpcCtx *psCtx )
+{
+    char acIhexStr[ 20 ];
+    char acRply[ 100 ];
+    unsigned char bDat = PROG_ICP_STATE;
+    long long llStart;
+    int zRtnv = 0;
+
+    if( 0 != psCtx->zIsSerProg )
+    {
+        if( 0 == lpc_PlaceInBootLoaderMode( psCtx ))
+        {
+            lpc_Log( psCtx, eLOG_DEBUG, "Micro on %s placed in boot loader mode successfully\n",
+                     psCtx->acPort );
+            if( psCtx->zMaxBaud > psCtx->zBaud )
+            {
+                llStart = lpc_Usec();
+                lpc_EscalateBaud( psCtx );
+                tim_Phase( psCtx->psTiming, eTIM_BAUD, llStart );
+            }
+        }
+        else
+        {
+            zRtnv = -1;
+        }
+    }
+    else if(( 0 > lpc_Command( psCtx, PROG_GET, 0, &bDat, sizeof( bDat ), acIhexStr,
+                               sizeof( acIhexStr ), acRply, sizeof( acRply ))) ||
+            ( 0 == lpc_GetReplyByte( acIhexStr, acRply )))
+    {
+        /* error not in ICP state */
+        lpc_Log( psCtx, eLOG_DEBUG, "Not in ICP mode\n" );
+    }
+
+    return( zRtnv );
+}
+
+
+/**
+   Send one ISP record and collect its reply.
+   Returns the reply length when the boot loader echoed the record and
+   acknowledged it with '.', or -1 if the reply was missing or bad.
+ */
+int lpc_Command( tsLpcCtx *psCtx, unsigned char bRecId, unsigned short wAddr,
+                 unsigned char *pbDat, unsigned char bLen, char *pacTxd, int zTxdSize,
+                 char *pacRxd, int zRxdSize )
+{
+    long long llStart;
+    int zTxLen;
+    int zReplySize;
+    int zRtnv = -1;
+
+    zTxLen = snintel_hex( pacTxd, zTxdSize, bRecId, pbDat, bLen, wAddr );
+    lpc_Log( psCtx, eLOG_DEBUG, "Sending %s\n", pacTxd );
+    memset( pacRxd, 0, zRxdSize );
+    llStart = lpc_Usec();
+    ser_Write( &psCtx->sSerPrt, pacTxd, zTxLen );
+    zReplySize = ser_Read( &psCtx->sSerPrt, pacRxd, zRxdSize - 1, psCtx->zTimeout,
+                           lpc_RxdPacket );
+    tim_Command( psCtx->psTiming, bRecId, llStart );
+    lpc_Log( psCtx, eLOG_DEBUG, "Read %s", pacRxd );
+
+    if(( 0 < zReplySize ) && ( 0 == lpc_ReplyOk( pacTxd, pacRxd )))
+    {
+        zRtnv = zReplySize;
+    }
+
+    return( zRtnv );
+}
+
+
+/**
+   Read one of the misc registers (command 03), bReg is one of GET_xxx.
+   Returns 0 and fills in *pbVal if the read was acknowledged.
+ */
+int lpc_GetReg( tsLpcCtx *psCtx, unsigned char bReg, unsigned char *pbVal )
+{
+    char acIhexStr[ 20 ];
+    char acRply[ 100 ];
+    int zRtnv = -1;
+
+    if( 0 < lpc_Command( psCtx, MISC_READ_FN, 0, &bReg, sizeof( bReg ),
+                         acIhexStr, sizeof( acIhexStr ), acRply, sizeof( acRply )))
+    {
+        *pbVal = lpc_GetReplyByte( acIhexStr, acRply );
+        zRtnv = 0;
+    }
+
+    return( zRtnv );
+}
+
+
+/**
+   Write one of the misc registers (command 02), bReg is one of PUT_xxx.
+   Returns 0 if the write was acknowledged.
+ */
+int lpc_SetReg( tsLpcCtx *psCtx, unsigned char bReg, unsigned char bVal )
+{
+    char acIhexStr[ 20 ];
+    char acRply[ 100 ];
+    unsigned char abDat[ 2 ];
+
+    abDat[ 0 ] = bReg;
+    abDat[ 1 ] = bVal;
+
+    return(( 0 < lpc_Command( psCtx, MISC_WRITE_FN, 0, abDat, sizeof( abDat ), acIhexStr,
+                              sizeof( acIhexStr ), acRply, sizeof( acRply ))) ? 0 : -1 );
+}
+
+
+/**
+   Read the boot loader version string (command 01) into pacVer.
+   Returns 0 if the read was acknowledged.
+ */
+int lpc_GetVersion( tsLpcCtx *psCtx, char *pacVer, int zSize )
+{
+    char acIhexStr[ 20 ];
+    char acRply[ 100 ];
+    int zRtnv = -1;
+
+    if( 0 < lpc_Command( psCtx, READ_VERSION_ID, 0, NULL, 0, acIhexStr, sizeof( acIhexStr ),
+                         acRply, sizeof( acRply )))
+    {
+        /* Drop the echo in front and the status and CR/LF after */
+        acRply[ strlen( acRply ) - 3 ] = '\0';
+        strncpy( pacVer, &acRply[ strlen( acIhexStr )], zSize - 1 );
+        pacVer[ zSize - 1 ] = '\0';
+        zRtnv = 0;
+    }
+
+    return( zRtnv );
+}
+
+
+/**
+   Read the CRC of the sector starting at wSectorAddr.
+   Returns 0 and fills in *plCrc if the read was acknowledged.
+ */
+int lpc_GetSectorCrc( tsLpcCtx *psCtx, unsigned short wSectorAddr, unsigned long *plCrc )
+{
+    char acIhexStr[ 20 ];
+    char acRply[ 100 ];
+    unsigned char bDat;
+    int zRtnv = -1;
+
+    /* The command takes the hi-byte of the sector address */
+    bDat = ( wSectorAddr >> 8 ) & 0xff;
+    if( 0 < lpc_Command( psCtx, READ_SECTOR_CRC, 0, &bDat, sizeof( bDat ),
+                         acIhexStr, sizeof( acIhexStr ), acRply, sizeof( acRply )))
+    {
+        *plCrc = lpc_GetReplyLong( acIhexStr, acRply ) & 0xffffffffUL;
+        zRtnv = 0;
+    }
+
+    return( zRtnv );
+}
+
+
+/**
+   Read the CRC of the whole flash.
+   Returns 0 and fills in *plCrc if the read was acknowledged.
+ */
+int lpc_GetGlobalCrc( tsLpcCtx *psCtx, unsigned long *plCrc )
+{
+    char acIhexStr[ 20 ];
+    char acRply[ 100 ];
+    int zRtnv = -1;
+
+    if( 0 < lpc_Command( psCtx, READ_GLOBAL_CRC, 0, NULL, 0,
+                         acIhexStr, sizeof( acIhexStr ), acRply, sizeof( acRply )))
+    {
+        *plCrc = lpc_GetReplyLong( acIhexStr, acRply ) & 0xffffffffUL;
+        zRtnv = 0;
+    }
+
+    return( zRtnv );
+}
+
+
+/**
+   Erase the page or sector (bType DO_PAGE or DO_SECTOR) holding wAddr.
+   Returns 0 if the boot loader acknowledged the erase.
+ */
+int lpc_Erase( tsLpcCtx *psCtx, unsigned char bType, unsigned short wAddr )
+{
+    char acIhexStr[ 20 ];
+    char acRply[ 100 ];
+    unsigned char abDat[ 3 ];
+
+    abDat[ 0 ] = bType; /* Command */
+    abDat[ 1 ] = ( wAddr >> 8 ) & 0xff; /* Hi-byte */
+    abDat[ 2 ] = wAddr & 0xff; /* Lo-byte */
+
+    return(( 0 < lpc_Command( psCtx, ERASE_SECTOR_PAGE, 0, abDat, sizeof( abDat ), acIhexStr,
+                              sizeof( acIhexStr ), acRply, sizeof( acRply ))) ? 0 : -1 );
+}
+
+
+/**
+   Reset the micro out of the boot loader (command 08).
+   Returns 0 if the boot loader acknowledged the reset.
+ */
+int lpc_Reset( tsLpcCtx *psCtx )
+{
+    char acIhexStr[ 20 ];
+    char acRply[ 100 ];
+
+    return(( 0 < lpc_Command( psCtx, RESET_MCU, 0, NULL, 0, acIhexStr, sizeof( acIhexStr ),
+                              acRply, sizeof( acRply ))) ? 0 : -1 );
+}
+
+
+/**
+   Send every used part of the image from zFirst to zLast as program records
+   of up to zRecSize data bytes, keeping up to zProgWindow records waiting
+   for their reply.  pabUsed marks the bytes the image defines, NULL sends
+   every byte.  Bytes that are not used keep what the flash holds, so erase
+   it first when the gaps must read 0xff.  The status character of each
+   record goes to the log sink as progress.
+   Returns the number of data bytes sent or -2 if a record failed.
+ */
+int lpc_ProgramBuffer( tsLpcCtx *psCtx, const unsigned char *pabRom,
+                       const unsigned char *pabUsed, int zFirst, int zLast )
+{
+    tsTxImage sTx;
+    int zRtnv;
+
+    if( 0 != lpc_BuildTxImage( &sTx, pabRom, pabUsed, zFirst, zLast, psCtx->zRecSize ))
+    {
+        lpc_Log( psCtx, eLOG_ERROR, "No memory for the program records\n" );
+        return( -2 );
+    }
+    zRtnv = lpc_SendTxImage( psCtx, &sTx, zFirst, zLast );
+    lpc_FreeTxImage( &sTx );
+
+    return( zRtnv );
+}
+
+
+/**
+   Encode every program record lpc_NextRecord finds from zFirst to zLast
+   into psTx, before any of them is needed, so that sending them is only
+   writes and reply checks.  zRecSize is the largest record, 0 uses
+   MAX_ISP_RECORD.  Free it with lpc_FreeTxImage.
+   Returns 0, or -1 if there was not enough memory.
+ */
+int lpc_BuildTxImage( tsTxImage *psTx, const unsigned char *pabRom,
+                      const unsigned char *pabUsed, int zFirst, int zLast, int zRecSize )
+{
+    tsFlatSource sSrc;
+
+    sSrc.pabRom = pabRom;
+    sSrc.pabUsed = pabUsed;
+    sSrc.zLast = zLast;
+
+    return( lpc_BuildTx( psTx, lpc_NextFlatRecord, &sSrc, zFirst, zRecSize ));
+}
+
+
+/**
+   Same as lpc_BuildTxImage for the whole of a sparse image.  Records are
+   found from its runs so the time taken follows the bytes the image
+   holds, not the span of addresses.
+   Returns 0, or -1 if there was not enough memory.
+ */
+int lpc_BuildTxImageSparse( tsTxImage *psTx, const tsImg *psImg, int zRecSize )
+{
+    return( lpc_BuildTx( psTx, lpc_NextImgRecord, psImg, 0, zRecSize ));
+}
+
+
+/**
+   Release what lpc_BuildTxImage allocated, psTx is left empty.
+ */
+void lpc_FreeTxImage( tsTxImage *psTx )
+{
+    free( psTx->psRec );
+    free( psTx->pacText );
+    memset( psTx, 0, sizeof( *psTx ));
+}
+
+
+/**
+   Send the records of psTx that start from zFirst to zLast, keeping up to
+   zProgWindow records waiting for their reply.  Records behind the oldest
+   one in flight are only sent while they fit in the zRxBuffer characters
+   the target can hold as it writes flash.  The status character of each
+   record goes to the log sink as progress.  If a record fails the replies
+   of the others in flight are read away before returning.
+   Returns the number of data bytes sent or -2 if a record failed.
+ */
+int lpc_SendTxImage( tsLpcCtx *psCtx, const tsTxImage *psTx, int zFirst, int zLast )
+{
+    tsInFlight asWin[ MAX_PROG_WINDOW ];
+    char acRply[ 1024 ];
+    const tsTxRecord *psRec;
+    int zRec;
+    int zLo;
+    int zHi;
+    int zSent = 0;
+    int zRplySize = 0;
+    int zRead;
+    int zInFlight = 0;
+    int zWindow;
+    int zFailed = 0;
+    char *pacEol;
+    int zLineLen;
+    long long llStart;
+    long long llNow;
+    int i;
+
+    memset( asWin, 0, sizeof( asWin ));
+    llStart = lpc_Usec();
+
+    zWindow = psCtx->zProgWindow;
+    if( zWindow < 1 )
+    {
+        zWindow = 1;
+    }
+    else if( zWindow > MAX_PROG_WINDOW )
+    {
+        zWindow = MAX_PROG_WINDOW;
+    }
+
+    /* The records are in address order, find the first one in range */
+    zLo = 0;
+    zHi = psTx->zRecords;
+    while( zLo < zHi )
+    {
+        zRec = ( zLo + zHi ) / 2;
+        if( psTx->psRec[ zRec ].wAddr < zFirst )
+        {
+            zLo = zRec + 1;
+        }
+        else
+        {
+            zHi = zRec;
+        }
+    }
+    zRec = zLo;
+
+    while(( 0 == zFailed ) &&
+          ((( zRec < psTx->zRecords ) && ( psTx->psRec[ zRec ].wAddr <= zLast )) ||
+           ( 0 < zInFlight )))
+    {
+        /* Keep the window full.  The next record goes out while the boot
+           loader is still echoing and programming the ones before it.  The
+           oldest record is taken in as it is echoed but anything behind it
+           waits in the target's receive buffer while that record is written
+           to flash, and the target drops what does not fit */
+        while(( zRec < psTx->zRecords ) && ( psTx->psRec[ zRec ].wAddr <= zLast ) &&
+              ( zInFlight < zWindow ))
+        {
+            psRec = &psTx->psRec[ zRec ];
+            if(( 0 < zInFlight ) &&
+               ( lpc_SentAhead( asWin, zWindow ) + INTEL_HEX_LEN( psRec->bLen ) >
+                 psCtx->zRxBuffer ))
+            {
+                break;
+            }
+            for( i = 0; 0 != asWin[ i ].zUsed; i++ )
+            {
+                /* Find a free window slot, there is always one here */
+            }
+            asWin[ i ].zUsed = 1;
+            asWin[ i ].wAddr = psRec->wAddr;
+            asWin[ i ].bLen = psRec->bLen;
+            asWin[ i ].zTxLen = INTEL_HEX_LEN( psRec->bLen );
+            asWin[ i ].llEcho = 0;
+            asWin[ i ].llSent = lpc_Usec();
+            zInFlight++;
+
+            if( 0 > ser_Write( &psCtx->sSerPrt, &psTx->pacText[ psRec->lOffset ],
+                               asWin[ i ].zTxLen ))
+            {
+                lpc_Log( psCtx, eLOG_ERROR, "Write of record at 0x%04x failed\n", psRec->wAddr );
+                zFailed = 1;
+                break;
+            }
+            asWin[ i ].llWritten = lpc_Usec();
+            lpc_Log( psCtx, eLOG_DEBUG, "Written: %.*s\n", asWin[ i ].zTxLen,
+                     &psTx->pacText[ psRec->lOffset ] );
+            zSent += psRec->bLen;
+            zRec++;
+        }
+        if(( 0 != zFailed ) || ( 0 == zInFlight ))
+        {
+            break;
+        }
+
+        /* Collect whatever has arrived and hand every complete reply line
+           back to the record that caused it */
+        zRead = ser_Read( &psCtx->sSerPrt, acRply + zRplySize, sizeof( acRply ) - zRplySize - 1,
+                          psCtx->zProgTimeout, lpc_RxdAny );
+        if( 0 >= zRead )
+        {
+            for( i = 0; i < zWindow; i++ )
+            {
+                if( 0 != asWin[ i ].zUsed )
+                {
+                    lpc_Log( psCtx, eLOG_ERROR, "\nNo reply for record at 0x%04x\n",
+                             asWin[ i ].wAddr );
+                }
+            }
+            zFailed = 1;
+            break;
+        }
+        zRplySize += zRead;
+        acRply[ zRplySize ] = 0;
+        llNow = lpc_Usec();
+
+        while( NULL != ( pacEol = memchr( acRply, '\n', zRplySize )))
+        {
+            zLineLen = pacEol - acRply + 1;
+            *pacEol = 0;
+            lpc_Log( psCtx, eLOG_DEBUG, "Read:    %s\n", acRply );
+            if( 0 != lpc_AckRecord( psCtx, asWin, zWindow, acRply, llNow ))
+            {
+                zFailed = 1;
+            }
+            else
+            {
+                zInFlight--;
+            }
+            zRplySize -= zLineLen;
+            memmove( acRply, acRply + zLineLen, zRplySize );
+        }
+
+        /* Replies come back in order so a part line is the echo of the
+           oldest record still in flight */
+        if( 0 < zRplySize )
+        {
+            lpc_EchoDone( asWin, zWindow, zRplySize, llNow );
+        }
+
+        if( zRplySize >= ( int )sizeof( acRply ) - 1 )
+        {
+            lpc_Log( psCtx, eLOG_ERROR, "\nReply too long, lost framing\n" );
+            zFailed = 1;
+        }
+    }
+    lpc_Log( psCtx, eLOG_PROGRESS, "\n" );
+
+    if(( 0 != zFailed ) && ( 0 < zInFlight ))
+    {
+        /* The records still in flight are echoed and acknowledged as they
+           are written.  Read their replies away until the line goes quiet,
+           so the next command does not take them for its own */
+        lpc_Log( psCtx, eLOG_DEBUG, "Draining the replies of %d records\n", zInFlight );
+        llNow = lpc_Usec() + ( long long )( zInFlight + 1 ) * psCtx->zProgTimeout;
+        while(( lpc_Usec() < llNow ) &&
+              ( 0 < ser_Read( &psCtx->sSerPrt, acRply, sizeof( acRply ) - 1,
+                              psCtx->zProgTimeout, lpc_RxdAny )))
+        {
+            /* Nothing to do with them */
+        }
+        ser_FlushRx( &psCtx->sSerPrt );
+    }
+
+    tim_Phase( psCtx->psTiming, eTIM_PROGRAM, llStart );
+    if(( NULL != psCtx->psTiming ) && ( 0 == zFailed ))
+    {
+        psCtx->psTiming->llProgBytes += zSent;
+    }
+
+    return(( 0 == zFailed ) ? zSent : -2 );
+}
+
+
+/**
+   Find the next program record at or after zAddr.  The record starts at
+   the first byte the hex file defined, holds at most zMaxLen bytes, never
+   crosses a flash page and stops at the last defined byte it covers.
+   Erased flash already reads 0xff so bytes that are only padding do not
+   need to be sent.  A NULL pabUsed treats every byte as defined.
+   Returns the record address, with its length in *pzLen, or zLast + 1 if
+   there are no more records.
+ */
+int lpc_NextRecord( const unsigned char *pabUsed, int zAddr, int zLast, int zMaxLen,
+                    int *pzLen )
+{
+    int zEnd;
+
+    while(( NULL != pabUsed ) && ( zAddr <= zLast ) && ( 0 == pabUsed[ zAddr ] ))
+    {
+        zAddr++;
+    }
+
+    if( zAddr <= zLast )
+    {
+        zEnd = zAddr + zMaxLen;
+        if( zEnd > ( zAddr | ( FLASH_PAGE_SIZE - 1 )) + 1 )
+        {
+            zEnd = ( zAddr | ( FLASH_PAGE_SIZE - 1 )) + 1;
+        }
+        if( zEnd > zLast + 1 )
+        {
+            zEnd = zLast + 1;
+        }
+        while(( NULL != pabUsed ) && ( 0 == pabUsed[ zEnd - 1 ] ))
+        {
+            zEnd--;
+        }
+        *pzLen = zEnd - zAddr;
+    }
+
+    return( zAddr );
+}
+
+
+/**
+   Returns 0 if pacRxd is the echo of pacTxd acknowledged with '.'
+ */
+int lpc_ReplyOk( char *pacTxd, char *pacRxd )
+{
+    int zRtnv = -1;
+
+    if(( 3 <= strlen( pacRxd )) &&
+       ( '.' == *( pacRxd + strlen( pacRxd ) - 3 )) &&
+       ( 0 == strncasecmp( pacTxd, pacRxd, strlen( pacTxd ))))
+    {
+        zRtnv = 0;
+    }
+
+    return( zRtnv );
+}
+
+
+/**
+   Returns the byte that follows the echo in an acknowledged reply or 0
+ */
+unsigned char lpc_GetReplyByte( char *pacTxd, char *pacRxd )
+{
+    unsigned char bRplyByte = 0;
+    char *pacRply;
+
+    if(( 0 < strlen( pacRxd )) &&
+       ( '.' == *( pacRxd + strlen( pacRxd ) - 3 )) &&
+       ( 0 == strncasecmp( pacTxd, pacRxd, strlen( pacTxd ))))
+    {
+        /* Received reply and the replay was OK */
+        pacRply = pacRxd + strlen( pacTxd );
+        bRplyByte = nibble( *( pacRply )) << 4;
+        bRplyByte |= nibble( *( pacRply + 1 ));
+    }
+
+    return( bRplyByte );
+}
+
+
+/**
+   Returns the 16 bit value that follows the echo in an acknowledged reply
+   or 0xbad0
+ */
+unsigned short lpc_GetReplyShort( char *pacTxd, char *pacRxd )
+{
+    unsigned short lRplyShort = 0xbad0;
+    char *pacRply;
+    int i;
+
+    if(( 0 < strlen( pacRxd )) &&
+       ( '.' == *( pacRxd + strlen( pacRxd ) - 3 )) &&
+       ( 0 == strncasecmp( pacTxd, pacRxd, strlen( pacTxd ))))
+    {
+        pacRply = pacRxd + strlen( pacTxd );
+        for( i = 0; i < 4; i++ )
+        {
+            lRplyShort <<= 4;
+            lRplyShort |= nibble( *( pacRply + i ));
+        }
+    }
+
+    return( lRplyShort );
+}
+
+
+/**
+   Returns the 32 bit value that follows the echo in an acknowledged reply
+   or 0xbad0bad0
+ */
+unsigned long lpc_GetReplyLong( char *pacTxd, char *pacRxd )
+{
+    unsigned long lRplyLong = 0xbad0bad0;
+    char *pacRply;
+    int i;
+
+    if(( 0 < strlen( pacRxd )) &&
+       ( '.' == *( pacRxd + strlen( pacRxd ) - 3 )) &&
+       ( 0 == strncasecmp( pacTxd, pacRxd, strlen( pacTxd ))))
+    {
+        pacRply = pacRxd + strlen( pacTxd );
+        for( i = 0; i < 8; i++ )
+        {
+            lRplyLong <<= 4;
+            lRplyLong |= nibble( *( pacRply + i ));
+        }
+    }
+
+    return( lRplyLong );
+}
+
+
+/**
+   Packet check for ser_Read, happy once a whole reply line has arrived
+ */
+int lpc_RxdPacket( void *pvBuf, int zLen )
+{
+    int zRtnv = -1;
+    char *pacBuf = pvBuf;
+
+    /* from GDB acRply = ":0100000310ec15.\r\n" */
+    if(( zLen > 3 ) && ( ':' == *pacBuf ) &&
+       ( '\n' == *( pacBuf + zLen - 1 )) &&
+       ( '\r' == *( pacBuf + zLen - 2 )))
+    {
+        /* These bits are the same for every packet */
+        zRtnv = 0;
+    }
+
+    return( zRtnv );
+}
+
+
+/**
+   Format a message and hand it to the log sink of the context.  Debug
+   messages are dropped unless zDebug is set.  Without a sink debug,
+   progress and info go to stdout and errors to stderr.
+ */
+void lpc_Log( tsLpcCtx *psCtx, teLOG_LEVEL eLevel, const char *pacFormat, ... )
+{
+    char acMsg[ 2048 ];
+    va_list ap;
+
+    if(( eLOG_DEBUG == eLevel ) && ( 0 == psCtx->zDebug ))
+    {
+        return;
+    }
+
+    va_start( ap, pacFormat );
+    vsnprintf( acMsg, sizeof( acMsg ), pacFormat, ap );
+    va_end( ap );
+
+    if( NULL != psCtx->fLog )
+    {
+        psCtx->fLog( psCtx->pvLogUser, eLevel, acMsg );
+    }
+    else if( eLOG_ERROR == eLevel )
+    {
+        fprintf( stderr, "%s", acMsg );
+    }
+    else
+    {
+        printf( "%s", acMsg );
+        fflush( stdout );
+    }
+}
+
+
+static int lpc_PlaceInBootLoaderMode( tsLpcCtx *psCtx )
+{
+    long long llStart;
+    int zRtnv;
+
+    llStart = lpc_Usec();
+    lpc_EnterBootLoader( psCtx );
+    tim_Phase( psCtx->psTiming, eTIM_ENTRY, llStart );
+
+    llStart = lpc_Usec();
+    zRtnv = lpc_SyncBaud( psCtx );
+    tim_Phase( psCtx->psTiming, eTIM_SYNC, llStart );
+
+    return( zRtnv );
+}
+
+
+/**
+   Power cycle the micro through the serial programmer and pulse reset so
+   it starts in the boot loader.  lpc_SyncBaud must follow.
+ */
+int lpc_EnterBootLoader( tsLpcCtx *psCtx )
+{
+    tsSerialPort *psSerPrt = &psCtx->sSerPrt;
+
+    /*
+      Ok so hardware Activation of the bootloader is to power down the board
+      wait a bit then power up the board with the reset line low and then toggling
+      the reset line three times
+      VDD XXX\_______/--------------------------------- DTR
+      RST XXX_________/-\_/-\_/-\_/-------------------- RTS
+
+      see section Hardware activation of the Boot Loader page 145 of the user manual
+    */
+
+    ser_SetDtrTo( psSerPrt, PWR_OFF ); /* power off */
+    ser_SetRtsTo( psSerPrt, RST_LO ); /* reset low */
+    lpc_Udelay( 1000000 );
+
+    ser_SetDtrTo( psSerPrt, PWR_ON ); /* power up */
+    lpc_Udelay( 100000 );
+    ser_SetRtsTo( psSerPrt, RST_HI ); /* reset hi */
+
+    lpc_Udelay( 16 );
+
+    ser_SetRtsTo( psSerPrt, RST_LO ); /* reset lo 1 */
+    lpc_Udelay( 48 );
+    ser_SetRtsTo( psSerPrt, RST_HI ); /* reset hi */
+
+    lpc_Udelay( 16 );
+
+    ser_SetRtsTo( psSerPrt, RST_LO ); /* reset lo 2 */
+    lpc_Udelay( 48 );
+    ser_SetRtsTo( psSerPrt, RST_HI ); /* reset hi */
+
+    lpc_Udelay( 16 );
+
+    ser_SetRtsTo( psSerPrt, RST_LO ); /* reset lo 3 */
+    lpc_Udelay( 48 );
+    ser_SetRtsTo( psSerPrt, RST_HI ); /* reset hi */
+
+    lpc_Udelay( 100 );
+
+    return( 0 );
+}
+
+
+/**
+   Send the autobaud character until the boot loader echoes it.
+   Returns 0 once the boot loader has locked on to the line rate.
+ */
+int lpc_SyncBaud( tsLpcCtx *psCtx )
+{
+    unsigned char cRply = 0;
+    int zErrCnt = 0;
+    int zRtnv = -1;
+
+    /* Discovered by trial and error and then a big margin for error.
+       It normally takes two goes from Hyperterm so I'll try four times
+       and then error out */
+    while(( cRply != AUTO_BAUD_CHAR ) && ( zErrCnt < BAUD_SYNC_ERR_CNT ))
+    {
+        ser_Write( &psCtx->sSerPrt, AUTO_BAUD_STR, 1 );
+        ser_Read( &psCtx->sSerPrt, &cRply, 1, AUTO_BAUD_TIMEOUT, lpc_RxdPacket );
+        zErrCnt++;
+    }
+    if( NULL != psCtx->psTiming )
+    {
+        psCtx->psTiming->lSyncTries += zErrCnt;
+    }
+
+    if( AUTO_BAUD_CHAR == cRply )
+    {
+        zRtnv = 0;
+    }
+    lpc_Log( psCtx, eLOG_DEBUG, " Received %c - %d - 0x%02x ErrCnt = %d\n", cRply,
+             cRply & 0xff, cRply & 0xff, zErrCnt );
+
+    /* Flush serial buffer */
+    while( ser_RxPoll( &psCtx->sSerPrt ))
+    {
+        ser_Read( &psCtx->sSerPrt, &cRply, 1, AUTO_BAUD_TIMEOUT, lpc_RxdPacket );
+    }
+    return( zRtnv );
+}
+
+
+/*
+  Work out the CPU clock the boot loader is running from using the FOSC
+  bits of UCFG1.  Crystal and external clocks can not be known from the
+  register so these use lOscFreq from the context.
+  Returns the clock in Hz or 0 if it is not known.
+ */
+static long lpc_OscFreq( tsLpcCtx *psCtx, unsigned char bUcfg1 )
+{
+    long lFreq = 0;
+
+    switch( bUcfg1 & ( eFOSC2 | eFOSC1 | eFOSC0 ))
+    {
+      case( 3 ) :
+          lFreq = LPC_IRC_FREQ;
+          break;
+
+      case( 4 ) :
+          lFreq = LPC_WDOSC_FREQ;
+          break;
+
+      case( 7 ) :
+      case( 2 ) :
+      case( 1 ) :
+      case( 0 ) :
+          lFreq = psCtx->lOscFreq;
+          break;
+
+      default :
+          break;
+    }
+
+    return( lFreq );
+}
+
+
+/*
+  Load the baud rate generator of the boot loader directly (command 07)
+  and move the host to the same rate.  The reply still comes back at the
+  old rate.
+ */
+static int lpc_SetTargetBaud( tsLpcCtx *psCtx, unsigned short wBrgr, int zNewBaud )
+{
+    char acIhexStr[ 20 ];
+    char acRply[ 100 ];
+    unsigned char abDat[ 2 ];
+    int zRtnv = -1;
+
+    abDat[ 0 ] = ( wBrgr >> 8 ) & 0xff; /* BRGR1 */
+    abDat[ 1 ] = wBrgr & 0xff; /* BRGR0 */
+
+    lpc_Log( psCtx, eLOG_DEBUG, "Load BRG with 0x%04x for %d baud\n", wBrgr, zNewBaud );
+    if( 0 < lpc_Command( psCtx, DIRECT_LOAD_BAUD_RATE, 0, abDat, sizeof( abDat ),
+                         acIhexStr, sizeof( acIhexStr ), acRply, sizeof( acRply )))
+    {
+        zRtnv = ser_SetBaud( &psCtx->sSerPrt, zNewBaud );
+    }
+
+    return( zRtnv );
+}
+
+
+/*
+  After autobaud has locked move both ends to the fastest standard rate up
+  to zMaxBaud that the oscillator can generate within BAUD_MAX_ERROR.
+  Each candidate must pass a verification read of the manufacture id.  If
+  it does not the host goes back to the original rate, the boot loader is
+  re-entered and the next slower rate is tried.
+  Returns the rate in use when done.
+ */
+static int lpc_EscalateBaud( tsLpcCtx *psCtx )
+{
+    static const int azRates[] = { 460800, 230400, 115200, 57600, 38400, 19200, 9600 };
+    unsigned char bUcfg1;
+    unsigned char bManId;
+    long lFreq;
+    long lDiv;
+    long lActual;
+    int zOrigBaud = psCtx->zBaud;
+    int i;
+
+    if( 0 != lpc_GetReg( psCtx, GET_UCFG1, &bUcfg1 ))
+    {
+        lpc_Log( psCtx, eLOG_DEBUG, "Could not read UCFG1, staying at %d baud\n", psCtx->zBaud );
+        return( psCtx->zBaud );
+    }
+
+    lFreq = lpc_OscFreq( psCtx, bUcfg1 );
+    if( 0 == lFreq )
+    {
+        lpc_Log( psCtx, eLOG_INFO,
+                 "Oscillator frequency unknown, use --osc to allow baud changes\n" );
+        return( psCtx->zBaud );
+    }
+
+    for( i = 0; i < sizeof( azRates ) / sizeof( azRates[ 0 ]); i++ )
+    {
+        if(( azRates[ i ] > psCtx->zMaxBaud ) || ( azRates[ i ] <= zOrigBaud ))
+        {
+            continue;
+        }
+
+        /* BRG rate is CCLK / ( BRGR + 16 ) */
+        lDiv = ( lFreq + azRates[ i ] / 2 ) / azRates[ i ];
+        if(( lDiv < 16 ) || ( lDiv > 0xffff + 16 ))
+        {
+            continue;
+        }
+        lActual = lFreq / lDiv;
+        if( labs( lActual - azRates[ i ]) * 1000 > azRates[ i ] * BAUD_MAX_ERROR )
+        {
+            continue;
+        }
+
+        if(( 0 == lpc_SetTargetBaud( psCtx, lDiv - 16, azRates[ i ])) &&
+           ( 0 == lpc_GetReg( psCtx, GET_MANID, &bManId )))
+        {
+            psCtx->zBaud = azRates[ i ];
+            lpc_Log( psCtx, eLOG_INFO, "Switched to %d baud\n", psCtx->zBaud );
+            break;
+        }
+
+        /* Did not work so go back to where we started from */
+        lpc_Log( psCtx, eLOG_DEBUG, "Verify at %d baud failed, falling back to %d\n",
+                 azRates[ i ], zOrigBaud );
+        ser_SetBaud( &psCtx->sSerPrt, zOrigBaud );
+        if( 0 != lpc_PlaceInBootLoaderMode( psCtx ))
+        {
+            lpc_Log( psCtx, eLOG_ERROR, "Failed to re-enter bootloader at %d baud\n",
+                     zOrigBaud );
+            break;
+        }
+    }
+
+    return( psCtx->zBaud );
+}
+
+
+/*
+  Match one reply line against the records in flight and release its slot.
+  The stage times of the record are handed to the timing, the echo is
+  taken as done now if it was not seen to finish before the status.
+  Returns 0 if the record was acknowledged with '.' or -1 on error.
+ */
+static int lpc_AckRecord( tsLpcCtx *psCtx, tsInFlight asWin[], int zWindow, char *pacLine,
+                          long long llNow )
+{
+    tsTimRecord sRec;
+    char *pacRec;
+    unsigned short wAddr;
+    char cStatus;
+    int zRtnv = -1;
+    int i;
+
+    /* Skip any noise in front of the echoed record */
+    pacRec = strchr( pacLine, ':' );
+    if(( NULL == pacRec ) || ( strlen( pacRec ) < 11 ))
+    {
+        lpc_Log( psCtx, eLOG_ERROR, "\nUnrecognised reply: %s\n", pacLine );
+        return( -1 );
+    }
+
+    wAddr = ( nibble( pacRec[ 3 ]) << 12 ) | ( nibble( pacRec[ 4 ]) << 8 ) |
+        ( nibble( pacRec[ 5 ]) << 4 ) | nibble( pacRec[ 6 ]);
+    cStatus = pacLine[ strlen( pacLine ) - 2 ];
+
+    for( i = 0; i < zWindow; i++ )
+    {
+        if(( 0 != asWin[ i ].zUsed ) && ( wAddr == asWin[ i ].wAddr ))
+        {
+            break;
+        }
+    }
+
+    if( i == zWindow )
+    {
+        lpc_Log( psCtx, eLOG_ERROR, "\nReply for unknown record at 0x%04x: %s\n",
+                 wAddr, pacLine );
+    }
+    else
+    {
+        asWin[ i ].zUsed = 0;
+        tim_Command( psCtx->psTiming, PROGRAM_DATA, asWin[ i ].llSent );
+        if( NULL != psCtx->psTiming )
+        {
+            if( 0 == asWin[ i ].llEcho )
+            {
+                asWin[ i ].llEcho = llNow;
+            }
+            sRec.wAddr = wAddr;
+            sRec.bLen = asWin[ i ].bLen;
+            sRec.allStage[ eTIM_SEND ] = asWin[ i ].llWritten - asWin[ i ].llSent;
+            sRec.allStage[ eTIM_ECHO ] = asWin[ i ].llEcho - asWin[ i ].llWritten;
+            sRec.allStage[ eTIM_FLASH ] = llNow - asWin[ i ].llEcho;
+            sRec.allStage[ eTIM_ACK ] = llNow - asWin[ i ].llSent;
+            tim_Record( psCtx->psTiming, &sRec );
+        }
+        lpc_Log( psCtx, eLOG_PROGRESS, "%c", cStatus );
+
+        if( '.' == cStatus )
+        {
+            zRtnv = 0;
+        }
+        else
+        {
+            lpc_Log( psCtx, eLOG_ERROR, "\nRecord at 0x%04x failed with status '%c'\n",
+                     wAddr, cStatus );
+        }
+    }
+
+    return( zRtnv );
+}
+
+
+/*
+  Mark the echo of the oldest record in flight as done once zPartial
+  characters of its reply line, at least its own length, have arrived.
+ */
+static void lpc_EchoDone( tsInFlight asWin[], int zWindow, int zPartial, long long llNow )
+{
+    int zOldest = -1;
+    int i;
+
+    for( i = 0; i < zWindow; i++ )
+    {
+        if(( 0 != asWin[ i ].zUsed ) &&
+           (( 0 > zOldest ) || ( asWin[ i ].llSent < asWin[ zOldest ].llSent )))
+        {
+            zOldest = i;
+        }
+    }
+
+    if(( 0 <= zOldest ) && ( 0 == asWin[ zOldest ].llEcho ) &&
+       ( zPartial >= asWin[ zOldest ].zTxLen ))
+    {
+        asWin[ zOldest ].llEcho = llNow;
+    }
+}
+
+
+/*
+  Characters of the records in flight behind the oldest one, which are
+  waiting in the target's receive buffer while it writes flash.
+ */
+static int lpc_SentAhead( const tsInFlight asWin[], int zWindow )
+{
+    int zOldest = -1;
+    int zAhead = 0;
+    int i;
+
+    for( i = 0; i < zWindow; i++ )
+    {
+        if( 0 != asWin[ i ].zUsed )
+        {
+            zAhead += asWin[ i ].zTxLen;
+            if(( 0 > zOldest ) || ( asWin[ i ].llSent < asWin[ zOldest ].llSent ))
+            {
+                zOldest = i;
+            }
+        }
+    }
+
+    return(( 0 > zOldest ) ? 0 : zAhead - asWin[ zOldest ].zTxLen );
+}
+
+
+/*
+  Encode the records fNext finds in pvSrc from zFirst on into psTx, for
+  lpc_BuildTxImage and lpc_BuildTxImageSparse.  The records are counted
+  first so the records and their text are one allocation each.
+  Returns 0, or -1 if there was not enough memory.
+ */
+static int lpc_BuildTx( tsTxImage *psTx, tfNextRecord fNext, const void *pvSrc, int zFirst,
+                        int zRecSize )
+{
+    unsigned char abRec[ MAX_ISP_RECORD ];
+    tsTxRecord *psRec;
+    int zAddr;
+    int zLen = 0;
+
+    memset( psTx, 0, sizeof( *psTx ));
+    if(( zRecSize <= 0 ) || ( zRecSize > MAX_ISP_RECORD ))
+    {
+        zRecSize = MAX_ISP_RECORD;
+    }
+    psTx->zRecSize = zRecSize;
+
+    for( zAddr = fNext( pvSrc, zFirst, zRecSize, &zLen, NULL ); 0 <= zAddr;
+         zAddr = fNext( pvSrc, zAddr + zLen, zRecSize, &zLen, NULL ))
+    {
+        psTx->zRecords++;
+        psTx->lTextLen += INTEL_HEX_LEN( zLen );
+    }
+    if( 0 == psTx->zRecords )
+    {
+        return( 0 );
+    }
+
+    psTx->psRec = malloc( psTx->zRecords * sizeof( tsTxRecord ));
+    psTx->pacText = malloc( psTx->lTextLen );
+    if(( NULL == psTx->psRec ) || ( NULL == psTx->pacText ))
+    {
+        lpc_FreeTxImage( psTx );
+        return( -1 );
+    }
+
+    psRec = psTx->psRec;
+    psTx->lTextLen = 0;
+    for( zAddr = fNext( pvSrc, zFirst, zRecSize, &zLen, abRec ); 0 <= zAddr;
+         zAddr = fNext( pvSrc, zAddr + zLen, zRecSize, &zLen, abRec ))
+    {
+        psRec->lOffset = psTx->lTextLen;
+        psRec->wAddr = zAddr;
+        psRec->bLen = zLen;
+        psTx->lTextLen += put_intel_hex( &psTx->pacText[ psTx->lTextLen ], PROGRAM_DATA,
+                                         abRec, zLen, zAddr );
+        psTx->zDataBytes += zLen;
+        psRec++;
+    }
+
+    return( 0 );
+}
+
+
+/*
+  lpc_NextRecord over a flat image as a tfNextRecord
+ */
+static int lpc_NextFlatRecord( const void *pvSrc, int zAddr, int zMaxLen, int *pzLen,
+                               unsigned char *pbData )
+{
+    const tsFlatSource *psSrc = pvSrc;
+
+    zAddr = lpc_NextRecord( psSrc->pabUsed, zAddr, psSrc->zLast, zMaxLen, pzLen );
+    if( zAddr > psSrc->zLast )
+    {
+        return( -1 );
+    }
+    if( NULL != pbData )
+    {
+        memcpy( pbData, &psSrc->pabRom[ zAddr ], *pzLen );
+    }
+
+    return( zAddr );
+}
+
+
+/*
+  lpc_NextRecord over the runs of a sparse image as a tfNextRecord.  A
+  record may cover a gap between runs in the same page, the gap is sent
+  as 0xff.
+ */
+static int lpc_NextImgRecord( const void *pvSrc, int zAddr, int zMaxLen, int *pzLen,
+                              unsigned char *pbData )
+{
+    const tsImg *psImg = pvSrc;
+    const tsImgSeg *psSeg;
+    int zEnd;
+    int i;
+
+    i = img_Find( psImg, zAddr );
+    if( i >= psImg->zSegs )
+    {
+        return( -1 );
+    }
+    if( psImg->psSeg[ i ].lAddr > zAddr )
+    {
+        zAddr = psImg->psSeg[ i ].lAddr;
+    }
+
+    zEnd = zAddr + zMaxLen;
+    if( zEnd > ( zAddr | ( FLASH_PAGE_SIZE - 1 )) + 1 )
+    {
+        zEnd = ( zAddr | ( FLASH_PAGE_SIZE - 1 )) + 1;
+    }
+
+    /* Stop at the last defined byte before zEnd */
+    while(( i + 1 < psImg->zSegs ) && ( psImg->psSeg[ i + 1 ].lAddr < zEnd ))
+    {
+        i++;
+    }
+    psSeg = &psImg->psSeg[ i ];
+    if( zEnd > psSeg->lAddr + psSeg->lLen )
+    {
+        zEnd = psSeg->lAddr + psSeg->lLen;
+    }
+    *pzLen = zEnd - zAddr;
+    if( NULL != pbData )
+    {
+        img_Read( psImg, zAddr, pbData, *pzLen );
+    }
+
+    return( zAddr );
+}
+
+
+/*
+  Packet check that is happy as soon as anything has been received
+ */
+static int lpc_RxdAny( void *pvBuf, int zLen )
+{
+    return(( zLen > 0 ) ? 0 : -1 );
+}
+
+
+#if defined(WINDOWS) || defined(WIN32) ||defined(_WIN32)
+void lpc_Udelay( unsigned int uS )
+{
+    LARGE_INTEGER llPerfCount;
+    LONGLONG llPerfCount2;
+    LONGLONG llCurUsec;
+    LONGLONG llDestUsec;
+    LARGE_INTEGER llPerfFreq;
+    LONGLONG llPerfFreq2;
+
+    /* Frequency of the high-resolution performance counter, it is fixed
+       at boot so asking each time costs little and needs no shared state */
+    QueryPerformanceFrequency( &llPerfFreq );
+    llPerfFreq2 = *(LONGLONG *) &llPerfFreq;
+
+    /* Get current value of high-resolution performance counter */
+    QueryPerformanceCounter( &llPerfCount );
+    llPerfCount2 = *(LONGLONG *)&llPerfCount;
+
+    /* Calculate the finish time in uSeconds */
+    llDestUsec = (( llPerfCount2 * (LONGLONG) 1000000 ) / llPerfFreq2 ) + (LONGLONG) uS;
+    /*debug_printf( "uS = %d\n", uS );
+    debug_printf( "llPerfCount2 = %lu\n", llPerfCount2 );*/
+
+
+    do 
+    {
+         /* Get current value of high-resolution performance
+            counter */
+         QueryPerformanceCounter( &llPerfCount );
+         llPerfCount2 = *(LONGLONG *) &llPerfCount;
+
+         /* Calculate current count in uSeconds */
+         llCurUsec = ( llPerfCount2 * (LONGLONG) 1000000 / llPerfFreq2 );
+    } while( llCurUsec < llDestUsec );
+}
+
+
+/**
+   Monotonic time in microseconds for timing phases of a session
+ */
+long long lpc_Usec( void )
+{
+    LARGE_INTEGER llPerfCount;
+    LARGE_INTEGER llPerfFreq;
+
+    QueryPerformanceFrequency( &llPerfFreq );
+    QueryPerformanceCounter( &llPerfCount );
+
+    return(( long long )( llPerfCount.QuadPart * 1000000LL / llPerfFreq.QuadPart ));
+}
+#endif
+
+#ifdef LINUX
+/**
+   Monotonic time in microseconds for timing phases of a session
+ */
+long long lpc_Usec( void )
+{
+    struct timespec sTs;
+
+    clock_gettime( CLOCK_MONOTONIC, &sTs );
+
+    return(( long long )sTs.tv_sec * 1000000LL + sTs.tv_nsec / 1000 );
+}
+
+
+void lpc_Udelay( unsigned int uS )
+{
+    struct timeval sTv;
+    unsigned long lCurUsec;
+    unsigned long lOldUsec;
+
+    gettimeofday( &sTv, 0 );
+    lOldUsec = (sTv.tv_sec * 1000000 ) + sTv.tv_usec;
+    do
+    {        
+        gettimeofday( &sTv, 0 );
+        lCurUsec = (sTv.tv_sec * 1000000 ) + sTv.tv_usec;
+    } while(( lCurUsec - lOldUsec ) < uS );
+    /* debug_printf( "cur %lu, old %lu, cur - old = %lu\n", lCurUsec, lOldUsec,
+       lCurUsec - lOldUsec ); */
+}
+#endif
@@ -0,0 +1,231 @@
+/*
+  File:         lpc935.h
+  Written by:   Rod Boyce
+  e-mail:       rod@boyce.net.nz
+
+  This file is part of lpc935-prog
+
+  lpc935-prog is free software; you can redistribute it and/or modify
+  it under the terms of the Lesser GNU General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  lpc935-prog is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser
+  GNU General Public License for more details.
+
+  You should have received a copy of the Lesser GNU General Public
+  License along with lpc935-prog; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+  USA
+*/
+#ifndef LPC935_H
+#define LPC935_H
+
+/* serial.h needs the system types of the port handle */
+#ifdef LINUX
+#include <termios.h>
+#endif
+#if defined(WINDOWS) || defined(WIN32) ||defined(_WIN32)
+#include <windows.h>
+#endif
+#include "serial.h"
+#include "timing.h"
+#include "trace.h"
+#include "image.h"
+
+/* Flash layout of the LPC935 */
+#define FLASH_PAGE_SIZE 64
+/* Largest program record, the boot loader programs at most a page at a time */
+#define MAX_ISP_RECORD FLASH_PAGE_SIZE
+
+/* Maximum number of program records that may be waiting for an ACK */
+#define MAX_PROG_WINDOW 16
+/* Characters the LPC935 UART holds while the boot loader is writing flash.
+   The receiver is only double buffered so one character is safe */
+#define LPC_RX_BUFFER 1
+
+/* Oscillators the boot loader can run from without a crystal */
+#define LPC_IRC_FREQ   7372800L /* Internal RC oscillator */
+#define LPC_WDOSC_FREQ 400000L /* Watchdog oscillator */
+
+/* Defines from the user manual for the LPC935 From Table 19-2 page 147 */
+
+/* Record types */
+/* 00 Program used program code memory */
+#define PROGRAM_DATA 0x00
+/* 01 Read version ID */
+#define READ_VERSION_ID 0x01
+/* 02 Misc write functions */
+#define MISC_WRITE_FN 0x02
+#define PUT_UCFG1 0x00
+#define PUT_BOOTV 0x02
+#define PUT_STATB 0x03
+#define PUT_SECB0 0x08
+#define PUT_SECB1 0x09
+#define PUT_SECB2 0x0a
+#define PUT_SECB3 0x0b
+#define PUT_SECB4 0x0c
+#define PUT_SECB5 0x0d
+#define PUT_SECB6 0x0e
+#define PUT_SECB7 0x0f
+/* #define PUT_CCP   0x10 This is a guess based on an error in the manual */
+/* 03 Misc read functions */
+#define MISC_READ_FN 0x03
+#define GET_UCFG1 0x00
+#define GET_BOOTV 0x02
+#define GET_STATB 0x03
+#define GET_SECB0 0x08
+#define GET_SECB1 0x09
+#define GET_SECB2 0x0a
+#define GET_SECB3 0x0b
+#define GET_SECB4 0x0c
+#define GET_SECB5 0x0d
+#define GET_SECB6 0x0e
+#define GET_SECB7 0x0f
+#define GET_MANID 0x10
+#define GET_DEVID 0x11
+#define GET_DERID 0x12
+/* 04 Erase sector page */
+#define ERASE_SECTOR_PAGE 0x04
+#define DO_PAGE   0x00
+#define DO_SECTOR 0x01
+/* 05 Read sector CRC */
+#define READ_SECTOR_CRC 0x05
+/* 06 Read global CRC */
+#define READ_GLOBAL_CRC 0x06
+/* 07 Direct load of baud rate */
+#define DIRECT_LOAD_BAUD_RATE 0x07
+/* 08 Reset MCU */
+#define RESET_MCU 0x08
+
+/* 10 programmer read */
+#define PROG_GET 0x0a
+/* 08 programmer write */
+#define PROG_SET 0x0b
+/* programer get and set sub commands */
+#define PROG_PWR_OFF_TIME 0
+#define PROG_ICP_STATE    1
+
+typedef enum
+{
+    eWDTE = 0x80,  /**< Watchdog time enable */
+    eRPE = 0x40, /**< Reset pin enable */
+    eBOE = 0x20, /**< Brownout detect enable */
+    eWDSE = 0x10, /**< Watchdog Safely enable bit */
+    eFOSC2 = 0x04, /**< Oscillator configuration bit 2 */
+    eFOSC1 = 0x02, /**< Oscillator configuration bit 1 */
+    eFOSC0 = 0x01 /**< Oscillator configuration bit 0 */
+} teUCFG1_BITS;
+
+typedef enum
+{
+    eEDISx = 0x04, /**< Disable the ability to erase the sector prtected by this register  */
+    eSPEDISx = 0x02, /**< Disable the ability to program or erase this sector */
+    eMOVCDISx = 0x01 /**< Disable the movc instruction for this sector */
+} teSECx;
+
+typedef enum
+{
+    eDCCP = 0x80, /**< Disable Clear Configuration Protection command */
+    eCWP = 0x40, /**< Configuration Write protect bit. */
+    eAWP = 0x20, /**< Activate Write protect bit. */
+    eBSB = 0x01 /**< Boot Status Bit. */
+} teBOOTSTAT;
+
+/* Kinds of message handed to the log sink */
+typedef enum
+{
+    eLOG_DEBUG, /**< Protocol trace, only produced when zDebug is set */
+    eLOG_PROGRESS, /**< Status character of each program record, no new line */
+    eLOG_INFO, /**< Something the user should see */
+    eLOG_ERROR /**< Something went wrong */
+} teLOG_LEVEL;
+
+typedef void (*tfLpcLog)( void *pvUser, teLOG_LEVEL eLevel, const char *pacMsg );
+
+/* Everything needed to talk to one micro.  Fill it in with lpc_Init and
+   change what is needed before lpc_Open.  Contexts share nothing and the
+   library keeps no writable globals, so each one may be driven from its
+   own thread as long as no two threads use the same context. */
+typedef struct
+{
+    tsSerialPort sSerPrt; /**< The open port */
+    char acPort[ 256 ]; /**< Name of the port */
+    int zOpen; /**< Set while the port is open */
+    int zBaud; /**< Rate in use, updated when the rate is escalated */
+    int zIsSerProg; /**< 1 for the serial programmer, 0 for the bridge */
+    int zTxGuard; /**< Fixed delay in microseconds after each transmit */
+    int zTimeout; /**< Microseconds to wait for the reply to a command */
+    int zProgTimeout; /**< Microseconds to wait for the next program reply */
+    int zProgWindow; /**< Program records in flight at once, 1 is stop and wait */
+    int zRxBuffer; /**< Characters the target holds while it writes flash, bounds the window */
+    int zRecSize; /**< Data bytes per program record, 0 uses the largest allowed */
+    int zMaxBaud; /**< Fastest rate to switch to after autobaud, 0 stays put */
+    long lOscFreq; /**< Crystal frequency for the rate escalation, 0 if unknown */
+    int zDebug; /**< If set the protocol is traced to the log sink */
+    tfLpcLog fLog; /**< Log sink, NULL prints to stdout and stderr */
+    void *pvLogUser; /**< Handed back to the log sink */
+    tsTiming *psTiming; /**< Phase and command times are added here, NULL for none */
+    tsTrace *psTrace; /**< Every chunk on the wire is written here, NULL for none */
+} tsLpcCtx;
+
+/* One program record of a transmit image */
+typedef struct
+{
+    unsigned int lOffset; /**< Where the text of the record starts in pacText */
+    unsigned short wAddr; /**< Flash address of the first data byte */
+    unsigned char bLen; /**< Data bytes, the text is INTEL_HEX_LEN( bLen ) long */
+} tsTxRecord;
+
+/* Every program record of an image encoded ahead of time, in address
+   order, with the text of all the records back to back in one buffer */
+typedef struct
+{
+    tsTxRecord *psRec; /**< The records, NULL if there are none */
+    int zRecords; /**< Number of records */
+    char *pacText; /**< Text of every record, no separators or nulls */
+    unsigned int lTextLen; /**< Characters in pacText */
+    int zRecSize; /**< Largest record it was built with */
+    int zDataBytes; /**< Data bytes over all the records */
+} tsTxImage;
+
+void lpc_Init( tsLpcCtx *psCtx );
+int lpc_Open( tsLpcCtx *psCtx, const char *pacPort );
+int lpc_Close( tsLpcCtx *psCtx );
+int lpc_Sync( tsLpcCtx *psCtx );
+int lpc_EnterBootLoader( tsLpcCtx *psCtx );
+int lpc_SyncBaud( tsLpcCtx *psCtx );
+
+int lpc_Command( tsLpcCtx *psCtx, unsigned char bRecId, unsigned short wAddr,
+                 unsigned char *pbDat, unsigned char bLen, char *pacTxd, int zTxdSize,
+                 char *pacRxd, int zRxdSize );
+int lpc_GetReg( tsLpcCtx *psCtx, unsigned char bReg, unsigned char *pbVal );
+int lpc_SetReg( tsLpcCtx *psCtx, unsigned char bReg, unsigned char bVal );
+int lpc_GetVersion( tsLpcCtx *psCtx, char *pacVer, int zSize );
+int lpc_GetSectorCrc( tsLpcCtx *psCtx, unsigned short wSectorAddr, unsigned long *plCrc );
+int lpc_GetGlobalCrc( tsLpcCtx *psCtx, unsigned long *plCrc );
+int lpc_Erase( tsLpcCtx *psCtx, unsigned char bType, unsigned short wAddr );
+int lpc_Reset( tsLpcCtx *psCtx );
+int lpc_ProgramBuffer( tsLpcCtx *psCtx, const unsigned char *pabRom,
+                       const unsigned char *pabUsed, int zFirst, int zLast );
+int lpc_BuildTxImage( tsTxImage *psTx, const unsigned char *pabRom,
+                      const unsigned char *pabUsed, int zFirst, int zLast, int zRecSize );
+int lpc_BuildTxImageSparse( tsTxImage *psTx, const tsImg *psImg, int zRecSize );
+void lpc_FreeTxImage( tsTxImage *psTx );
+int lpc_SendTxImage( tsLpcCtx *psCtx, const tsTxImage *psTx, int zFirst, int zLast );
+int lpc_NextRecord( const unsigned char *pabUsed, int zAddr, int zLast, int zMaxLen,
+                    int *pzLen );
+
+int lpc_ReplyOk( char *pacTxd, char *pacRxd );
+unsigned char lpc_GetReplyByte( char *pacTxd, char *pacRxd );
+unsigned short lpc_GetReplyShort( char *pacTxd, char *pacRxd );
+unsigned long lpc_GetReplyLong( char *pacTxd, char *pacRxd );
+int lpc_RxdPacket( void *pvBuf, int zLen );
+
+void lpc_Log( tsLpcCtx *psCtx, teLOG_LEVEL eLevel, const char *pacFormat, ... );
+long long lpc_Usec( void );
+void lpc_Udelay( unsigned int uS );
+
+#endif
@@ -29,12 +29,15 @@
 #include <sys/signal.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <poll.h>
+#include <time.h>
 #include <errno.h>
 
 #include "serial.h"
 
 /* Private functions */
 static int ser_GetLinuxBaud( int zBaud );
+static long long ser_MonoUsec( void );
 
 
 int ser_Open( tsSerialPort *psSerPrt, char *pacPort, int zBaud )
@@ -59,13 +62,17 @@ int ser_Open( tsSerialPort *psSerPrt, char *pacPort, int zBaud )
         newtio->c_iflag &= ~( ICRNL | INPCK | ISTRIP | IUCLC| IXOFF | IXON | IGNCR );
         newtio->c_cflag &= ~( HUPCL | CRTSCTS | CSIZE );
         newtio->c_cflag |= ( CS8 | CLOCAL | CREAD );
-        newtio->c_cc[ VMIN ] = 1;
+        /* Reads never block in the driver, ser_Read waits in poll() instead */
+        newtio->c_cc[ VMIN ] = 0;
         newtio->c_cc[ VTIME ] = 0;
         cfsetispeed( newtio, ser_GetLinuxBaud( zBaud ));
         cfsetospeed( newtio, ser_GetLinuxBaud( zBaud ));
         tcsetattr( psSerPrt->fdSer, TCSANOW, newtio );
 
         tcflush( psSerPrt->fdSer, TCIFLUSH );
+        psSerPrt->zBaud = zBaud;
+        psSerPrt->zTxGuard = 0;
+        psSerPrt->fTrace = NULL;
         ser_SetDtrTo( psSerPrt, 1 );
         ser_SetRtsTo( psSerPrt, 1 );
 
@@ -97,6 +104,15 @@ int ser_RxPoll( tsSerialPort *psSerPrt )
 }
 
 
+/*
+  Throw away everything received and not yet read
+ */
+int ser_FlushRx( tsSerialPort *psSerPrt )
+{
+    return(( 0 == tcflush( psSerPrt->fdSer, TCIFLUSH )) ? 0 : -1 );
+}
+
+
 int ser_Write( tsSerialPort *psSerPrt, void *pvBuff, int zLen )
 {
     unsigned char *pbBuf = pvBuff;
@@ -117,65 +133,134 @@ int ser_Write( tsSerialPort *psSerPrt, void *pvBuff, int zLen )
             break;
         }
     } while( zWritten < zLen );
-    usleep( 250000 );
+
+    if(( NULL != psSerPrt->fTrace ) && ( zWritten > 0 ))
+    {
+        psSerPrt->fTrace( psSerPrt->pvTrace, SER_TX, pbBuf, zWritten );
+    }
+
+    if( zWritten > 0 )
+    {
+        /* Only wait as long as the bytes take to leave the UART.  If the
+           driver can not tell us when it has drained, use the wire time of
+           10 bits per character at the current baud rate */
+        if( 0 != tcdrain( psSerPrt->fdSer ))
+        {
+            usleep(( useconds_t )(( 10000000LL * zWritten ) / psSerPrt->zBaud ));
+        }
+
+        if( 0 < psSerPrt->zTxGuard )
+        {
+            usleep( psSerPrt->zTxGuard );
+        }
+    }
     
     return( zWritten );
 }
 
+
+int ser_SetTxGuard( tsSerialPort *psSerPrt, int zGuard )
+{
+    psSerPrt->zTxGuard = ( zGuard > 0 ) ? zGuard : 0;
+
+    return( 0 );
+}
+
+
+/*
+  Hand every chunk written or read to fTrace, NULL turns tracing off
+ */
+int ser_SetTrace( tsSerialPort *psSerPrt, tfSerialTrace fTrace, void *pvUser )
+{
+    psSerPrt->fTrace = fTrace;
+    psSerPrt->pvTrace = pvUser;
+
+    return( 0 );
+}
+
+
+/*
+  Change the line rate of an open port.  Anything still in the transmit
+  queue is sent at the old rate first.
+ */
+int ser_SetBaud( tsSerialPort *psSerPrt, int zBaud )
+{
+    int zRtnv = -1;
+
+    cfsetispeed( &psSerPrt->sNewTio, ser_GetLinuxBaud( zBaud ));
+    cfsetospeed( &psSerPrt->sNewTio, ser_GetLinuxBaud( zBaud ));
+    if( 0 == tcsetattr( psSerPrt->fdSer, TCSADRAIN, &psSerPrt->sNewTio ))
+    {
+        psSerPrt->zBaud = zBaud;
+        zRtnv = 0;
+    }
+
+    return( zRtnv );
+}
+
 int ser_Read( tsSerialPort *psSerPrt, void *pvBuff, int zLen, int zTimeout,
               tfSerialCallback fPktChk )
 {
     unsigned char *pbBuf = pvBuff;
-    int zBytesAvail = 0;
+    struct pollfd sPfd;
+    long long llDeadline;
+    long long llRemain;
     int zRead = 0;
     int zBytesRxd = 0;
+    int zReady;
 
-    zBytesAvail = ser_RxPoll( psSerPrt );
+    /* The time out is in microseconds from now.  Work against a monotonic
+       deadline so a slow trickle of bytes can not stretch the time out */
+    llDeadline = ser_MonoUsec() + zTimeout;
 
-    /* Round the Time out up to the number of 100 milliseconds from microseconds */
-    zTimeout = ( zTimeout + 10000 ) / 10000;
+    sPfd.fd = psSerPrt->fdSer;
+    sPfd.events = POLLIN;
 
-    if( 0 == zBytesAvail )
+    while(( zBytesRxd < zLen ) && ( 0 != fPktChk( pbBuf, zBytesRxd )))
     {
-        while(( zTimeout > 0 ) && ( 0 == zBytesAvail ))
+        llRemain = llDeadline - ser_MonoUsec();
+        if( llRemain <= 0 )
         {
-            usleep( 10000 );
-            zBytesAvail = ser_RxPoll( psSerPrt );
-            zTimeout--;
+            break;
         }
-    }
 
-    if( 0!= zBytesAvail )
-    {
-        while(( zTimeout > 0 ) && ( zBytesRxd < zLen ) &&
-              ( 0 != fPktChk( pbBuf, zBytesRxd )))
+        /* Sleep in the kernel until bytes arrive or the deadline passes.
+           Round up to whole milliseconds so we never spin on a 0 time out */
+        sPfd.revents = 0;
+        zReady = poll( &sPfd, 1, ( int )(( llRemain + 999 ) / 1000 ));
+        if( zReady < 0 )
         {
-            /* There is data in the buffer so read it out */
-            if( 0 != ser_RxPoll( psSerPrt ))
+            if( EINTR == errno )
             {
-                do
-                {
-                    zRead = read( psSerPrt->fdSer, pbBuf + zBytesRxd, zLen - zBytesRxd );
-                    if( zRead > 0 )
-                    {
-                        zBytesRxd += zRead;
-                    }
-                    else
-                    {
-                        zBytesRxd = zRead;
-                        break;
-                    }
-                } while( zBytesRxd < zBytesAvail );
+                continue;
             }
+            zBytesRxd = -1;
+            break;
+        }
 
-            if( zBytesRxd < 0 )
+        if( 0 != ( sPfd.revents & POLLIN ))
+        {
+            /* VMIN = VTIME = 0 so this returns whatever has arrived */
+            zRead = read( psSerPrt->fdSer, pbBuf + zBytesRxd, zLen - zBytesRxd );
+            if( zRead > 0 )
+            {
+                if( NULL != psSerPrt->fTrace )
+                {
+                    psSerPrt->fTrace( psSerPrt->pvTrace, SER_RX, pbBuf + zBytesRxd, zRead );
+                }
+                zBytesRxd += zRead;
+            }
+            else if(( zRead < 0 ) && ( EAGAIN != errno ) && ( EINTR != errno ))
             {
                 /* An error occurred so get out a here to */
+                zBytesRxd = zRead;
                 break;
             }
-            
-            zTimeout--;
-            usleep( 10000 );
+        }
+        else if( 0 != ( sPfd.revents & ( POLLERR | POLLHUP | POLLNVAL )))
+        {
+            zBytesRxd = -1;
+            break;
         }
     }
     
@@ -224,6 +309,19 @@ int ser_SetRtsTo( tsSerialPort *psSerPrt, int zState )
 }
 
 
+/*
+  Monotonic time in microseconds, immune to wall clock steps
+ */
+static long long ser_MonoUsec( void )
+{
+    struct timespec sTs;
+
+    clock_gettime( CLOCK_MONOTONIC, &sTs );
+
+    return(( long long )sTs.tv_sec * 1000000LL + sTs.tv_nsec / 1000 );
+}
+
+
 static int ser_GetLinuxBaud( int zBaud )
 {
     int zRtnv = B2400;
@@ -40,6 +40,8 @@ int ser_Open( tsSerialPort *psSerPrt, char *pacPort, int zBaud )
 
     /* Set comm port to use */
     psSerPrt->zComPort = atoi( pacPort + 3 );
+    psSerPrt->zTxGuard = 0;
+    psSerPrt->fTrace = NULL;
 
     /* Open handle to comms port */
     psSerPrt->hCom = CreateFile( pacPort, GENERIC_READ | GENERIC_WRITE,
@@ -117,6 +119,15 @@ int ser_RxPoll( tsSerialPort *psSerPrt )
 }
 
 
+/*
+  Throw away everything received and not yet read
+ */
+int ser_FlushRx( tsSerialPort *psSerPrt )
+{
+    return(( FALSE != PurgeComm( psSerPrt->hCom, PURGE_RXCLEAR )) ? 0 : -1 );
+}
+
+
 int ser_Write( tsSerialPort *psSerPrt, void *pvBuff, int zLen )
 {
     int zRtnv = -1;
@@ -129,12 +140,62 @@ int ser_Write( tsSerialPort *psSerPrt, void *pvBuff, int zLen )
     if( 0 != lWritten )
     {
         zRtnv = ( int )lWritten;
+        if( NULL != psSerPrt->fTrace )
+        {
+            psSerPrt->fTrace( psSerPrt->pvTrace, SER_TX, pvBuff, zRtnv );
+        }
+
+        /* Wait for the bytes to leave the UART then any requested guard */
+        FlushFileBuffers( psSerPrt->hCom );
+        if( 0 < psSerPrt->zTxGuard )
+        {
+            Sleep(( psSerPrt->zTxGuard + 999 ) / 1000 );
+        }
     }
     
     return( zRtnv );
 }
 
 
+int ser_SetTxGuard( tsSerialPort *psSerPrt, int zGuard )
+{
+    psSerPrt->zTxGuard = ( zGuard > 0 ) ? zGuard : 0;
+
+    return( 0 );
+}
+
+
+/*
+  Hand every chunk written or read to fTrace, NULL turns tracing off
+ */
+int ser_SetTrace( tsSerialPort *psSerPrt, tfSerialTrace fTrace, void *pvUser )
+{
+    psSerPrt->fTrace = fTrace;
+    psSerPrt->pvTrace = pvUser;
+
+    return( 0 );
+}
+
+
+int ser_SetBaud( tsSerialPort *psSerPrt, int zBaud )
+{
+    int zRtnv = -1;
+    DCB sDcb;
+
+    FlushFileBuffers( psSerPrt->hCom );
+    if( 0 != GetCommState( psSerPrt->hCom, &sDcb ))
+    {
+        sDcb.BaudRate = ser_GetBaudRate( zBaud );
+        if( 0 != SetCommState( psSerPrt->hCom, &sDcb ))
+        {
+            zRtnv = 0;
+        }
+    }
+
+    return( zRtnv );
+}
+
+
 int ser_Read( tsSerialPort *psSerPrt, void *pvBuff, int zLen, int zTimeout,
               tfSerialCallback fPktChk )
 {
@@ -178,6 +239,11 @@ int ser_Read( tsSerialPort *psSerPrt, void *pvBuff, int zLen, int zTimeout,
                                   zLen - zTotalBytesRead,
                                   (unsigned long *)&zBytesRead, NULL );
 
+                if(( NULL != psSerPrt->fTrace ) && ( 0 < zBytesRead ))
+                {
+                    psSerPrt->fTrace( psSerPrt->pvTrace, SER_RX, pbBuff + zTotalBytesRead,
+                                      zBytesRead );
+                }
                 zTotalBytesRead += zBytesRead;
         
                 if( FALSE != zRtnv )
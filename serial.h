@@ -23,12 +23,23 @@
 #ifndef SERIAL_H
 #define SERIAL_H
 
+/* Direction of a chunk handed to the trace hook */
+#define SER_TX 0
+#define SER_RX 1
+
+/* Called with every chunk written to or read from the port */
+typedef void (*tfSerialTrace)( void *pvUser, int zDir, const void *pvBuf, int zLen );
+
 #ifdef LINUX
 typedef struct
 {
     int fdSer;
     struct termios sOldTio;
     struct termios sNewTio;
+    int zBaud;       /* Line rate used to size transmit waits */
+    int zTxGuard;    /* Extra delay after each write in microseconds */
+    tfSerialTrace fTrace; /* Trace hook, NULL for none */
+    void *pvTrace;   /* Handed back to the trace hook */
 } tsSerialPort;
 #else
 #if defined(WINDOWS) || defined(WIN32) ||defined(_WIN32)
@@ -36,6 +47,9 @@ typedef struct
 {
     HANDLE hCom;     /* Com port handle */
     int zComPort;
+    int zTxGuard;    /* Extra delay after each write in microseconds */
+    tfSerialTrace fTrace; /* Trace hook, NULL for none */
+    void *pvTrace;   /* Handed back to the trace hook */
 } tsSerialPort;
 #endif
 #endif
@@ -45,10 +59,15 @@ typedef int (*tfSerialCallback)(void *, int);
 int ser_Open( tsSerialPort *psSerPrt, char *pacPort, int zBaud );
 int ser_Close( tsSerialPort *psSerPrt );
 int ser_RxPoll( tsSerialPort *psSerPrt );
+int ser_FlushRx( tsSerialPort *psSerPrt );
 int ser_Write( tsSerialPort *psSerPrt, void *pvBuff, int zLen );
 int ser_Read( tsSerialPort *psSerPrt, void *pvBuff, int zLen, int zTimeout,
               tfSerialCallback fPktChk );
 
+int ser_SetTxGuard( tsSerialPort *psSerPrt, int zGuard );
+int ser_SetTrace( tsSerialPort *psSerPrt, tfSerialTrace fTrace, void *pvUser );
+int ser_SetBaud( tsSerialPort *psSerPrt, int zBaud );
+
 int ser_SetDtrTo( tsSerialPort *psSerPrt, int zState );
 int ser_SetRtsTo( tsSerialPort *psSerPrt, int zState );
 
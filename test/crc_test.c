@@ -0,0 +1,219 @@
+/*  
+  File:         crc_test.c
+  Written by:   Rod Boyce
+  e-mail:       rod@boyce.net.nz
+
+  This file is part of lpc935-prog
+  
+  lpc935-prog is free software; you can redistribute it and/or modify
+  it under the terms of the Lesser GNU General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  lpc935-prog is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser
+  GNU General Public License for more details.
+
+  You should have received a copy of the Lesser GNU General Public
+  License along with lpc935-prog; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+  USA
+*/
+/*
+  Known answer tests of the host CRC engine.
+
+  The engine is checked against POSIX cksum, which runs the same
+  polynomial most significant bit first from 0 and then adds the length
+  and inverts, so the answers come from an implementation that shares no
+  code or tables with crc.c.  The sector and global CRCs are then checked
+  for the images in asImage, and every entry of the slice by 4 tables is
+  checked against the polynomial one bit at a time.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "../crc.h"
+
+/* Images the sector and global vectors are worked out over */
+#define IMG_BLANK 0 /* Erased flash, every byte 0xff */
+#define IMG_ZERO  1 /* Every byte 0x00 */
+#define IMG_ADDR  2 /* Each byte the low byte of its address */
+
+/* A buffer and what cksum prints for it */
+typedef struct
+{
+    const char *pacName; /**< What the buffer holds */
+    int zImage; /**< Image the buffer is the start of, -1 for pacText */
+    const char *pacText; /**< Text to check when zImage is -1 */
+    unsigned int lLen; /**< Bytes checked */
+    unsigned long lCksum; /**< Output of cksum over the same bytes */
+} tsCksum;
+
+/* The sector and global CRCs the boot loader returns for an image */
+typedef struct
+{
+    const char *pacName; /**< What the image holds */
+    int zImage; /**< IMG_ value of the image */
+    unsigned long lSector; /**< CRC of every sector, the images repeat each sector */
+    unsigned long lGlobal; /**< CRC of the whole flash */
+} tsImageCrc;
+
+static const tsCksum asCksum[] =
+{
+    { "check string", -1, "123456789", 9, 930766865UL },
+    { "blank sector", IMG_BLANK, NULL, CRC_SECTOR_SIZE, 2603594795UL },
+    { "blank flash", IMG_BLANK, NULL, CRC_FLASH_SIZE, 1671469031UL },
+    { "address flash", IMG_ADDR, NULL, CRC_FLASH_SIZE, 3964908346UL }
+};
+
+/* The boot loader CRC as the user manual gives it, the polynomial from 0
+   with nothing added at the end.  READ_SECTOR_CRC and READ_GLOBAL_CRC
+   readings of these images from a board belong here */
+static const tsImageCrc asImage[] =
+{
+    { "blank", IMG_BLANK, 0x5b0af1eaUL, 0x85b5bb36UL },
+    { "zero", IMG_ZERO, 0x00000000UL, 0x00000000UL },
+    { "address", IMG_ADDR, 0x91566c1bUL, 0xb9f9cad1UL }
+};
+
+static void test_FillImage( unsigned char *pabRom, int zImage );
+static unsigned long test_Cksum( const unsigned char *pbData, unsigned int lLen );
+static unsigned long test_BitCrc( const unsigned char *pbData, unsigned int lLen );
+
+
+int main( int argc, char **argv )
+{
+    static unsigned char abRom[ CRC_FLASH_SIZE ];
+    unsigned long alSector[ CRC_FLASH_SIZE / CRC_SECTOR_SIZE ];
+    unsigned char abWord[ 4 ];
+    unsigned long lGlobal;
+    unsigned long lGot;
+    const unsigned char *pbData;
+    int zErrors = 0;
+    int zPos;
+    int i;
+    int n;
+
+    for( i = 0; i < sizeof( asCksum ) / sizeof( asCksum[ 0 ]); i++ )
+    {
+        pbData = ( const unsigned char * )asCksum[ i ].pacText;
+        if( 0 <= asCksum[ i ].zImage )
+        {
+            test_FillImage( abRom, asCksum[ i ].zImage );
+            pbData = abRom;
+        }
+        lGot = test_Cksum( pbData, asCksum[ i ].lLen );
+        if( lGot != asCksum[ i ].lCksum )
+        {
+            printf( "cksum of %s is %lu, expected %lu\n", asCksum[ i ].pacName, lGot,
+                    asCksum[ i ].lCksum );
+            zErrors++;
+        }
+    }
+
+    for( i = 0; i < sizeof( asImage ) / sizeof( asImage[ 0 ]); i++ )
+    {
+        test_FillImage( abRom, asImage[ i ].zImage );
+        crc_Image( abRom, alSector, &lGlobal );
+        for( n = 0; n < CRC_FLASH_SIZE / CRC_SECTOR_SIZE; n++ )
+        {
+            lGot = crc_Sector( abRom, n * CRC_SECTOR_SIZE );
+            if(( lGot != asImage[ i ].lSector ) || ( alSector[ n ] != asImage[ i ].lSector ))
+            {
+                printf( "Sector %d CRC of the %s image is 0x%08lx and 0x%08lx, expected 0x%08lx\n",
+                        n, asImage[ i ].pacName, lGot, alSector[ n ], asImage[ i ].lSector );
+                zErrors++;
+            }
+        }
+        lGot = crc_Global( abRom );
+        if(( lGot != asImage[ i ].lGlobal ) || ( lGlobal != asImage[ i ].lGlobal ))
+        {
+            printf( "Global CRC of the %s image is 0x%08lx and 0x%08lx, expected 0x%08lx\n",
+                    asImage[ i ].pacName, lGot, lGlobal, asImage[ i ].lGlobal );
+            zErrors++;
+        }
+    }
+
+    /* One byte goes through table 0 alone, four bytes with only byte
+       zPos set pick out entry n of table 3 - zPos */
+    for( n = 0; n < 256; n++ )
+    {
+        abWord[ 0 ] = n;
+        if( crc_Update( 0, abWord, 1 ) != test_BitCrc( abWord, 1 ))
+        {
+            printf( "Single byte table entry 0x%02x is wrong\n", n );
+            zErrors++;
+        }
+        for( zPos = 0; zPos < 4; zPos++ )
+        {
+            memset( abWord, 0, sizeof( abWord ));
+            abWord[ zPos ] = n;
+            if( crc_Update( 0, abWord, 4 ) != test_BitCrc( abWord, 4 ))
+            {
+                printf( "Table %d entry 0x%02x is wrong\n", 3 - zPos, n );
+                zErrors++;
+            }
+        }
+    }
+
+    printf( "crc_test: %d errors\n", zErrors );
+
+    return(( 0 == zErrors ) ? 0 : 1 );
+}
+
+
+/*
+  Fill a whole flash image with one of the IMG_ patterns
+ */
+static void test_FillImage( unsigned char *pabRom, int zImage )
+{
+    int i;
+
+    for( i = 0; i < CRC_FLASH_SIZE; i++ )
+    {
+        pabRom[ i ] = ( IMG_BLANK == zImage ) ? 0xff : ( IMG_ZERO == zImage ) ? 0x00 : i & 0xff;
+    }
+}
+
+
+/*
+  What POSIX cksum prints, the CRC of the bytes followed by their length
+  low byte first with no zero bytes at the top, inverted
+ */
+static unsigned long test_Cksum( const unsigned char *pbData, unsigned int lLen )
+{
+    unsigned long lCrc;
+    unsigned char bLen;
+
+    lCrc = crc_Update( 0, pbData, lLen );
+    for( ; 0 != lLen; lLen >>= 8 )
+    {
+        bLen = lLen & 0xff;
+        lCrc = crc_Update( lCrc, &bLen, 1 );
+    }
+
+    return( ~lCrc & 0xffffffffUL );
+}
+
+
+/*
+  Straight from the polynomial, one bit at a time
+ */
+static unsigned long test_BitCrc( const unsigned char *pbData, unsigned int lLen )
+{
+    unsigned long lCrc = 0;
+    int zBit;
+
+    while( lLen-- > 0 )
+    {
+        lCrc ^= ( unsigned long )*pbData++ << 24;
+        for( zBit = 0; zBit < 8; zBit++ )
+        {
+            lCrc = ( 0 != ( lCrc & 0x80000000UL )) ? ( lCrc << 1 ) ^ 0x04c11db7UL : ( lCrc << 1 );
+        }
+        lCrc &= 0xffffffffUL;
+    }
+
+    return( lCrc );
+}
@@ -0,0 +1,406 @@
+/*  
+  File:         timing.c
+  Written by:   Rod Boyce
+  e-mail:       rod@boyce.net.nz
+
+  This file is part of lpc935-prog
+  
+  lpc935-prog is free software; you can redistribute it and/or modify
+  it under the terms of the Lesser GNU General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  lpc935-prog is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser
+  GNU General Public License for more details.
+
+  You should have received a copy of the Lesser GNU General Public
+  License along with lpc935-prog; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+  USA
+*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "lpc935.h"
+#include "timing.h"
+
+static int tim_Bucket( long long llUsec );
+static long long tim_BucketTop( int zBucket );
+static void tim_Line( FILE *psOut, int zJson, const char *pacName, const tsTimHist *psHist,
+                      int zFirst );
+static void tim_Slowest( const tsTiming *psTim, FILE *psOut, int zJson );
+static int tim_SlowerFirst( const void *pvA, const void *pvB );
+
+static const char *apacPhase[ eTIM_PHASES ] =
+{
+    [ eTIM_PREPARE ] = "prepare",
+    [ eTIM_ENTRY   ] = "entry",
+    [ eTIM_SYNC    ] = "sync",
+    [ eTIM_BAUD    ] = "baud",
+    [ eTIM_ERASE   ] = "erase",
+    [ eTIM_PROGRAM ] = "program",
+    [ eTIM_VERIFY  ] = "verify"
+};
+
+static const char *apacStage[ eTIM_STAGES ] =
+{
+    [ eTIM_SEND  ] = "send",
+    [ eTIM_ECHO  ] = "echo",
+    [ eTIM_FLASH ] = "flash",
+    [ eTIM_ACK   ] = "ack"
+};
+
+/* Names of the record types, 09 is not used */
+static const char *apacCmd[ TIM_COMMANDS ] =
+{
+    [ PROGRAM_DATA          ] = "program_data",
+    [ READ_VERSION_ID       ] = "read_version",
+    [ MISC_WRITE_FN         ] = "misc_write",
+    [ MISC_READ_FN          ] = "misc_read",
+    [ ERASE_SECTOR_PAGE     ] = "erase",
+    [ READ_SECTOR_CRC       ] = "sector_crc",
+    [ READ_GLOBAL_CRC       ] = "global_crc",
+    [ DIRECT_LOAD_BAUD_RATE ] = "load_baud",
+    [ RESET_MCU             ] = "reset",
+    [ PROG_GET              ] = "prog_get",
+    [ PROG_SET              ] = "prog_set"
+};
+
+
+/**
+   Clear all the statistics and start the session clock.
+ */
+void tim_Init( tsTiming *psTim )
+{
+    memset( psTim, 0, sizeof( *psTim ));
+    psTim->llStart = lpc_Usec();
+}
+
+
+/**
+   Add one sample in microseconds to a histogram.
+ */
+void tim_Add( tsTimHist *psHist, long long llUsec )
+{
+    if( llUsec < 0 )
+    {
+        llUsec = 0;
+    }
+    psHist->lCount++;
+    psHist->llTotal += llUsec;
+    if( llUsec > psHist->llMax )
+    {
+        psHist->llMax = llUsec;
+    }
+    psHist->alBucket[ tim_Bucket( llUsec )]++;
+}
+
+
+/**
+   Returns the time that zPercent of the samples did not exceed, rounded up
+   to the top of its bucket, or 0 if the histogram is empty.
+ */
+long long tim_Percentile( const tsTimHist *psHist, int zPercent )
+{
+    unsigned long lWant;
+    unsigned long lSeen = 0;
+    long long llTop = 0;
+    int i;
+
+    if( 0 == psHist->lCount )
+    {
+        return( 0 );
+    }
+
+    lWant = ( psHist->lCount * zPercent + 99 ) / 100;
+    if( 0 == lWant )
+    {
+        lWant = 1;
+    }
+    for( i = 0; i < TIM_BUCKETS; i++ )
+    {
+        lSeen += psHist->alBucket[ i ];
+        if( lSeen >= lWant )
+        {
+            llTop = tim_BucketTop( i );
+            break;
+        }
+    }
+
+    return(( llTop < psHist->llMax ) ? llTop : psHist->llMax );
+}
+
+
+/**
+   Add the time since llStart to a phase.  Does nothing if psTim is NULL so
+   callers need not check whether timing is on.
+ */
+void tim_Phase( tsTiming *psTim, teTIM_PHASE ePhase, long long llStart )
+{
+    if( NULL != psTim )
+    {
+        tim_Add( &psTim->asPhase[ ePhase ], lpc_Usec() - llStart );
+    }
+}
+
+
+/**
+   Add the time since llStart to the statistics of record type bRecId.
+   Does nothing if psTim is NULL.
+ */
+void tim_Command( tsTiming *psTim, unsigned char bRecId, long long llStart )
+{
+    if(( NULL != psTim ) && ( bRecId < TIM_COMMANDS ))
+    {
+        tim_Add( &psTim->asCmd[ bRecId ], lpc_Usec() - llStart );
+    }
+}
+
+
+/**
+   Add the stage times of one program record.  If the record is among the
+   zSlowest by ACK time so far it is kept, replacing the fastest of those.
+   Does nothing if psTim is NULL.
+ */
+void tim_Record( tsTiming *psTim, const tsTimRecord *psRec )
+{
+    int zFastest = 0;
+    int i;
+
+    if( NULL == psTim )
+    {
+        return;
+    }
+
+    for( i = 0; i < eTIM_STAGES; i++ )
+    {
+        tim_Add( &psTim->asStage[ i ], psRec->allStage[ i ]);
+    }
+
+    if( psTim->zSlowUsed < psTim->zSlowest )
+    {
+        psTim->asSlow[ psTim->zSlowUsed++ ] = *psRec;
+        return;
+    }
+
+    for( i = 1; i < psTim->zSlowUsed; i++ )
+    {
+        if( psTim->asSlow[ i ].allStage[ eTIM_ACK ] <
+            psTim->asSlow[ zFastest ].allStage[ eTIM_ACK ])
+        {
+            zFastest = i;
+        }
+    }
+    if(( 0 < psTim->zSlowUsed ) &&
+       ( psRec->allStage[ eTIM_ACK ] > psTim->asSlow[ zFastest ].allStage[ eTIM_ACK ]))
+    {
+        psTim->asSlow[ zFastest ] = *psRec;
+    }
+}
+
+
+/**
+   Write the summary of a session to psOut, as one JSON object if zJson is
+   set or as a table otherwise.  Phases and commands that never ran are
+   left out.
+ */
+void tim_Report( const tsTiming *psTim, FILE *psOut, int zJson )
+{
+    long long llProgUs = psTim->asPhase[ eTIM_PROGRAM ].llTotal;
+    long long llBps = ( llProgUs > 0 ) ? ( psTim->llProgBytes * 1000000LL ) / llProgUs : 0;
+    int zFirst;
+    int i;
+
+    if( 0 != zJson )
+    {
+        fprintf( psOut, "{\n  \"elapsed_us\": %lld,\n  \"program_bytes\": %lld,\n"
+                 "  \"program_Bps\": %lld,\n  \"sync_tries\": %lu,\n  \"phases\": {",
+                 lpc_Usec() - psTim->llStart, psTim->llProgBytes, llBps, psTim->lSyncTries );
+    }
+    else
+    {
+        fprintf( psOut, "Session %lld ms, %lld bytes programmed at %lld bytes/s, "
+                 "%lu autobaud tries\n", ( lpc_Usec() - psTim->llStart ) / 1000,
+                 psTim->llProgBytes, llBps, psTim->lSyncTries );
+        fprintf( psOut, "%-14s %8s %10s %9s %9s %9s %9s\n", "Phase/command", "Count",
+                 "Total us", "Mean us", "p50 us", "p99 us", "Max us" );
+    }
+
+    for( zFirst = 1, i = 0; i < eTIM_PHASES; i++ )
+    {
+        if( 0 != psTim->asPhase[ i ].lCount )
+        {
+            tim_Line( psOut, zJson, apacPhase[ i ], &psTim->asPhase[ i ], zFirst );
+            zFirst = 0;
+        }
+    }
+
+    if( 0 != zJson )
+    {
+        fprintf( psOut, "\n  },\n  \"commands\": {" );
+    }
+
+    for( zFirst = 1, i = 0; i < TIM_COMMANDS; i++ )
+    {
+        if(( NULL != apacCmd[ i ]) && ( 0 != psTim->asCmd[ i ].lCount ))
+        {
+            tim_Line( psOut, zJson, apacCmd[ i ], &psTim->asCmd[ i ], zFirst );
+            zFirst = 0;
+        }
+    }
+
+    if( 0 != zJson )
+    {
+        fprintf( psOut, "\n  },\n  \"records\": {" );
+    }
+
+    for( zFirst = 1, i = 0; i < eTIM_STAGES; i++ )
+    {
+        if( 0 != psTim->asStage[ i ].lCount )
+        {
+            tim_Line( psOut, zJson, apacStage[ i ], &psTim->asStage[ i ], zFirst );
+            zFirst = 0;
+        }
+    }
+
+    if( 0 != zJson )
+    {
+        fprintf( psOut, "\n  }" );
+    }
+    tim_Slowest( psTim, psOut, zJson );
+    if( 0 != zJson )
+    {
+        fprintf( psOut, "\n}\n" );
+    }
+    fflush( psOut );
+}
+
+
+/*
+  One phase or command of the report
+ */
+static void tim_Line( FILE *psOut, int zJson, const char *pacName, const tsTimHist *psHist,
+                      int zFirst )
+{
+    long long llMean = psHist->llTotal / ( long long )psHist->lCount;
+
+    if( 0 != zJson )
+    {
+        fprintf( psOut, "%s\n    \"%s\": { \"count\": %lu, \"total_us\": %lld, \"mean_us\": %lld, "
+                 "\"p50_us\": %lld, \"p99_us\": %lld, \"max_us\": %lld }",
+                 zFirst ? "" : ",", pacName, psHist->lCount, psHist->llTotal, llMean,
+                 tim_Percentile( psHist, 50 ), tim_Percentile( psHist, 99 ), psHist->llMax );
+    }
+    else
+    {
+        fprintf( psOut, "%-14s %8lu %10lld %9lld %9lld %9lld %9lld\n", pacName,
+                 psHist->lCount, psHist->llTotal, llMean, tim_Percentile( psHist, 50 ),
+                 tim_Percentile( psHist, 99 ), psHist->llMax );
+    }
+}
+
+
+/*
+  The kept program records, slowest first
+ */
+static void tim_Slowest( const tsTiming *psTim, FILE *psOut, int zJson )
+{
+    tsTimRecord asSort[ TIM_MAX_SLOW ];
+    const tsTimRecord *psRec;
+    int i;
+
+    if( 0 == psTim->zSlowest )
+    {
+        return;
+    }
+
+    memcpy( asSort, psTim->asSlow, sizeof( asSort[ 0 ]) * psTim->zSlowUsed );
+    qsort( asSort, psTim->zSlowUsed, sizeof( asSort[ 0 ]), tim_SlowerFirst );
+
+    if( 0 != zJson )
+    {
+        fprintf( psOut, ",\n  \"slowest\": [" );
+    }
+    else
+    {
+        fprintf( psOut, "Slowest records\n%-8s %4s %9s %9s %9s %9s\n", "Address", "Len",
+                 "Send us", "Echo us", "Flash us", "ACK us" );
+    }
+
+    for( i = 0; i < psTim->zSlowUsed; i++ )
+    {
+        psRec = &asSort[ i ];
+        if( 0 != zJson )
+        {
+            fprintf( psOut, "%s\n    { \"addr\": %u, \"len\": %u, \"send_us\": %lld, "
+                     "\"echo_us\": %lld, \"flash_us\": %lld, \"ack_us\": %lld }",
+                     ( 0 == i ) ? "" : ",", psRec->wAddr, psRec->bLen,
+                     psRec->allStage[ eTIM_SEND ], psRec->allStage[ eTIM_ECHO ],
+                     psRec->allStage[ eTIM_FLASH ], psRec->allStage[ eTIM_ACK ]);
+        }
+        else
+        {
+            fprintf( psOut, "0x%04x   %4u %9lld %9lld %9lld %9lld\n", psRec->wAddr,
+                     psRec->bLen, psRec->allStage[ eTIM_SEND ], psRec->allStage[ eTIM_ECHO ],
+                     psRec->allStage[ eTIM_FLASH ], psRec->allStage[ eTIM_ACK ]);
+        }
+    }
+
+    if( 0 != zJson )
+    {
+        fprintf( psOut, "\n  ]" );
+    }
+}
+
+
+static int tim_SlowerFirst( const void *pvA, const void *pvB )
+{
+    long long llA = (( const tsTimRecord * )pvA )->allStage[ eTIM_ACK ];
+    long long llB = (( const tsTimRecord * )pvB )->allStage[ eTIM_ACK ];
+
+    return(( llA < llB ) ? 1 : ( llA > llB ) ? -1 : 0 );
+}
+
+
+/*
+  Bucket of a time, one per microsecond below 16 then 8 per power of two
+ */
+static int tim_Bucket( long long llUsec )
+{
+    int zMsb = 0;
+    long long llVal;
+    int zBucket;
+
+    if( llUsec < 16 )
+    {
+        return(( int )llUsec );
+    }
+
+    for( llVal = llUsec; llVal > 1; llVal >>= 1 )
+    {
+        zMsb++;
+    }
+    zBucket = 16 + ( zMsb - 4 ) * 8 + ( int )(( llUsec >> ( zMsb - 3 )) & 7 );
+
+    return(( zBucket < TIM_BUCKETS ) ? zBucket : TIM_BUCKETS - 1 );
+}
+
+
+/*
+  Largest time that falls in a bucket
+ */
+static long long tim_BucketTop( int zBucket )
+{
+    int zShift;
+
+    if( zBucket < 16 )
+    {
+        return( zBucket );
+    }
+
+    zShift = ( zBucket - 16 ) / 8 + 1;
+
+    return((( 8LL + ( zBucket - 16 ) % 8 + 1 ) << zShift ) - 1 );
+}
@@ -0,0 +1,104 @@
+/*  
+  File:         timing.h
+  Written by:   Rod Boyce
+  e-mail:       rod@boyce.net.nz
+
+  This file is part of lpc935-prog
+  
+  lpc935-prog is free software; you can redistribute it and/or modify
+  it under the terms of the Lesser GNU General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  lpc935-prog is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser
+  GNU General Public License for more details.
+
+  You should have received a copy of the Lesser GNU General Public
+  License along with lpc935-prog; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+  USA
+*/
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdio.h>
+
+/* Histogram of times in microseconds.  Times under 16 us get a bucket
+   each, above that every power of two is split in 8 so a percentile read
+   back from the buckets is within 1/8 of the real value */
+#define TIM_BUCKETS 240
+
+/* ISP record types 00 to 0b have their own command statistics */
+#define TIM_COMMANDS 0x0c
+
+/* Most program records --slowest may keep */
+#define TIM_MAX_SLOW 64
+
+/* Parts of a session that are timed as a whole */
+typedef enum
+{
+    eTIM_PREPARE, /**< Parsing and encoding the image, overlaps entry and sync */
+    eTIM_ENTRY, /**< Power cycle and reset into the boot loader */
+    eTIM_SYNC, /**< Autobaud */
+    eTIM_BAUD, /**< Baud rate escalation */
+    eTIM_ERASE, /**< Erases done before programming */
+    eTIM_PROGRAM, /**< Streaming program records */
+    eTIM_VERIFY, /**< Sector CRC readback */
+
+    eTIM_PHASES
+} teTIM_PHASE;
+
+/* Stages of one program record */
+typedef enum
+{
+    eTIM_SEND, /**< Writing the record to the port */
+    eTIM_ECHO, /**< From written until the whole echo is back */
+    eTIM_FLASH, /**< From the end of the echo to the status, the flash write */
+    eTIM_ACK, /**< From the start of the write to the end of the reply */
+
+    eTIM_STAGES
+} teTIM_STAGE;
+
+typedef struct
+{
+    unsigned long lCount; /**< Samples added */
+    long long llTotal; /**< Sum of the samples */
+    long long llMax; /**< Longest sample */
+    unsigned int alBucket[ TIM_BUCKETS ];
+} tsTimHist;
+
+/* Times of one program record */
+typedef struct
+{
+    unsigned short wAddr; /**< Flash address of the record */
+    unsigned char bLen; /**< Data bytes in the record */
+    long long allStage[ eTIM_STAGES ]; /**< Microseconds spent in each stage */
+} tsTimRecord;
+
+/* Timing of a whole session.  Hang one off a context with psTiming to
+   collect it, everything is fixed size so nothing is allocated while
+   talking to the micro */
+typedef struct
+{
+    long long llStart; /**< When tim_Init was called */
+    long long llProgBytes; /**< Data bytes sent in program records */
+    unsigned long lSyncTries; /**< Autobaud characters sent */
+    tsTimHist asPhase[ eTIM_PHASES ];
+    tsTimHist asCmd[ TIM_COMMANDS ];
+    tsTimHist asStage[ eTIM_STAGES ];
+    int zSlowest; /**< Slowest program records to keep, up to TIM_MAX_SLOW */
+    int zSlowUsed; /**< Entries of asSlow in use */
+    tsTimRecord asSlow[ TIM_MAX_SLOW ]; /**< Slowest records by ACK time, unsorted */
+} tsTiming;
+
+void tim_Init( tsTiming *psTim );
+void tim_Add( tsTimHist *psHist, long long llUsec );
+long long tim_Percentile( const tsTimHist *psHist, int zPercent );
+void tim_Phase( tsTiming *psTim, teTIM_PHASE ePhase, long long llStart );
+void tim_Command( tsTiming *psTim, unsigned char bRecId, long long llStart );
+void tim_Record( tsTiming *psTim, const tsTimRecord *psRec );
+void tim_Report( const tsTiming *psTim, FILE *psOut, int zJson );
+
+#endif
@@ -0,0 +1,183 @@
+/*  
+  File:         trace.c
+  Written by:   Rod Boyce
+  e-mail:       rod@boyce.net.nz
+
+  This file is part of lpc935-prog
+  
+  lpc935-prog is free software; you can redistribute it and/or modify
+  it under the terms of the Lesser GNU General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  lpc935-prog is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser
+  GNU General Public License for more details.
+
+  You should have received a copy of the Lesser GNU General Public
+  License along with lpc935-prog; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+  USA
+*/
+#include <string.h>
+
+#include "lpc935.h"
+#include "trace.h"
+
+/* Trace output is written in big blocks so tracing costs little more
+   than a memcpy per chunk */
+#define TRC_BUFFER 65536
+
+static void trc_Record( tsTrace *psTrc, int zDir, unsigned long lDelta,
+                        const unsigned char *pbData, int zLen );
+
+
+/**
+   Create a trace file and start its clock.
+   Returns 0 on success or -1 if the file could not be created.
+ */
+int trc_Open( tsTrace *psTrc, const char *pacFile )
+{
+    psTrc->psFile = fopen( pacFile, "wb" );
+    if( NULL == psTrc->psFile )
+    {
+        return( -1 );
+    }
+    setvbuf( psTrc->psFile, NULL, _IOFBF, TRC_BUFFER );
+    fwrite( TRC_MAGIC, 1, TRC_MAGIC_SIZE, psTrc->psFile );
+    psTrc->llLast = lpc_Usec();
+
+    return( 0 );
+}
+
+
+/**
+   Open a trace file to read it back with trc_Next.
+   Returns 0 on success or -1 if it could not be opened or is not a trace.
+ */
+int trc_OpenRead( tsTrace *psTrc, const char *pacFile )
+{
+    char acMagic[ TRC_MAGIC_SIZE ];
+
+    psTrc->llLast = 0;
+    psTrc->psFile = fopen( pacFile, "rb" );
+    if( NULL == psTrc->psFile )
+    {
+        return( -1 );
+    }
+
+    if(( TRC_MAGIC_SIZE != fread( acMagic, 1, TRC_MAGIC_SIZE, psTrc->psFile )) ||
+       ( 0 != memcmp( acMagic, TRC_MAGIC, TRC_MAGIC_SIZE )))
+    {
+        fclose( psTrc->psFile );
+        psTrc->psFile = NULL;
+        return( -1 );
+    }
+
+    return( 0 );
+}
+
+
+/**
+   Flush and close a trace file opened either way.
+ */
+int trc_Close( tsTrace *psTrc )
+{
+    if( NULL != psTrc->psFile )
+    {
+        fclose( psTrc->psFile );
+        psTrc->psFile = NULL;
+    }
+
+    return( 0 );
+}
+
+
+/**
+   Trace hook for ser_SetTrace, pvUser is the tsTrace.  Adds one record
+   holding the chunk and the time since the record before.
+ */
+void trc_Chunk( void *pvUser, int zDir, const void *pvBuf, int zLen )
+{
+    tsTrace *psTrc = pvUser;
+    const unsigned char *pbData = pvBuf;
+    long long llNow = lpc_Usec();
+    long long llDelta = llNow - psTrc->llLast;
+    int zPart;
+
+    psTrc->llLast = llNow;
+
+    /* Idle for more than the 32 bit delta can hold, pad with empty records */
+    while( llDelta > 0xffffffffLL )
+    {
+        trc_Record( psTrc, zDir, 0xffffffffUL, NULL, 0 );
+        llDelta -= 0xffffffffLL;
+    }
+
+    do
+    {
+        zPart = ( zLen > TRC_MAX_CHUNK ) ? TRC_MAX_CHUNK : zLen;
+        trc_Record( psTrc, zDir, ( unsigned long )llDelta, pbData, zPart );
+        pbData += zPart;
+        zLen -= zPart;
+        llDelta = 0;
+    } while( zLen > 0 );
+}
+
+
+/**
+   Read the next record of a trace.
+   Returns 1 if a record was read, 0 at the end of the trace or -1 if the
+   trace is cut short.
+ */
+int trc_Next( tsTrace *psTrc, tsTraceRec *psRec )
+{
+    unsigned char abHead[ TRC_HEADER ];
+    size_t lGot;
+
+    lGot = fread( abHead, 1, sizeof( abHead ), psTrc->psFile );
+    if( 0 == lGot )
+    {
+        return( 0 );
+    }
+    if( sizeof( abHead ) != lGot )
+    {
+        return( -1 );
+    }
+
+    psRec->zDir = abHead[ 0 ];
+    psTrc->llLast += ( unsigned long )abHead[ 1 ] | (( unsigned long )abHead[ 2 ] << 8 ) |
+        (( unsigned long )abHead[ 3 ] << 16 ) | (( unsigned long )abHead[ 4 ] << 24 );
+    psRec->llTime = psTrc->llLast;
+    psRec->zLen = abHead[ 5 ] | ( abHead[ 6 ] << 8 );
+
+    if(( psRec->zLen > TRC_MAX_CHUNK ) ||
+       ( psRec->zLen != fread( psRec->abData, 1, psRec->zLen, psTrc->psFile )))
+    {
+        return( -1 );
+    }
+
+    return( 1 );
+}
+
+
+static void trc_Record( tsTrace *psTrc, int zDir, unsigned long lDelta,
+                        const unsigned char *pbData, int zLen )
+{
+    unsigned char abHead[ TRC_HEADER ];
+
+    abHead[ 0 ] = zDir;
+    abHead[ 1 ] = lDelta & 0xff;
+    abHead[ 2 ] = ( lDelta >> 8 ) & 0xff;
+    abHead[ 3 ] = ( lDelta >> 16 ) & 0xff;
+    abHead[ 4 ] = ( lDelta >> 24 ) & 0xff;
+    abHead[ 5 ] = zLen & 0xff;
+    abHead[ 6 ] = ( zLen >> 8 ) & 0xff;
+
+    fwrite( abHead, 1, sizeof( abHead ), psTrc->psFile );
+    if( 0 < zLen )
+    {
+        fwrite( pbData, 1, zLen, psTrc->psFile );
+    }
+}
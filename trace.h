@@ -0,0 +1,61 @@
+/*  
+  File:         trace.h
+  Written by:   Rod Boyce
+  e-mail:       rod@boyce.net.nz
+
+  This file is part of lpc935-prog
+  
+  lpc935-prog is free software; you can redistribute it and/or modify
+  it under the terms of the Lesser GNU General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  lpc935-prog is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser
+  GNU General Public License for more details.
+
+  You should have received a copy of the Lesser GNU General Public
+  License along with lpc935-prog; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+  USA
+*/
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+
+/* A trace file starts with this and is followed by one record per chunk
+   of bytes written to or read from the port:
+       1 byte  direction, SER_TX or SER_RX
+       4 bytes microseconds since the record before, little endian
+       2 bytes length of the chunk, little endian
+       the bytes of the chunk */
+#define TRC_MAGIC      "LPCTRC1\n"
+#define TRC_MAGIC_SIZE 8
+#define TRC_HEADER     7
+/* Longer chunks are split over several records */
+#define TRC_MAX_CHUNK  4096
+
+typedef struct
+{
+    FILE *psFile; /**< Open trace file */
+    long long llLast; /**< Time of the record before, in microseconds */
+} tsTrace;
+
+/* One record read back from a trace file */
+typedef struct
+{
+    int zDir; /**< SER_TX or SER_RX */
+    long long llTime; /**< Microseconds since the trace started */
+    int zLen; /**< Bytes in abData */
+    unsigned char abData[ TRC_MAX_CHUNK ];
+} tsTraceRec;
+
+int trc_Open( tsTrace *psTrc, const char *pacFile );
+int trc_OpenRead( tsTrace *psTrc, const char *pacFile );
+int trc_Close( tsTrace *psTrc );
+void trc_Chunk( void *pvUser, int zDir, const void *pvBuf, int zLen );
+int trc_Next( tsTrace *psTrc, tsTraceRec *psRec );
+
+#endif